@@ -0,0 +1,132 @@
+#include "block.h"
+
+CellBlock::CellBlock(std::string data, uint32_t format) : data(std::move(data)), format(format), restartNumber(0)
+{
+    entryBytes = this->data.size();
+    if(format == TABLE_FORMAT_V2){
+        std::memcpy(&restartNumber, this->data.data() + this->data.size() - sizeof(uint32_t), sizeof(uint32_t));
+        entryBytes -= (uint64_t)(restartNumber + 1) * sizeof(uint32_t);
+    }
+}
+
+uint32_t CellBlock::restart(uint32_t i) const
+{
+    uint32_t pos;
+    std::memcpy(&pos, data.data() + entryBytes + (uint64_t)i * sizeof(uint32_t), sizeof(uint32_t));
+    return pos;
+}
+
+// 重启点处写入完整的键与偏移量，其余写入差值；偏移量在合并后的文件中不一定递增，因此差值使用zigzag编码
+void BlockBuilder::add(uint64_t key, uint64_t offset, uint32_t vlen)
+{
+    char bytes[30];
+    char *dst = bytes;
+    if(counter == 0){
+        restarts.push_back(buffer.size());
+        varint_to_byte(key, &dst);
+        varint_to_byte(offset, &dst);
+    } else {
+        varint_to_byte(key - lastKey, &dst);
+        varint_to_byte(zigzag_encode((int64_t)(offset - lastOffset)), &dst);
+    }
+    varint_to_byte(vlen, &dst);
+    buffer.append(bytes, dst - bytes);
+    counter = (counter + 1) % TABLE_RESTART_INTERVAL;
+    lastKey = key;
+    lastOffset = offset;
+}
+
+std::string BlockBuilder::finish()
+{
+    char bytes[sizeof(uint32_t)];
+    for(auto restart : restarts){
+        char *dst = bytes;
+        uint32_to_byte(restart, &dst);
+        buffer.append(bytes, sizeof(uint32_t));
+    }
+    char *dst = bytes;
+    uint32_to_byte(restarts.size(), &dst);
+    buffer.append(bytes, sizeof(uint32_t));
+
+    std::string result;
+    result.swap(buffer);
+    restarts.clear();
+    counter = 0;
+    return result;
+}
+
+BlockIterator::BlockIterator(std::shared_ptr<const CellBlock> block) : block(std::move(block))
+{
+    seek_to_first();
+}
+
+void BlockIterator::decode()
+{
+    if(nextPos >= block->entryBytes){
+        isValid = false;
+        return;
+    }
+    char *base = const_cast<char *>(block->data.data());
+    char *src = base + nextPos;
+    if(block->format == TABLE_FORMAT_V1){
+        currentKey = byte_to_uint64(&src);
+        currentOffset = byte_to_uint64(&src);
+        currentVlen = byte_to_uint32(&src);
+    } else {
+        if(nextRestart < block->restartNumber && block->restart(nextRestart) == nextPos){
+            currentKey = byte_to_varint(&src);
+            currentOffset = byte_to_varint(&src);
+            nextRestart++;
+        } else {
+            currentKey += byte_to_varint(&src);
+            currentOffset += zigzag_decode(byte_to_varint(&src));
+        }
+        currentVlen = (uint32_t)byte_to_varint(&src);
+    }
+    nextPos = src - base;
+    isValid = true;
+}
+
+uint64_t BlockIterator::key_at(uint64_t pos) const
+{
+    char *src = const_cast<char *>(block->data.data()) + pos;
+    return (block->format == TABLE_FORMAT_V1) ? byte_to_uint64(&src) : byte_to_varint(&src);
+}
+
+void BlockIterator::seek_to_first()
+{
+    nextPos = 0;
+    nextRestart = 0;
+    decode();
+}
+
+void BlockIterator::seek(uint64_t key)
+{
+    if(block->format == TABLE_FORMAT_V1){
+        // 定长元组直接二分
+        uint64_t low = 0;
+        uint64_t high = block->entryBytes / CELL_LENGTH;
+        while(low < high){
+            uint64_t mid = (low + high) / 2;
+            if(key_at(mid * CELL_LENGTH) < key) low = mid + 1;
+            else high = mid;
+        }
+        nextPos = low * CELL_LENGTH;
+        decode();
+        return;
+    }
+    // 找到最后一个键不大于key的重启点，再顺序解码
+    uint32_t low = 0;
+    uint32_t high = block->restartNumber;
+    while(low + 1 < high){
+        uint32_t mid = (low + high) / 2;
+        if(key_at(block->restart(mid)) <= key) low = mid;
+        else high = mid;
+    }
+    nextPos = (block->restartNumber > 0) ? block->restart(low) : 0;
+    nextRestart = low;
+    decode();
+    while(isValid && currentKey < key){
+        decode();
+    }
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include "global.h"
+
+/*
+ * 从SSTable中读出的一块元组的原始字节
+ * v1格式的块为连续的20字节元组，可以直接二分查找
+ * v2格式的块中，重启点处的元组存放完整的键与偏移量，其余元组存放与前一个元组的差值，值长度均为变长整数
+ * 块的末尾依次为各重启点的位置与重启点数（均为uint32）
+ */
+struct CellBlock{
+    std::string data;
+    uint32_t format;
+    uint32_t restartNumber; // 重启点数，v1格式为0
+    uint64_t entryBytes; // 元组部分的字节数
+
+    CellBlock(std::string data, uint32_t format);
+
+    // 第i个重启点在块中的位置
+    uint32_t restart(uint32_t i) const;
+
+    uint64_t byteSize() const { return data.size() + sizeof(CellBlock); }
+};
+
+// 依次写入有序的元组，生成v2格式的数据块
+class BlockBuilder{
+private:
+    std::string buffer;
+    std::vector<uint32_t> restarts;
+    uint32_t counter; // 距离上一个重启点的元组数
+    uint64_t lastKey;
+    uint64_t lastOffset;
+
+public:
+    BlockBuilder() : counter(0), lastKey(0), lastOffset(0) {}
+
+    void add(uint64_t key, uint64_t offset, uint32_t vlen);
+
+    bool empty() const { return buffer.empty(); }
+
+    // 完成后块的字节数
+    uint64_t sizeEstimate() const { return buffer.size() + (restarts.size() + 1) * sizeof(uint32_t); }
+
+    // 追加重启点并返回整个块，之后可以开始下一个块
+    std::string finish();
+};
+
+/*
+ * 块内的迭代器，对两种格式的块提供相同的接口
+ * v2格式查找时先在重启点上二分，再从重启点开始顺序解码，至多解码TABLE_RESTART_INTERVAL个元组
+ */
+class BlockIterator{
+private:
+    std::shared_ptr<const CellBlock> block;
+    uint64_t nextPos; // 下一个元组在块中的位置
+    uint32_t nextRestart; // 下一个重启点的序号
+    bool isValid;
+    uint64_t currentKey;
+    uint64_t currentOffset;
+    uint32_t currentVlen;
+
+    // 解码nextPos处的元组
+    void decode();
+
+    // 位于pos处的元组的键，pos须为重启点或v1格式的元组起点
+    uint64_t key_at(uint64_t pos) const;
+
+public:
+    // 创建后位于第一个元组
+    explicit BlockIterator(std::shared_ptr<const CellBlock> block);
+
+    void seek_to_first();
+
+    // 移动到第一个不小于key的元组
+    void seek(uint64_t key);
+
+    void next() { decode(); }
+
+    bool valid() const { return isValid; }
+
+    uint64_t key() const { return currentKey; }
+
+    uint64_t offset() const { return currentOffset; }
+
+    uint32_t vlen() const { return currentVlen; }
+};
@@ -0,0 +1,105 @@
+#include "blockcache.h"
+
+void BlockCache::evict(Shard &shard)
+{
+    uint64_t shardCapacity = capacity / BLOCK_CACHE_SHARDS;
+    while(shard.usage > shardCapacity && !(shard.lowList.empty() && shard.highList.empty())){
+        std::list<Entry> &victimList = shard.lowList.empty() ? shard.highList : shard.lowList;
+        Entry &victim = victimList.back();
+        shard.usage -= victim.charge;
+        shard.table.erase(victim.key);
+        victimList.pop_back();
+        shard.stats.evictions++;
+    }
+}
+
+std::shared_ptr<const CellBlock> BlockCache::lookup(uint64_t tableId, uint64_t blockIndex)
+{
+    BlockKey key(tableId, blockIndex);
+    Shard &shard = shard_of(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.table.find(key);
+    if(it == shard.table.end()){
+        shard.stats.misses++;
+        return nullptr;
+    }
+    shard.stats.hits++;
+    std::list<Entry> &list = it->second->highPriority ? shard.highList : shard.lowList;
+    list.splice(list.begin(), list, it->second);
+    return it->second->block;
+}
+
+void BlockCache::insert(uint64_t tableId, uint64_t blockIndex, std::shared_ptr<const CellBlock> block, bool highPriority)
+{
+    BlockKey key(tableId, blockIndex);
+    Shard &shard = shard_of(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.table.find(key);
+    if(it != shard.table.end()){
+        shard.usage -= it->second->charge;
+        (it->second->highPriority ? shard.highList : shard.lowList).erase(it->second);
+        shard.table.erase(it);
+    }
+    std::list<Entry> &list = highPriority ? shard.highList : shard.lowList;
+    list.push_front(Entry{key, block, block->byteSize(), highPriority});
+    shard.table[key] = list.begin();
+    shard.usage += block->byteSize();
+    evict(shard);
+}
+
+void BlockCache::erase(uint64_t tableId, uint64_t blockNumber)
+{
+    for(uint64_t blockIndex = 0; blockIndex < blockNumber; blockIndex++){
+        BlockKey key(tableId, blockIndex);
+        Shard &shard = shard_of(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.table.find(key);
+        if(it == shard.table.end()) continue;
+        shard.usage -= it->second->charge;
+        (it->second->highPriority ? shard.highList : shard.lowList).erase(it->second);
+        shard.table.erase(it);
+    }
+}
+
+void BlockCache::clear()
+{
+    for(auto &shard : shards){
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.lowList.clear();
+        shard.highList.clear();
+        shard.table.clear();
+        shard.usage = 0;
+        shard.stats = BlockCacheStats();
+    }
+}
+
+void BlockCache::set_capacity(uint64_t bytes)
+{
+    capacity = bytes;
+    for(auto &shard : shards){
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        evict(shard);
+    }
+}
+
+uint64_t BlockCache::usage()
+{
+    uint64_t total = 0;
+    for(auto &shard : shards){
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        total += shard.usage;
+    }
+    return total;
+}
+
+BlockCacheStats BlockCache::stats()
+{
+    BlockCacheStats total;
+    for(auto &shard : shards){
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        total.hits += shard.stats.hits;
+        total.misses += shard.stats.misses;
+        total.evictions += shard.stats.evictions;
+    }
+    return total;
+}
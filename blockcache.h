@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "MurmurHash3.h"
+#include "global.h"
+#include "block.h"
+
+// 块缓存的命中统计
+struct BlockCacheStats{
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+};
+
+/*
+ * 按字节限制容量的分片LRU块缓存
+ * 键为<SSTable编号, 块号>，按哈希分到各个分片，每片各自加锁、各自淘汰
+ * 每片维护高低两条优先级的LRU链表，总是先淘汰低优先级的块，高优先级的块（如level-0）只在没有低优先级块时才被淘汰
+ * 块以shared_ptr返回，被淘汰时正在使用它的查询不受影响
+ */
+class BlockCache{
+private:
+    typedef std::pair<uint64_t, uint64_t> BlockKey;
+
+    struct BlockKeyHash{
+        size_t operator()(const BlockKey &key) const { return fmix64(key.first * 0x9e3779b97f4a7c15ULL + key.second); }
+    };
+
+    struct Entry{
+        BlockKey key;
+        std::shared_ptr<const CellBlock> block;
+        uint64_t charge;
+        bool highPriority;
+    };
+
+    struct Shard{
+        std::mutex mutex;
+        std::list<Entry> lowList; // 表头为最近使用
+        std::list<Entry> highList;
+        std::unordered_map<BlockKey, std::list<Entry>::iterator, BlockKeyHash> table;
+        uint64_t usage = 0;
+        BlockCacheStats stats;
+    };
+
+    Shard shards[BLOCK_CACHE_SHARDS];
+    uint64_t capacity; // 总容量，每片各占1 / BLOCK_CACHE_SHARDS
+
+    Shard &shard_of(const BlockKey &key) { return shards[BlockKeyHash()(key) % BLOCK_CACHE_SHARDS]; }
+
+    // 淘汰直到该片的用量不超过容量
+    void evict(Shard &shard);
+
+public:
+    explicit BlockCache(uint64_t capacity = BLOCK_CACHE_BYTES) : capacity(capacity) {}
+
+    // 查找块，不存在时返回空指针；命中时移到链表头部
+    std::shared_ptr<const CellBlock> lookup(uint64_t tableId, uint64_t blockIndex);
+
+    // 插入块，已存在时替换
+    void insert(uint64_t tableId, uint64_t blockIndex, std::shared_ptr<const CellBlock> block, bool highPriority);
+
+    // 删除某个SSTable的全部块，SSTable被合并删除后调用
+    void erase(uint64_t tableId, uint64_t blockNumber);
+
+    void clear();
+
+    void set_capacity(uint64_t bytes);
+
+    uint64_t getCapacity() const { return capacity; }
+
+    uint64_t usage();
+
+    BlockCacheStats stats();
+};
@@ -1,51 +1,143 @@
 #include "bloomfilter.h"
 
-// 构造函数
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    // 每个字各使用一个乘法常数，从同一个32位种子派生出8个相互独立的探测位
+    const uint32_t BLOOM_SALT[BLOOM_BLOCK_WORDS] = {
+        0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+        0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+    };
+
+    // 计算键的哈希，高32位用于选块，低32位作为块内探测的种子
+    inline uint64_t bloom_hash(uint64_t key)
+    {
+        uint64_t hash[2] = {0}; // 产生一个128-bit的结果
+        MurmurHash3_x64_128(&key, sizeof(key), 1, hash);
+        return hash[0];
+    }
+
+    // 将哈希映射到[0, blockNum)，用乘法代替取模
+    inline uint32_t bloom_block(uint64_t hash, uint32_t blockNum)
+    {
+        return (uint32_t)(((hash >> 32) * blockNum) >> 32);
+    }
+
+#if defined(__AVX2__)
+    // 一次算出块内8个字各自的掩码，分为低4个字与高4个字
+    inline void bloom_mask(uint32_t seed, __m256i &low, __m256i &high)
+    {
+        const __m256i salt = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(BLOOM_SALT));
+        __m256i bit = _mm256_mullo_epi32(_mm256_set1_epi32(seed), salt);
+        bit = _mm256_srli_epi32(bit, 26); // 取高6位，即字内的位序号
+        const __m256i one = _mm256_set1_epi64x(1);
+        low = _mm256_sllv_epi64(one, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(bit)));
+        high = _mm256_sllv_epi64(one, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(bit, 1)));
+    }
+#endif
+}
+
+// 构造函数，默认只有一个块
 BloomFilter::BloomFilter()
 {
-    this->data.assign(length, 0);
+    blockNum = 1;
+    data.assign(blockNum, BloomBlock{});
+}
+
+// 按键数与每键位数计算块数
+BloomFilter::BloomFilter(uint64_t keyNumber, uint32_t bitsPerKey)
+{
+    uint64_t bits = keyNumber * bitsPerKey;
+    blockNum = (bits + BLOOM_BLOCK_BYTES * 8 - 1) / (BLOOM_BLOCK_BYTES * 8);
+    if(blockNum == 0) blockNum = 1;
+    data.assign(blockNum, BloomBlock{});
 }
 
 // 在将Memtable转换为SSTable时，一一插入所有键，此后将BloomFilter存入硬盘
 void BloomFilter::insert(uint64_t key)
 {
-    uint64_t hash[2] = {0}; // 产生一个128-bit的结果
-    MurmurHash3_x64_128(&key,sizeof(key),1,hash);
-    
-    // 根据哈希值进行插入
-    data[hash[0] % length] = 1;
-    data[(hash[0] >> 32) % length] = 1;
-    data[hash[1] % length] = 1;
-    data[(hash[1] >> 32) % length] = 1;
+    uint64_t hash = bloom_hash(key);
+    BloomBlock &block = data[bloom_block(hash, blockNum)];
+    uint32_t seed = (uint32_t)hash;
+#if defined(__AVX2__)
+    __m256i low, high;
+    bloom_mask(seed, low, high);
+    __m256i *words = reinterpret_cast<__m256i *>(block.words);
+    _mm256_store_si256(words, _mm256_or_si256(_mm256_load_si256(words), low));
+    _mm256_store_si256(words + 1, _mm256_or_si256(_mm256_load_si256(words + 1), high));
+#else
+    for(int i = 0; i < BLOOM_BLOCK_WORDS; i++){
+        block.words[i] |= (uint64_t)1 << ((seed * BLOOM_SALT[i]) >> 26);
+    }
+#endif
 }
 
 // 快速判断SSTable中是否存在某一键值对，但可能误判
-bool BloomFilter::search(uint64_t key)
+bool BloomFilter::search(uint64_t key) const
 {
-    uint64_t hash[2] = {0}; // 产生一个128-bit的结果
-    MurmurHash3_x64_128(&key,sizeof(key),1,hash);
-
-    if(data[hash[0] % length] 
-    && data[(hash[0] >> 32) % length] 
-    && data[hash[1] % length] 
-    && data[(hash[1] >> 32) % length]){
-        return true;
+    uint64_t hash = bloom_hash(key);
+    const BloomBlock &block = blocks()[bloom_block(hash, blockNum)];
+    uint32_t seed = (uint32_t)hash;
+#if defined(__AVX2__)
+    __m256i low, high;
+    bloom_mask(seed, low, high);
+    const __m256i *words = reinterpret_cast<const __m256i *>(block.words);
+    // testc在掩码的每一位都被置位时返回1
+    return _mm256_testc_si256(_mm256_load_si256(words), low)
+        && _mm256_testc_si256(_mm256_load_si256(words + 1), high);
+#else
+    for(int i = 0; i < BLOOM_BLOCK_WORDS; i++){
+        if(!(block.words[i] & ((uint64_t)1 << ((seed * BLOOM_SALT[i]) >> 26)))){
+            return false;
+        }
     }
-    return false;
+    return true;
+#endif
+}
+
+// 序列化后的字节数：类型标记、块数与所有块
+uint64_t BloomFilter::byteSize() const
+{
+    return 2 * sizeof(uint32_t) + (uint64_t)blockNum * BLOOM_BLOCK_BYTES;
 }
 
 // 将布隆过滤器变成一个字节数组
-void BloomFilter::bloom_to_byte(char ** dst)
+void BloomFilter::filter_to_byte(char ** dst)
 {
-    for(int i = 0; i < length; i++){
-        uint32_to_byte(data[i], dst);
+    uint32_to_byte(FILTER_MAGIC | FILTER_TYPE_BLOOM, dst);
+    uint32_to_byte(blockNum, dst);
+    const BloomBlock *source = blocks();
+    for(uint32_t b = 0; b < blockNum; b++){
+        for(int i = 0; i < BLOOM_BLOCK_WORDS; i++){
+            uint64_to_byte(source[b].words[i], dst);
+        }
     }
 }
 
-// 将字节数组变成布隆过滤器
+// 将字节数组变成布隆过滤器，调用前类型标记应已被读出
 void BloomFilter::byte_to_bloom(char **src)
 {
-    for(int i = 0; i < length; i++){
-        data[i] = byte_to_uint32(src);
+    blockNum = byte_to_uint32(src);
+    data.assign(blockNum, BloomBlock{});
+    for(auto &block : data){
+        for(int i = 0; i < BLOOM_BLOCK_WORDS; i++){
+            block.words[i] = byte_to_uint64(src);
+        }
+    }
+}
+
+bool BloomFilter::map_bloom(const char *src, std::shared_ptr<MappedFile> mappedFile)
+{
+    const char *words = src + sizeof(uint32_t);
+    if((uintptr_t)words % BLOOM_BLOCK_BYTES != 0){
+        return false;
     }
+    std::memcpy(&blockNum, src, sizeof(uint32_t));
+    std::vector<BloomBlock>().swap(data);
+    mapped = (const BloomBlock *)words;
+    file = mappedFile;
+    return true;
 }
@@ -3,28 +3,44 @@
 #include <cstdint>
 #include "MurmurHash3.h"
 #include "global.h"
-
-// 布隆过滤器
-class BloomFilter{
+#include "filter.h"
+
+// 布隆过滤器的一个块，恰好占据一个64字节的缓存行
+struct alignas(BLOOM_BLOCK_BYTES) BloomBlock{
+    uint64_t words[BLOOM_BLOCK_WORDS];
+};
+
+/*
+ * 分块布隆过滤器
+ * 位数组按64字节分块，一个键的全部探测位都落在同一个块内的不同字中，
+ * 因此一次否定查询只会产生一次缓存未命中，且可以使用SIMD一次完成探测
+ * 块数由键数与每个键分配的位数决定
+ */
+class BloomFilter : public Filter{
 private:
-    std::vector<uint32_t> data; // 存放数组，保证其为8192个字节
-    const int length = HASH_LENGTH; // 哈希数组大小,此时误报率较小
-    const int hashNumber = 4; // 哈希函数个数为4
+    std::vector<BloomBlock> data; // 位数组
+    uint32_t blockNum; // 块数
+    const BloomBlock *mapped = nullptr; // 映射在文件中的位数组，为空时使用data
+    std::shared_ptr<MappedFile> file; // 保证映射在过滤器存活期间有效
+
+    const BloomBlock *blocks() const { return mapped ? mapped : data.data(); }
 
 public:
     BloomFilter();
 
-    // 自定义赋值运算符重载函数
-    BloomFilter& operator=(const BloomFilter& other) {
-        data = other.data;
-        return *this;
-    }
+    BloomFilter(uint64_t keyNumber, uint32_t bitsPerKey = BLOOM_BITS_PER_KEY);
 
     void insert(uint64_t key);
 
-    bool search(uint64_t key);
+    bool search(uint64_t key) const override;
 
-    void bloom_to_byte(char ** dst);
+    // 序列化后的字节数（含过滤器段的头部）
+    uint64_t byteSize() const override;
+
+    void filter_to_byte(char ** dst) override;
 
     void byte_to_bloom(char **src);
-};
\ No newline at end of file
+
+    // 原地使用映射中的位数组，块未按缓存行对齐时返回false
+    bool map_bloom(const char *src, std::shared_ptr<MappedFile> mappedFile);
+};
@@ -0,0 +1,243 @@
+#include "compactionpicker.h"
+#include <cmath>
+
+// 第level层的文件，层不存在时为空
+static const std::map<std::string, CacheTable> &level_tables(const SSTable &sstable, uint32_t level)
+{
+    static const std::map<std::string, CacheTable> empty;
+    auto levelIt = sstable.cacheMap.find(level);
+    return (levelIt == sstable.cacheMap.end()) ? empty : levelIt->second;
+}
+
+static uint64_t level_bytes(const SSTable &sstable, uint32_t level)
+{
+    uint64_t bytes = 0;
+    for(auto &cachePair : level_tables(sstable, level)){
+        bytes += cachePair.second.fileSize;
+    }
+    return bytes;
+}
+
+// 第level层的文件数容量，尚未创建的层按扇出推算
+static uint64_t level_capacity(const SSTable &sstable, uint32_t level)
+{
+    auto capacityIt = sstable.levelFileNum.find(level);
+    if(capacityIt != sstable.levelFileNum.end()){
+        return capacityIt->second;
+    }
+    return (level == 0) ? 2 : sstable.compactionFanout * level_capacity(sstable, level - 1);
+}
+
+// 有文件的最深层，都为空时为0
+static uint32_t deepest_level(const SSTable &sstable)
+{
+    for(auto levelIt = sstable.cacheMap.rbegin(); levelIt != sstable.cacheMap.rend(); levelIt++){
+        if(!levelIt->second.empty()){
+            return levelIt->first;
+        }
+    }
+    return 0;
+}
+
+// level-1的字节目标：文件数容量乘以level-1及以下文件的平均字节数，没有文件时按每个元组CELL_LENGTH字节估计
+static double base_bytes(const SSTable &sstable)
+{
+    uint64_t files = 0;
+    uint64_t bytes = 0;
+    for(auto levelIt = sstable.cacheMap.upper_bound(0); levelIt != sstable.cacheMap.end(); levelIt++){
+        for(auto &cachePair : levelIt->second){
+            files++;
+            bytes += cachePair.second.fileSize;
+        }
+    }
+    double tableBytes = (files > 0) ? (double)bytes / files : (double)sstable.table_keys() * CELL_LENGTH;
+    return level_capacity(sstable, 1) * tableBytes;
+}
+
+// 动态目标下第level层的字节目标，最深层为触发移到新一层的大小
+static double target_bytes(const SSTable &sstable, uint32_t level, uint32_t deepest)
+{
+    double fanout = sstable.compactionFanout;
+    double base = base_bytes(sstable);
+    if(level == deepest){
+        return base * std::pow(fanout, deepest);
+    }
+    return std::max(level_bytes(sstable, deepest) / std::pow(fanout, deepest - level), base);
+}
+
+// key所在的守卫区间的起点，第一个守卫之前的区间为0
+static uint64_t guard_of(const std::set<uint64_t> &guards, uint64_t key)
+{
+    auto guardIt = guards.upper_bound(key);
+    return (guardIt == guards.begin()) ? 0 : *std::prev(guardIt);
+}
+
+std::unique_ptr<CompactionPicker> CompactionPicker::create(CompactionStyle style)
+{
+    switch(style){
+        case COMPACTION_TIERED:
+            return std::make_unique<TieredPicker>();
+        case COMPACTION_LAZY_LEVELING:
+            return std::make_unique<LazyLevelingPicker>();
+        case COMPACTION_GUARDED:
+            return std::make_unique<GuardedPicker>();
+        default:
+            return std::make_unique<LeveledPicker>();
+    }
+}
+
+// level-0的文件互相重叠，总是按文件数计算
+double LeveledPicker::score(const SSTable &sstable, uint32_t level) const
+{
+    uint64_t files = level_tables(sstable, level).size();
+    if(files == 0){
+        return 0;
+    }
+    if(level == 0 || !sstable.dynamicLevelBytes){
+        return (double)files / level_capacity(sstable, level);
+    }
+    return level_bytes(sstable, level) / target_bytes(sstable, level, deepest_level(sstable));
+}
+
+// 动态目标下按时间戳从旧到新累计，直到剩余的字节数不超过目标；最深层整层移动
+uint64_t LeveledPicker::overflow_files(const SSTable &sstable, uint32_t level) const
+{
+    const std::map<std::string, CacheTable> &tables = level_tables(sstable, level);
+    if(level == 0){
+        return tables.size();
+    }
+    if(!sstable.dynamicLevelBytes){
+        uint64_t capacity = level_capacity(sstable, level);
+        return (tables.size() > capacity) ? tables.size() - capacity : 0;
+    }
+    uint32_t deepest = deepest_level(sstable);
+    if(level == deepest){
+        return tables.size();
+    }
+    std::vector<std::tuple<uint64_t, uint64_t, uint64_t>> ages; // <时间戳，最小键，字节数>，与select_overflow的顺序一致
+    for(auto &cachePair : tables){
+        ages.emplace_back(cachePair.second.timeStamp, cachePair.second.minKey, cachePair.second.fileSize);
+    }
+    std::sort(ages.begin(), ages.end());
+    double remaining = level_bytes(sstable, level);
+    double target = target_bytes(sstable, level, deepest);
+    uint64_t selected = 0;
+    while(selected < ages.size() && (selected == 0 || remaining > target)){
+        remaining -= std::get<2>(ages[selected]);
+        selected++;
+    }
+    return selected;
+}
+
+double TieredPicker::score(const SSTable &sstable, uint32_t level) const
+{
+    return (double)level_tables(sstable, level).size() / level_capacity(sstable, level);
+}
+
+uint64_t TieredPicker::overflow_files(const SSTable &sstable, uint32_t level) const
+{
+    return level_tables(sstable, level).size();
+}
+
+// 下一层就是最深层，或者还没有文件
+bool LazyLevelingPicker::merge_next_level(const SSTable &sstable, uint32_t level) const
+{
+    return deepest_level(sstable) <= level + 1;
+}
+
+double GuardedPicker::score(const SSTable &sstable, uint32_t level) const
+{
+    if(level == 0){
+        return TieredPicker::score(sstable, level);
+    }
+    const std::set<uint64_t> &guards = sstable.level_guards(level);
+    std::map<uint64_t, uint64_t> fragments; // <区间起点，片段数>
+    uint64_t keys = 0;
+    uint64_t most = 0;
+    for(auto &cachePair : level_tables(sstable, level)){
+        keys += cachePair.second.KVNumber;
+        most = std::max(most, ++fragments[guard_of(guards, cachePair.second.minKey)]);
+    }
+    return std::max((double)keys / (level_capacity(sstable, level) * sstable.table_keys()),
+        (double)most / sstable.compactionFanout);
+}
+
+/*
+ * 文件按最小键归入守卫区间，取片段最多的区间，相同时取键较小者
+ * 守卫是陆续采样的，已有的片段可能跨过新的守卫，因此再加入与输入的键区间重叠的其余文件，直到不再增加；
+ * 这样本层剩下的文件都不与输入重叠，输出的时间戳被压低时也不会覆盖它们的版本
+ */
+bool GuardedPicker::pick_files(const SSTable &sstable, uint32_t level, std::vector<std::pair<std::string, CacheTable>> &selected) const
+{
+    if(level == 0){
+        return false;
+    }
+    const std::map<std::string, CacheTable> &tables = level_tables(sstable, level);
+    const std::set<uint64_t> &guards = sstable.level_guards(level);
+    std::map<uint64_t, uint64_t> fragments; // <区间起点，片段数>
+    for(auto &cachePair : tables){
+        fragments[guard_of(guards, cachePair.second.minKey)]++;
+    }
+    if(fragments.empty()){
+        return false;
+    }
+    uint64_t guard = 0;
+    uint64_t most = 0;
+    for(auto &fragmentPair : fragments){
+        if(fragmentPair.second > most){
+            guard = fragmentPair.first;
+            most = fragmentPair.second;
+        }
+    }
+    std::vector<bool> chosen;
+    uint64_t minKey = UINT64_MAX;
+    uint64_t maxKey = 0;
+    for(auto &cachePair : tables){
+        bool inGuard = (guard_of(guards, cachePair.second.minKey) == guard);
+        chosen.push_back(inGuard);
+        if(inGuard){
+            minKey = std::min(minKey, cachePair.second.minKey);
+            maxKey = std::max(maxKey, cachePair.second.maxKey);
+        }
+    }
+    for(bool grown = true; grown; ){
+        grown = false;
+        uint64_t i = 0;
+        for(auto &cachePair : tables){
+            if(!chosen[i] && cachePair.second.minKey <= maxKey && cachePair.second.maxKey >= minKey){
+                chosen[i] = true;
+                minKey = std::min(minKey, cachePair.second.minKey);
+                maxKey = std::max(maxKey, cachePair.second.maxKey);
+                grown = true;
+            }
+            i++;
+        }
+    }
+    uint64_t i = 0;
+    for(auto &cachePair : tables){
+        if(chosen[i++]){
+            selected.emplace_back(cachePair);
+        }
+    }
+    // 归并时时间戳相同的版本取靠前的输入，同一层中时间戳相同的重叠片段以后写入的为准
+    std::sort(selected.begin(), selected.end(), [](const auto &item1, const auto &item2){
+        return (item1.second.timeStamp > item2.second.timeStamp)
+            || ((item1.second.timeStamp == item2.second.timeStamp)
+            && (item1.second.fileNumber > item2.second.fileNumber));
+    });
+    return true;
+}
+
+std::vector<uint64_t> GuardedPicker::output_cuts(const SSTable &sstable, uint32_t level) const
+{
+    const std::set<uint64_t> &guards = sstable.level_guards(level + 1);
+    return std::vector<uint64_t>(guards.begin(), guards.end());
+}
+
+// 跨过下一层守卫的文件重写后才能按下一层的区间切分
+bool GuardedPicker::can_move(const SSTable &sstable, uint32_t level, const CacheTable &cacheTable) const
+{
+    const std::set<uint64_t> &guards = sstable.level_guards(level + 1);
+    auto guardIt = guards.upper_bound(cacheTable.minKey);
+    return guardIt == guards.end() || *guardIt > cacheTable.maxKey;
+}
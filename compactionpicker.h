@@ -0,0 +1,93 @@
+#pragma once
+
+#include "sstable.h"
+
+/*
+ * 合并策略接口
+ * 决定每层何时需要合并、选出该层的多少个文件，以及是否与下一层中键区间重叠的文件一起重写
+ * 不重写下一层时，输出作为一个新的有序段放入下一层，同一层的各段键区间可以重叠，读操作按时间戳取最新的版本
+ * 调用者持有versionMutex，实现只读取cacheMap、levelFileNum、守卫键与合并选项，不加锁
+ */
+class CompactionPicker{
+public:
+    virtual ~CompactionPicker() {}
+
+    // 第level层超出目标的程度，大于1时需要合并
+    virtual double score(const SSTable &sstable, uint32_t level) const = 0;
+
+    // 第level层中参与合并的文件数，按时间戳从旧到新选取
+    virtual uint64_t overflow_files(const SSTable &sstable, uint32_t level) const = 0;
+
+    // 是否同时重写下一层中与输入重叠的文件
+    virtual bool merge_next_level(const SSTable &sstable, uint32_t level) const = 0;
+
+    // 自行选出第level层的输入文件，时间戳相同时编号大的在前；返回false时按overflow_files与compactionPriority选择
+    virtual bool pick_files(const SSTable &sstable, uint32_t level, std::vector<std::pair<std::string, CacheTable>> &selected) const { return false; }
+
+    // 输出文件在这些键处切分，升序
+    virtual std::vector<uint64_t> output_cuts(const SSTable &sstable, uint32_t level) const { return {}; }
+
+    // 输入文件能否原样移到下一层
+    virtual bool can_move(const SSTable &sstable, uint32_t level, const CacheTable &cacheTable) const { return true; }
+
+    static std::unique_ptr<CompactionPicker> create(CompactionStyle style);
+};
+
+/*
+ * 分层合并
+ * 每层的文件数容量为上一层的compactionFanout倍，溢出的旧文件与下一层重叠的文件一起重写，level-1及以下每层只有一个有序段
+ * dynamicLevelBytes为真时按字节计算目标：最深层的目标为它的实际大小，其上各层依次除以扇出，但不小于level-1的基准；
+ * 最深层超过基准乘以扇出的层数次方时整层移到新的一层，使最深层始终占数据的大部分，空间放大有界
+ */
+class LeveledPicker : public CompactionPicker{
+public:
+    double score(const SSTable &sstable, uint32_t level) const override;
+
+    uint64_t overflow_files(const SSTable &sstable, uint32_t level) const override;
+
+    bool merge_next_level(const SSTable &sstable, uint32_t level) const override { return true; }
+};
+
+/*
+ * 分级合并（size-tiered / universal）
+ * 一层的文件数超过容量时，整层的各段归并为一段放入下一层，不重写下一层已有的段
+ * 每层的段都来自上一层的一次整层合并，大小相近；每个键在每层只被重写一次，写放大约为层数，代价是每层最多约扇出个段
+ */
+class TieredPicker : public CompactionPicker{
+public:
+    double score(const SSTable &sstable, uint32_t level) const override;
+
+    uint64_t overflow_files(const SSTable &sstable, uint32_t level) const override;
+
+    bool merge_next_level(const SSTable &sstable, uint32_t level) const override { return false; }
+};
+
+/*
+ * 惰性分层（lazy leveling），介于两者之间
+ * 除最深层外按分级合并；合并到最深层时与其中重叠的文件一起重写，最深层只有一个有序段
+ * 最深层溢出时整层移到新的一层，原来的层变为空的分级层
+ */
+class LazyLevelingPicker : public TieredPicker{
+public:
+    bool merge_next_level(const SSTable &sstable, uint32_t level) const override;
+};
+
+/*
+ * 分段布局（fragmented LSM，参照PebblesDB）
+ * level-1及以下每层按守卫键划分为区间，区间内的片段可以互相重叠；一层溢出时只合并片段最多的一个区间，
+ * 输出在下一层的守卫键处切分，作为新的片段追加到下一层对应的区间，不重写下一层已有的文件
+ * 每个键在每层只被重写一次，写放大与分级合并相近，而每次合并只涉及一个区间；点查询按键区间只访问所在区间的片段，各片段有自己的过滤器
+ * level-0照常整层合并
+ */
+class GuardedPicker : public TieredPicker{
+public:
+    // 片段在守卫处切分，常常不满一个文件，level-1及以下按键数计算，容量为文件数容量乘以每个文件的键数；
+    // 一个守卫区间的片段数超过扇出时也需要合并，限制点查询在每层访问的片段数
+    double score(const SSTable &sstable, uint32_t level) const override;
+
+    bool pick_files(const SSTable &sstable, uint32_t level, std::vector<std::pair<std::string, CacheTable>> &selected) const override;
+
+    std::vector<uint64_t> output_cuts(const SSTable &sstable, uint32_t level) const override;
+
+    bool can_move(const SSTable &sstable, uint32_t level, const CacheTable &cacheTable) const override;
+};
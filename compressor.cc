@@ -0,0 +1,443 @@
+#include "compressor.h"
+#include <chrono>
+#include <unordered_map>
+#include <unordered_set>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+CompressionStats Compressor::stats[COMPRESSION_TYPE_NUMBER];
+
+bool Compressor::available(CompressionType type)
+{
+    switch(type){
+    case COMPRESSION_NONE:
+    case COMPRESSION_LZ:
+        return true;
+#ifdef HAVE_ZLIB
+    case COMPRESSION_ZLIB:
+        return true;
+#endif
+#ifdef HAVE_ZSTD
+    case COMPRESSION_ZSTD:
+        return true;
+#endif
+#ifdef HAVE_LZ4
+    case COMPRESSION_LZ4:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+const char *Compressor::name(CompressionType type)
+{
+    static const char *names[COMPRESSION_TYPE_NUMBER] = {"none", "lz", "zlib", "zstd", "lz4"};
+    return (type < COMPRESSION_TYPE_NUMBER) ? names[type] : "unknown";
+}
+
+static uint32_t lz_hash(const uint8_t *p, int bits)
+{
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(uint32_t));
+    return (v * 2654435761U) >> (32 - bits);
+}
+
+// 字典的哈希表只与字典内容有关，每个线程缓存最近使用的一份，避免每次编码都重新扫描字典
+struct LzDictionaryTable{
+    std::string dict;
+    std::vector<uint32_t> table; // 位置 + 1，0表示空
+};
+
+static const std::vector<uint32_t> &lz_dictionary_table(const std::string &dict)
+{
+    thread_local LzDictionaryTable cached;
+    if(cached.table.empty() || cached.dict != dict){
+        cached.dict = dict;
+        cached.table.assign((uint64_t)1 << LZ_HASH_BITS, 0);
+        const uint8_t *base = (const uint8_t *)dict.data();
+        uint64_t begin = (dict.size() > LZ_MAX_OFFSET) ? dict.size() - LZ_MAX_OFFSET : 0;
+        for(uint64_t p = begin; p + LZ_MIN_MATCH <= dict.size(); p++){
+            cached.table[lz_hash(base + p, LZ_HASH_BITS)] = p + 1;
+        }
+    }
+    return cached.table;
+}
+
+/*
+ * 内置的LZ77编码器
+ * 编码为若干组[字面量长度][字面量][匹配距离][匹配长度 - LZ_MIN_MATCH]，最后一组只有字面量
+ * 用哈希表记录每个4字节片段最近出现的位置，字典视为数据之前的历史，匹配可以指向字典
+ * 输入的哈希表按输入长度取位数，短值只需清空很小的表；字典另用缓存的哈希表，输入中找不到时再查字典
+ * level越大，找不到匹配时跳过得越慢，压缩率越高
+ */
+bool Compressor::lz_compress(const char *src, uint64_t size, std::string &dst, const std::string *dict, int level)
+{
+    uint64_t dictSize = dict ? dict->size() : 0;
+    if(dictSize + size > UINT32_MAX){
+        dict = nullptr;
+        dictSize = 0;
+    }
+    thread_local std::string history;
+    history.clear();
+    if(dict) history.append(*dict);
+    history.append(src, size);
+    const uint8_t *base = (const uint8_t *)history.data();
+    uint64_t end = history.size();
+
+    int bits = 8;
+    while(bits < LZ_HASH_BITS && ((uint64_t)1 << bits) < size) bits++;
+    thread_local std::vector<uint32_t> table;
+    table.assign((uint64_t)1 << bits, 0);
+    const std::vector<uint32_t> *dictTable = dictSize ? &lz_dictionary_table(*dict) : nullptr;
+    int skipShift = (level <= 0) ? 5 : std::min(5 + level, 16);
+
+    char bytes[2 * 10];
+    uint64_t anchor = dictSize;
+    uint64_t p = dictSize;
+    auto emit_literals = [&](uint64_t literalEnd){
+        char *out = bytes;
+        varint_to_byte(literalEnd - anchor, &out);
+        dst.append(bytes, out - bytes);
+        dst.append((const char *)base + anchor, literalEnd - anchor);
+    };
+    auto matches = [&](uint32_t slot){
+        return slot != 0 && p - (slot - 1) <= LZ_MAX_OFFSET && std::memcmp(base + slot - 1, base + p, LZ_MIN_MATCH) == 0;
+    };
+    while(p + LZ_MIN_MATCH <= end){
+        uint32_t h = lz_hash(base + p, bits);
+        uint32_t slot = table[h];
+        table[h] = p + 1;
+        if(!matches(slot) && dictTable){
+            slot = (*dictTable)[lz_hash(base + p, LZ_HASH_BITS)];
+        }
+        if(matches(slot)){
+            uint64_t candidate = slot - 1;
+            uint64_t length = LZ_MIN_MATCH;
+            while(p + length < end && base[candidate + length] == base[p + length]) length++;
+            emit_literals(p);
+            char *out = bytes;
+            varint_to_byte(p - candidate, &out);
+            varint_to_byte(length - LZ_MIN_MATCH, &out);
+            dst.append(bytes, out - bytes);
+            p += length;
+            anchor = p;
+        } else {
+            p += 1 + ((p - anchor) >> skipShift);
+        }
+    }
+    emit_literals(end);
+    return true;
+}
+
+bool Compressor::lz_decompress(const char *src, uint64_t size, char *dst, uint64_t rawSize, const std::string *dict)
+{
+    char *in = const_cast<char *>(src);
+    const char *inEnd = src + size;
+    uint64_t dictSize = dict ? dict->size() : 0;
+    uint64_t produced = 0;
+    while(true){
+        uint64_t literalLength;
+        if(!byte_to_varint(&in, inEnd, literalLength)) return false;
+        if(literalLength > (uint64_t)(inEnd - in) || literalLength > rawSize - produced) return false;
+        std::memcpy(dst + produced, in, literalLength);
+        in += literalLength;
+        produced += literalLength;
+        if(produced == rawSize) return true;
+        uint64_t distance, length;
+        if(!byte_to_varint(&in, inEnd, distance) || !byte_to_varint(&in, inEnd, length)) return false;
+        if(distance == 0 || distance > produced + dictSize || rawSize - produced < LZ_MIN_MATCH || length > rawSize - produced - LZ_MIN_MATCH) return false;
+        length += LZ_MIN_MATCH;
+        if(distance <= produced && distance >= length){
+            std::memcpy(dst + produced, dst + produced - distance, length);
+            produced += length;
+            continue;
+        }
+        // 匹配指向字典或与输出重叠时逐字节复制
+        for(uint64_t i = 0; i < length; i++, produced++){
+            int64_t from = (int64_t)produced - (int64_t)distance;
+            dst[produced] = (from < 0) ? (*dict)[dictSize + from] : dst[from];
+        }
+    }
+}
+
+#ifdef HAVE_ZLIB
+// deflate与inflate的状态约有几百KB，每个线程各保留一份，每次编解码前只需重置
+struct ZlibStreams{
+    z_stream deflater{};
+    z_stream inflater{};
+    int deflateLevel = 0;
+    bool deflaterReady = false;
+    bool inflaterReady = false;
+
+    ~ZlibStreams(){
+        if(deflaterReady) deflateEnd(&deflater);
+        if(inflaterReady) inflateEnd(&inflater);
+    }
+
+    z_stream *deflate_stream(int level){
+        if(deflaterReady && deflateLevel != level){
+            deflateEnd(&deflater);
+            deflaterReady = false;
+        }
+        if(!deflaterReady){
+            deflater = z_stream{};
+            // 使用不带头部的原始deflate流，短数据更省空间
+            if(deflateInit2(&deflater, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) return nullptr;
+            deflaterReady = true;
+            deflateLevel = level;
+        } else if(deflateReset(&deflater) != Z_OK){
+            return nullptr;
+        }
+        return &deflater;
+    }
+
+    z_stream *inflate_stream(){
+        if(!inflaterReady){
+            inflater = z_stream{};
+            if(inflateInit2(&inflater, -15) != Z_OK) return nullptr;
+            inflaterReady = true;
+        } else if(inflateReset(&inflater) != Z_OK){
+            return nullptr;
+        }
+        return &inflater;
+    }
+};
+
+static thread_local ZlibStreams zlibStreams;
+#endif
+
+#ifdef HAVE_ZSTD
+struct ZstdContexts{
+    ZSTD_CCtx *compressor = ZSTD_createCCtx();
+    ZSTD_DCtx *decompressor = ZSTD_createDCtx();
+
+    ~ZstdContexts(){
+        ZSTD_freeCCtx(compressor);
+        ZSTD_freeDCtx(decompressor);
+    }
+};
+
+static thread_local ZstdContexts zstdContexts;
+#endif
+
+bool Compressor::compress(CompressionType type, int level, const char *src, uint64_t size, std::string &dst, const std::string *dict)
+{
+    uint64_t old = dst.size();
+    switch(type){
+    case COMPRESSION_LZ:
+        return lz_compress(src, size, dst, dict, level);
+#ifdef HAVE_ZLIB
+    case COMPRESSION_ZLIB: {
+        z_stream *stream = zlibStreams.deflate_stream(level == 0 ? Z_DEFAULT_COMPRESSION : level);
+        if(!stream) return false;
+        if(dict) deflateSetDictionary(stream, (const Bytef *)dict->data(), dict->size());
+        uint64_t bound = deflateBound(stream, size);
+        dst.resize(old + bound);
+        stream->next_in = (Bytef *)src;
+        stream->avail_in = size;
+        stream->next_out = (Bytef *)&dst[old];
+        stream->avail_out = bound;
+        int ret = deflate(stream, Z_FINISH);
+        dst.resize(old + stream->total_out);
+        return ret == Z_STREAM_END;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    case COMPRESSION_ZSTD: {
+        uint64_t bound = ZSTD_compressBound(size);
+        dst.resize(old + bound);
+        size_t length = ZSTD_compress_usingDict(zstdContexts.compressor, &dst[old], bound, src, size,
+            dict ? dict->data() : nullptr, dict ? dict->size() : 0, level == 0 ? ZSTD_CLEVEL_DEFAULT : level);
+        if(ZSTD_isError(length)) return false;
+        dst.resize(old + length);
+        return true;
+    }
+#endif
+#ifdef HAVE_LZ4
+    case COMPRESSION_LZ4: {
+        int bound = LZ4_compressBound(size);
+        dst.resize(old + bound);
+        LZ4_stream_t *stream = LZ4_createStream();
+        if(dict) LZ4_loadDict(stream, dict->data(), dict->size());
+        int length = LZ4_compress_fast_continue(stream, src, &dst[old], size, bound, level <= 0 ? 1 : level);
+        LZ4_freeStream(stream);
+        if(length <= 0) return false;
+        dst.resize(old + length);
+        return true;
+    }
+#endif
+    default:
+        return false;
+    }
+}
+
+bool Compressor::decompress(CompressionType type, const char *src, uint64_t size, char *dst, uint64_t rawSize, const std::string *dict)
+{
+    switch(type){
+    case COMPRESSION_NONE:
+        if(size != rawSize) return false;
+        std::memcpy(dst, src, size);
+        return true;
+    case COMPRESSION_LZ:
+        return lz_decompress(src, size, dst, rawSize, dict);
+#ifdef HAVE_ZLIB
+    case COMPRESSION_ZLIB: {
+        z_stream *stream = zlibStreams.inflate_stream();
+        if(!stream) return false;
+        if(dict) inflateSetDictionary(stream, (const Bytef *)dict->data(), dict->size());
+        stream->next_in = (Bytef *)src;
+        stream->avail_in = size;
+        stream->next_out = (Bytef *)dst;
+        stream->avail_out = rawSize;
+        int ret = inflate(stream, Z_FINISH);
+        return ret == Z_STREAM_END && stream->total_out == rawSize;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    case COMPRESSION_ZSTD: {
+        size_t length = ZSTD_decompress_usingDict(zstdContexts.decompressor, dst, rawSize, src, size,
+            dict ? dict->data() : nullptr, dict ? dict->size() : 0);
+        return !ZSTD_isError(length) && length == rawSize;
+    }
+#endif
+#ifdef HAVE_LZ4
+    case COMPRESSION_LZ4: {
+        int length = dict ? LZ4_decompress_safe_usingDict(src, dst, size, rawSize, dict->data(), dict->size())
+            : LZ4_decompress_safe(src, dst, size, rawSize);
+        return length >= 0 && (uint64_t)length == rawSize;
+    }
+#endif
+    default:
+        return false;
+    }
+}
+
+void Compressor::encode(const CompressionOptions &options, const char *src, uint64_t size, std::string &dst,
+    uint32_t dictId, const std::string *dict)
+{
+    CompressionType type = available(options.type) ? options.type : COMPRESSION_LZ;
+    uint64_t old = dst.size();
+    char bytes[1 + 2 * 10];
+    char *out = bytes;
+    char_to_byte((char)type, &out);
+    varint_to_byte(dict ? dictId : 0, &out);
+    varint_to_byte(size, &out);
+    dst.append(bytes, out - bytes);
+
+    if(type != COMPRESSION_NONE){
+        auto start = std::chrono::steady_clock::now();
+        bool ok = compress(type, options.level, src, size, dst, dict);
+        auto end = std::chrono::steady_clock::now();
+        CompressionStats &stat = stats[type];
+        stat.compressCalls++;
+        stat.rawBytes += size;
+        stat.compressNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        if(ok && dst.size() - old < size){
+            stat.compressedBytes += dst.size() - old;
+            return;
+        }
+        stat.compressedBytes += size;
+    }
+    // 压缩失败或没有变小，按原样存放
+    dst.resize(old);
+    out = bytes;
+    char_to_byte((char)COMPRESSION_NONE, &out);
+    varint_to_byte(0, &out);
+    varint_to_byte(size, &out);
+    dst.append(bytes, out - bytes);
+    dst.append(src, size);
+}
+
+bool Compressor::decode(const char *src, uint64_t size, std::string &dst, const std::vector<std::string> *dictionaries)
+{
+    if(size < 3) return false;
+    char *in = const_cast<char *>(src);
+    CompressionType type = (CompressionType)(uint8_t)byte_to_char(&in);
+    uint64_t dictId, rawSize;
+    if(!byte_to_varint(&in, src + size, dictId) || !byte_to_varint(&in, src + size, rawSize) || !available(type)) return false;
+    const std::string *dict = nullptr;
+    if(dictId != 0){
+        if(!dictionaries || dictId >= dictionaries->size()) return false;
+        dict = &(*dictionaries)[dictId];
+    }
+    dst.resize(rawSize);
+    auto start = std::chrono::steady_clock::now();
+    bool ok = decompress(type, in, src + size - in, &dst[0], rawSize, dict);
+    auto end = std::chrono::steady_clock::now();
+    if(type != COMPRESSION_NONE){
+        stats[type].decompressCalls++;
+        stats[type].decompressNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        if(!ok) stats[type].decompressFailures++;
+    }
+    return ok;
+}
+
+std::string Compressor::train_dictionary(const std::vector<std::string> &samples, uint64_t dictBytes)
+{
+    // 统计每个片段出现在多少个样本中
+    std::unordered_map<std::string, uint32_t> count;
+    for(auto &sample : samples){
+        std::unordered_set<std::string> seen;
+        for(uint64_t p = 0; p + DICT_GRAM_LENGTH <= sample.size(); p++){
+            std::string gram = sample.substr(p, DICT_GRAM_LENGTH);
+            if(seen.insert(gram).second) count[gram]++;
+        }
+    }
+    std::vector<std::pair<uint32_t, std::string>> ranked;
+    for(auto &gramPair : count){
+        if(gramPair.second > 1) ranked.emplace_back(gramPair.second, gramPair.first);
+    }
+    std::sort(ranked.begin(), ranked.end(), [](const auto &a, const auto &b){
+        return a.first > b.first || (a.first == b.first && a.second < b.second);
+    });
+    std::vector<std::string> chosen;
+    uint64_t total = 0;
+    for(auto &gramPair : ranked){
+        if(total + DICT_GRAM_LENGTH > dictBytes) break;
+        chosen.push_back(gramPair.second);
+        total += DICT_GRAM_LENGTH;
+    }
+    std::string dict;
+    for(auto it = chosen.rbegin(); it != chosen.rend(); it++){
+        dict += *it;
+    }
+    return dict;
+}
+
+void Compressor::report(std::ostream &os)
+{
+    for(int type = COMPRESSION_LZ; type < COMPRESSION_TYPE_NUMBER; type++){
+        CompressionStats &stat = stats[type];
+        if(stat.compressCalls == 0 && stat.decompressCalls == 0) continue;
+        os << "Codec " << name((CompressionType)type)
+            << ": raw bytes " << stat.rawBytes
+            << ", compressed bytes " << stat.compressedBytes
+            << ", ratio " << (stat.compressedBytes > 0 ? (double)stat.rawBytes / stat.compressedBytes : 0)
+            << ", compress " << (stat.rawBytes > 0 ? (double)stat.compressNanos / stat.rawBytes : 0) << " ns/byte"
+            << ", decompress calls " << stat.decompressCalls
+            << ", " << (stat.decompressCalls > 0 ? stat.decompressNanos / stat.decompressCalls : 0) << " ns/call"
+            << ", corrupt " << stat.decompressFailures
+            << std::endl;
+    }
+}
+
+void Compressor::reset_stats()
+{
+    for(auto &stat : stats){
+        stat.compressCalls = 0;
+        stat.rawBytes = 0;
+        stat.compressedBytes = 0;
+        stat.compressNanos = 0;
+        stat.decompressCalls = 0;
+        stat.decompressNanos = 0;
+        stat.decompressFailures = 0;
+    }
+}
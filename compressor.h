@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include "global.h"
+
+// 压缩编码器，编号会写入文件，不能改变
+enum CompressionType{
+    COMPRESSION_NONE = 0, // 不压缩
+    COMPRESSION_LZ = 1, // 内置的LZ77编码器，总是可用
+    COMPRESSION_ZLIB = 2, // 构建时找到zlib才可用
+    COMPRESSION_ZSTD = 3, // 构建时找到zstd才可用
+    COMPRESSION_LZ4 = 4, // 构建时找到lz4才可用
+    COMPRESSION_TYPE_NUMBER
+};
+
+// 压缩选项，可以为每一层或每一类值长度分别设置
+struct CompressionOptions{
+    CompressionType type = COMPRESSION_NONE;
+    int level = 0; // 压缩级别，0为编码器的默认级别
+    bool dictionary = false; // 是否使用训练出的字典，只对vLog中的值有效
+};
+
+// 每个编码器的统计
+struct CompressionStats{
+    std::atomic<uint64_t> compressCalls{0};
+    std::atomic<uint64_t> rawBytes{0}; // 压缩前的字节数
+    std::atomic<uint64_t> compressedBytes{0}; // 压缩后的字节数
+    std::atomic<uint64_t> compressNanos{0};
+    std::atomic<uint64_t> decompressCalls{0};
+    std::atomic<uint64_t> decompressNanos{0};
+    std::atomic<uint64_t> decompressFailures{0}; // 数据损坏而解码失败的次数
+};
+
+/*
+ * 压缩层
+ * 编码结果为[编码器 uint8][字典编号 变长整数][原长度 变长整数][数据]，读取时据此选择编码器，因此不同编码器的数据可以共存
+ * 请求的编码器不可用时退回内置的LZ编码器，压缩后不更小时按原样存放
+ */
+class Compressor{
+private:
+    static CompressionStats stats[COMPRESSION_TYPE_NUMBER];
+
+    static bool compress(CompressionType type, int level, const char *src, uint64_t size, std::string &dst, const std::string *dict);
+
+    static bool decompress(CompressionType type, const char *src, uint64_t size, char *dst, uint64_t rawSize, const std::string *dict);
+
+    static bool lz_compress(const char *src, uint64_t size, std::string &dst, const std::string *dict, int level);
+
+    static bool lz_decompress(const char *src, uint64_t size, char *dst, uint64_t rawSize, const std::string *dict);
+
+public:
+    static bool available(CompressionType type);
+
+    static const char *name(CompressionType type);
+
+    // 将src编码后追加到dst末尾，dict非空时dictId为其编号
+    static void encode(const CompressionOptions &options, const char *src, uint64_t size, std::string &dst,
+        uint32_t dictId = 0, const std::string *dict = nullptr);
+
+    // 解码到dst，dst的容量可以在多次调用间复用；dictionaries按编号存放字典，数据损坏时返回false
+    static bool decode(const char *src, uint64_t size, std::string &dst, const std::vector<std::string> *dictionaries = nullptr);
+
+    // 从样本中挑选出现在最多样本中的片段拼成字典，出现次数多的放在末尾，距离更近
+    static std::string train_dictionary(const std::vector<std::string> &samples, uint64_t dictBytes);
+
+    // 输出各编码器的压缩率与耗时
+    static void report(std::ostream &os);
+
+    static void reset_stats();
+};
@@ -2,6 +2,10 @@
 #include <cstdint>
 #include <string>
 #include <assert.h>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <random>
 
 #include "test.h"
 
@@ -11,6 +15,7 @@ private:
 	const uint64_t SIMPLE_TEST_MAX = 512;
 	const uint64_t LARGE_TEST_MAX = 1024 * 64;
 	const uint64_t GC_TEST_MAX = 1024 * 48;
+	const uint64_t FEATURE_TEST_MAX = 1024 * 16;
 
 	void regular_test(uint64_t max)
 	{
@@ -191,6 +196,274 @@ private:
 		report();
 	}
 
+	// Compare every key and a full scan of the store with a reference map
+	void check_against(KVStore &kv, const std::map<uint64_t, std::string> &ref, uint64_t max)
+	{
+		for (uint64_t i = 0; i < max; ++i)
+		{
+			auto it = ref.find(i);
+			EXPECT(it == ref.end() ? not_found : it->second, kv.get(i));
+		}
+
+		std::list<std::pair<uint64_t, std::string>> list_stu;
+		kv.scan(0, max, list_stu);
+		EXPECT(ref.size(), list_stu.size());
+		auto ap = ref.begin();
+		auto sp = list_stu.begin();
+		while (ap != ref.end() && sp != list_stu.end())
+		{
+			EXPECT((*ap).first, (*sp).first);
+			EXPECT((*ap).second, (*sp).second);
+			ap++;
+			sp++;
+		}
+	}
+
+	void filter_test(uint64_t max)
+	{
+		uint64_t i;
+		std::mt19937_64 gen(42);
+
+		// Filters never reject a key they were built with
+		std::vector<uint64_t> keys;
+		for (i = 0; i < max; ++i)
+			keys.push_back(gen());
+		std::sort(keys.begin(), keys.end());
+		keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+		for (FilterPolicy policy : {FILTER_POLICY_BLOOM, FILTER_POLICY_XOR})
+		{
+			for (uint32_t bitsPerKey : {4, 10, 16})
+			{
+				auto filter = Filter::create(policy, keys, bitsPerKey);
+				for (uint64_t key : keys)
+					EXPECT(true, filter->search(key));
+			}
+		}
+		phase();
+
+		// Xor filters on every level, looking up present and absent keys
+		for (uint32_t level = 0; level < 8; ++level)
+			store.setFilterPolicy(level, FILTER_POLICY_XOR);
+
+		for (i = 0; i < max; ++i)
+			store.put(i * 3, std::string(i % 64 + 1, 'x'));
+
+		for (i = 0; i < max * 3; ++i)
+			EXPECT(i % 3 ? not_found : std::string(i / 3 % 64 + 1, 'x'), store.get(i));
+
+		for (uint32_t level = 0; level < 8; ++level)
+			store.setFilterPolicy(level, FILTER_POLICY_BLOOM);
+
+		phase();
+
+		report();
+	}
+
+	void iterator_test(uint64_t max)
+	{
+		uint64_t i;
+		std::map<uint64_t, std::string> ref;
+		std::mt19937_64 gen(42);
+
+		// Overwrites and deletions spread over the memtable and several levels
+		for (i = 0; i < max * 2; ++i)
+		{
+			uint64_t key = gen() % max;
+			if (gen() % 4 == 0)
+			{
+				store.del(key);
+				ref.erase(key);
+			}
+			else
+			{
+				store.put(key, std::to_string(i));
+				ref[key] = std::to_string(i);
+			}
+		}
+
+		// Test forward order
+		auto it = store.newIterator();
+		auto ap = ref.begin();
+		for (it->seek_to_first(); it->valid() && ap != ref.end(); it->next(), ap++)
+		{
+			EXPECT((*ap).first, it->key());
+			EXPECT((*ap).second, it->value());
+		}
+		EXPECT(true, ap == ref.end());
+		EXPECT(false, it->valid());
+		phase();
+
+		// Test backward order
+		auto rp = ref.rbegin();
+		for (it->seek_to_last(); it->valid() && rp != ref.rend(); it->prev(), rp++)
+		{
+			EXPECT((*rp).first, it->key());
+			EXPECT((*rp).second, it->value());
+		}
+		EXPECT(true, rp == ref.rend());
+		EXPECT(false, it->valid());
+		phase();
+
+		// Test seeks and direction changes within bounds
+		uint64_t lower = max / 4;
+		uint64_t upper = max / 2;
+		auto bounded = store.newIterator(lower, upper);
+		for (i = 0; i < 256; ++i)
+		{
+			uint64_t key = lower + gen() % (upper - lower + 1);
+
+			auto ge = ref.lower_bound(key);
+			bounded->seek(key);
+			EXPECT(ge != ref.end() && ge->first <= upper, bounded->valid());
+			if (bounded->valid())
+			{
+				EXPECT(ge->first, bounded->key());
+				bounded->next();
+				auto after = std::next(ge);
+				EXPECT(after != ref.end() && after->first <= upper, bounded->valid());
+				bounded->prev();
+				EXPECT(true, bounded->valid());
+				if (bounded->valid())
+					EXPECT(ge->first, bounded->key());
+			}
+
+			auto le = ref.upper_bound(key);
+			bool found = le != ref.begin() && std::prev(le)->first >= lower;
+			bounded->seek_for_prev(key);
+			EXPECT(found, bounded->valid());
+			if (found && bounded->valid())
+				EXPECT(std::prev(le)->first, bounded->key());
+		}
+		phase();
+
+		report();
+	}
+
+	void recovery_test(uint64_t max)
+	{
+		uint64_t i;
+		const std::string dir = "./data/recovery-test";
+		const std::string stray = dir + "/level-0/999999.sst";
+		std::map<uint64_t, std::string> ref;
+
+		// Write, delete and close
+		{
+			KVStore recovered(dir, dir + "/vlog");
+			recovered.reset();
+			for (i = 0; i < max; ++i)
+			{
+				recovered.put(i, std::string(i % 64 + 1, 'r'));
+				ref[i] = std::string(i % 64 + 1, 'r');
+			}
+			for (i = 0; i < max; i += 4)
+			{
+				EXPECT(true, recovered.del(i));
+				ref.erase(i);
+			}
+			check_against(recovered, ref, max);
+		}
+		phase();
+
+		// A table missing from the MANIFEST is removed on open
+		{
+			utils::mkdir(dir + "/level-0");
+			std::ofstream(stray) << "not a table";
+			KVStore recovered(dir, dir + "/vlog");
+			EXPECT(false, std::ifstream(stray).good());
+			check_against(recovered, ref, max);
+			for (i = 1; i < max; i += 4)
+			{
+				recovered.put(i, std::string(i % 64 + 1, 'u'));
+				ref[i] = std::string(i % 64 + 1, 'u');
+			}
+		}
+		phase();
+
+		// Reopen after writes made by the previous session
+		{
+			KVStore recovered(dir, dir + "/vlog");
+			check_against(recovered, ref, max);
+			recovered.reset();
+		}
+		// Closing after reset leaves only the MANIFEST and an empty level-0
+		utils::rmfile(dir + "/" + MANIFEST_NAME);
+		utils::rmdir(dir + "/level-0");
+		utils::rmdir(dir);
+		phase();
+
+		report();
+	}
+
+	void option_test(uint64_t max)
+	{
+		struct OptionCase
+		{
+			const char *name;
+			std::function<void(KVStore &)> setup;
+			std::function<void(KVStore &)> restore;
+		};
+		CompressionOptions zlib{COMPRESSION_ZLIB, 0, false};
+		OptionCase cases[] = {
+			{"learned index", [](KVStore &kv) { kv.setIndexType(INDEX_LEARNED); },
+			 [](KVStore &kv) { kv.setIndexType(INDEX_BINARY); }},
+			{"eytzinger index", [](KVStore &kv) { kv.setIndexType(INDEX_EYTZINGER); },
+			 [](KVStore &kv) { kv.setIndexType(INDEX_BINARY); }},
+			{"packed metadata", [](KVStore &kv) { kv.setPackedMetadata(true); },
+			 [](KVStore &kv) { kv.setPackedMetadata(false); }},
+			{"lazy loading", [](KVStore &kv) { kv.setLazyLoading(true, 64 * 1024); },
+			 [](KVStore &kv) { kv.setLazyLoading(false); }},
+			{"range filter", [](KVStore &kv) { kv.setRangeFilter(true); },
+			 [](KVStore &kv) { kv.setRangeFilter(false); }},
+			{"compression", [zlib](KVStore &kv) {
+				 for (uint32_t level = 0; level < 8; ++level)
+					 kv.setBlockCompression(level, zlib);
+				 kv.setValueCompression(0, zlib);
+			 },
+			 [](KVStore &kv) {
+				 for (uint32_t level = 0; level < 8; ++level)
+					 kv.setBlockCompression(level, CompressionOptions());
+				 kv.setValueCompression(0, CompressionOptions());
+			 }},
+			{"l0 partitions", [](KVStore &kv) { kv.setL0Partitions(4, 2); },
+			 [](KVStore &kv) { kv.setL0Partitions(L0_PARTITIONS, FLUSH_THREADS); }},
+			{"tiered compaction", [](KVStore &kv) { kv.setCompactionStyle(COMPACTION_TIERED, 3); },
+			 [](KVStore &kv) { kv.setCompactionStyle(COMPACTION_LEVELED); }},
+			{"guarded compaction", [](KVStore &kv) { kv.setCompactionStyle(COMPACTION_GUARDED, 4); },
+			 [](KVStore &kv) { kv.setCompactionStyle(COMPACTION_LEVELED); }},
+		};
+
+		for (auto &option : cases)
+		{
+			std::map<uint64_t, std::string> ref;
+			std::mt19937_64 gen(42);
+
+			store.reset();
+			option.setup(store);
+			for (uint64_t i = 0; i < max * 2; ++i)
+			{
+				uint64_t key = gen() % max;
+				if (gen() % 4 == 0)
+				{
+					store.del(key);
+					ref.erase(key);
+				}
+				else
+				{
+					store.put(key, std::string(i % 64 + 1, 'o'));
+					ref[key] = std::string(i % 64 + 1, 'o');
+				}
+			}
+			check_against(store, ref, max);
+			option.restore(store);
+
+			std::cout << "  " << option.name << std::endl;
+			phase();
+		}
+
+		report();
+	}
+
 public:
 	CorrectnessTest(const std::string &dir, const std::string &vlog, bool v = true) : Test(dir, vlog, v)
 	{
@@ -214,6 +487,22 @@ public:
 
 		std::cout << "[GC Test]" << std::endl;
 		gc_test(GC_TEST_MAX);
+
+		store.reset();
+
+		std::cout << "[Filter Test]" << std::endl;
+		filter_test(FEATURE_TEST_MAX);
+
+		store.reset();
+
+		std::cout << "[Iterator Test]" << std::endl;
+		iterator_test(FEATURE_TEST_MAX);
+
+		std::cout << "[Recovery Test]" << std::endl;
+		recovery_test(FEATURE_TEST_MAX);
+
+		std::cout << "[Option Test]" << std::endl;
+		option_test(FEATURE_TEST_MAX);
 	}
 };
 
@@ -0,0 +1,45 @@
+#include "eytzinger.h"
+
+// 分配按缓存行对齐的数组，使前几层节点恰好落在同一缓存行内
+template <typename T>
+static T *aligned_array(uint64_t number)
+{
+    uint64_t bytes = (number * sizeof(T) + CACHE_LINE_BYTES - 1) / CACHE_LINE_BYTES * CACHE_LINE_BYTES;
+    return static_cast<T *>(std::aligned_alloc(CACHE_LINE_BYTES, bytes));
+}
+
+EytzingerIndex::EytzingerIndex(const std::vector<uint64_t> &keyList) : size(keyList.size())
+{
+    keys.reset(aligned_array<uint64_t>(size + 1));
+    rank.reset(aligned_array<uint32_t>(size + 1));
+    keys[0] = 0;
+    rank[0] = size;
+    uint64_t pos = 0;
+    fill(keyList, 1, pos);
+}
+
+void EytzingerIndex::fill(const std::vector<uint64_t> &keyList, uint64_t node, uint64_t &pos)
+{
+    if(node > size) return;
+    fill(keyList, 2 * node, pos);
+    keys[node] = keyList[pos];
+    rank[node] = pos;
+    pos++;
+    fill(keyList, 2 * node + 1, pos);
+}
+
+/*
+ * 无分支地向下走到叶子，比key小向右，否则向左
+ * 最后走过的路径中最后一次向左的位置即为答案，去掉末尾连续的1与再一个0即可得到
+ * 一个缓存行放8个键，预取当前节点往下第3层的第一个节点
+ */
+uint64_t EytzingerIndex::lower_bound(uint64_t key) const
+{
+    uint64_t node = 1;
+    while(node <= size){
+        __builtin_prefetch(keys.get() + node * EYTZINGER_PREFETCH_STRIDE);
+        node = 2 * node + (keys[node] < key);
+    }
+    node >>= __builtin_ffsll(~node);
+    return rank[node];
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include "global.h"
+
+/*
+ * Eytzinger布局的键索引
+ * 将有序键按二叉堆的层序存放，节点i的左右孩子为2i与2i+1，查找时总是从前往后访问
+ * 前几层集中在开头的几个缓存行中，每一步还可以预取若干层之后的节点，减少缓存未命中
+ * 有序的键数组另行保留，供扫描使用；rank记录每个节点在有序数组中的位置
+ */
+class EytzingerIndex{
+private:
+    struct AlignedFree{
+        void operator()(void *p) const { std::free(p); }
+    };
+
+    std::unique_ptr<uint64_t[], AlignedFree> keys; // 下标从1开始
+    std::unique_ptr<uint32_t[], AlignedFree> rank;
+    uint64_t size;
+
+    // 按中序遍历依次填入有序键
+    void fill(const std::vector<uint64_t> &keyList, uint64_t node, uint64_t &pos);
+
+public:
+    explicit EytzingerIndex(const std::vector<uint64_t> &keyList);
+
+    // 第一个不小于key的键在有序数组中的位置，不存在时为size
+    uint64_t lower_bound(uint64_t key) const;
+
+    uint64_t byteSize() const { return (size + 1) * (sizeof(uint64_t) + sizeof(uint32_t)); }
+};
@@ -0,0 +1,104 @@
+#include "filter.h"
+#include "bloomfilter.h"
+#include "xorfilter.h"
+#include <cmath>
+
+// 按策略构建过滤器，每键位数为0时不使用过滤器
+// 异或过滤器的每键位数约为指纹位数的1.23倍，位数较多时改用16位指纹
+std::shared_ptr<Filter> Filter::create(FilterPolicy policy, const std::vector<uint64_t> &keyList, uint32_t bitsPerKey)
+{
+    if(bitsPerKey == 0){
+        return std::make_shared<NoFilter>();
+    }
+    if(policy == FILTER_POLICY_XOR){
+        if(bitsPerKey >= 16){
+            auto filter = std::make_shared<XorFilter16>();
+            if(filter->build(keyList)) return filter;
+        } else {
+            auto filter = std::make_shared<XorFilter8>();
+            if(filter->build(keyList)) return filter;
+        }
+        // 构建失败时退化为布隆过滤器
+        policy = FILTER_POLICY_BLOOM;
+    }
+    if(policy == FILTER_POLICY_BLOOM){
+        auto filter = std::make_shared<BloomFilter>(keyList.size(), bitsPerKey);
+        for(auto key : keyList){
+            filter->insert(key);
+        }
+        return filter;
+    }
+    return std::make_shared<NoFilter>();
+}
+
+// 根据类型标记还原过滤器
+std::shared_ptr<Filter> Filter::load(uint32_t filterType, char **src)
+{
+    switch(filterType & ~FILTER_MAGIC_MASK){
+        case FILTER_TYPE_BLOOM: {
+            auto filter = std::make_shared<BloomFilter>();
+            filter->byte_to_bloom(src);
+            return filter;
+        }
+        case FILTER_TYPE_XOR8: {
+            auto filter = std::make_shared<XorFilter8>();
+            filter->byte_to_filter(src);
+            return filter;
+        }
+        case FILTER_TYPE_XOR16: {
+            auto filter = std::make_shared<XorFilter16>();
+            filter->byte_to_filter(src);
+            return filter;
+        }
+        default:
+            return std::make_shared<NoFilter>();
+    }
+}
+
+// 根据类型标记原地使用映射中的过滤器，失败时与load一样复制
+std::shared_ptr<Filter> Filter::map(uint32_t filterType, const char *src, std::shared_ptr<MappedFile> file)
+{
+    switch(filterType & ~FILTER_MAGIC_MASK){
+        case FILTER_TYPE_BLOOM: {
+            auto filter = std::make_shared<BloomFilter>();
+            if(filter->map_bloom(src, file)) return filter;
+            break;
+        }
+        case FILTER_TYPE_XOR8: {
+            auto filter = std::make_shared<XorFilter8>();
+            if(filter->map_filter(src, file)) return filter;
+            break;
+        }
+        case FILTER_TYPE_XOR16: {
+            auto filter = std::make_shared<XorFilter16>();
+            if(filter->map_filter(src, file)) return filter;
+            break;
+        }
+        default:
+            break;
+    }
+    char *bytes = const_cast<char *>(src); // 只读取，不写入映射
+    return load(filterType, &bytes);
+}
+
+// 异或过滤器的误报率只取决于指纹位数
+// 分块布隆过滤器每块的键数近似服从泊松分布，块内每个字被每个键置一位，按块内键数加权求和
+double Filter::projected_rate(FilterPolicy policy, uint32_t bitsPerKey)
+{
+    if(policy == FILTER_POLICY_NONE || bitsPerKey == 0){
+        return 1;
+    }
+    if(policy == FILTER_POLICY_XOR){
+        return (bitsPerKey >= 16) ? 1.0 / 65536 : 1.0 / 256;
+    }
+    const double wordBits = BLOOM_BLOCK_BYTES * 8 / BLOOM_BLOCK_WORDS;
+    double mean = BLOOM_BLOCK_BYTES * 8.0 / bitsPerKey; // 每块的平均键数
+    double probability = std::exp(-mean); // 块内恰有c个键的概率
+    double rate = 0;
+    for(int c = 0; c < mean + 10 * std::sqrt(mean) + 20; c++){
+        if(c > 0) probability *= mean / c;
+        double bitSet = 1 - std::pow(1 - 1 / wordBits, c);
+        rate += probability * std::pow(bitSet, BLOOM_BLOCK_WORDS);
+    }
+    return rate;
+}
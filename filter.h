@@ -0,0 +1,52 @@
+#pragma once
+
+#include <memory>
+#include "global.h"
+#include "mappedfile.h"
+
+// 过滤器策略，可以为每一层分别选择
+enum FilterPolicy{
+    FILTER_POLICY_NONE, // 不使用过滤器
+    FILTER_POLICY_BLOOM, // 分块布隆过滤器
+    FILTER_POLICY_XOR // 异或过滤器，SSTable不可变，因此只需一次性构建
+};
+
+/*
+ * 过滤器接口
+ * SSTable生成后不再改变，因此过滤器只在构建时插入全部键，此后只读
+ * 序列化时第一个字为FILTER_MAGIC与类型的组合，读取时据此选择实现
+ */
+class Filter{
+public:
+    virtual ~Filter() {}
+
+    // 可能存在返回true，一定不存在返回false
+    virtual bool search(uint64_t key) const = 0;
+
+    // 序列化后的字节数（含类型标记）
+    virtual uint64_t byteSize() const = 0;
+
+    virtual void filter_to_byte(char **dst) = 0;
+
+    // 按策略为一组互不相同的键构建过滤器
+    static std::shared_ptr<Filter> create(FilterPolicy policy, const std::vector<uint64_t> &keyList, uint32_t bitsPerKey);
+
+    // 根据已读出的类型标记，从字节数组还原过滤器
+    static std::shared_ptr<Filter> load(uint32_t filterType, char **src);
+
+    // 与load相同，但过滤器直接使用映射中的位数组，并持有映射；不满足对齐要求时退回复制
+    static std::shared_ptr<Filter> map(uint32_t filterType, const char *src, std::shared_ptr<MappedFile> file);
+
+    // 按策略与每键位数估计误报率
+    static double projected_rate(FilterPolicy policy, uint32_t bitsPerKey);
+};
+
+// 不使用过滤器时的占位实现，总是返回可能存在
+class NoFilter : public Filter{
+public:
+    bool search(uint64_t key) const override { return true; }
+
+    uint64_t byteSize() const override { return sizeof(uint32_t); }
+
+    void filter_to_byte(char **dst) override { uint32_to_byte(FILTER_MAGIC | FILTER_TYPE_NONE, dst); }
+};
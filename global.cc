@@ -1,4 +1,5 @@
 #include "global.h"
+#include "ratelimiter.h"
 
 uint64_t currentTimeStamp; // 最新的时间戳
 
@@ -12,35 +13,25 @@ void char_to_byte(char data, char **dst)
 
 void uint16_to_byte(uint16_t data, char **dst)
 {
-    char *src = (char *)(&data);
-    for(int i = 0; i < 2; i++){
-        **dst = *(src + i);
-        (*dst) += 1;
-    }
+    std::memcpy(*dst, &data, 2);
+    (*dst) += 2;
 }
 
 void uint32_to_byte(uint32_t data, char **dst)
 {
-    char *src = (char *)(&data);
-    for(int i = 0; i < 4; i++){
-        **dst = *(src + i);
-        (*dst) += 1;
-    }
+    std::memcpy(*dst, &data, 4);
+    (*dst) += 4;
 }
 
 void uint64_to_byte(uint64_t data, char **dst)
 {
-    char *src = (char *)(&data);
-    for(int i = 0; i < 8; i++){
-        **dst = *(src + i);
-        (*dst) += 1;
-    }
+    std::memcpy(*dst, &data, 8);
+    (*dst) += 8;
 }
 
 void string_to_byte(std::string data, char **dst)
 {
-    const char *src = data.c_str();
-    std::strcpy(*dst, src);
+    std::memcpy(*dst, data.data(), data.length());
     (*dst) += data.length();
 }
 
@@ -55,30 +46,24 @@ char byte_to_char(char ** src)
 uint16_t byte_to_uint16(char ** src)
 {
     uint16_t data;
-    for(int i = 0; i < 2; i++){
-        *((char *)(&data) + i) = **src;
-        (*src) += 1;
-    }
+    std::memcpy(&data, *src, 2);
+    (*src) += 2;
     return data;
 }
 
 uint32_t byte_to_uint32(char ** src)
 {
     uint32_t data;
-    for(int i = 0; i < 4; i++){
-        *((char *)(&data) + i) = **src;
-        (*src) += 1;
-    }
+    std::memcpy(&data, *src, 4);
+    (*src) += 4;
     return data;
 }
 
 uint64_t byte_to_uint64(char ** src)
 {
     uint64_t data;
-    for(int i = 0; i < 8; i++){
-        *((char *)(&data) + i) = **src;
-        (*src) += 1;
-    }
+    std::memcpy(&data, *src, 8);
+    (*src) += 8;
     return data;
 }
 
@@ -88,3 +73,108 @@ std::string byte_to_string(char ** src, uint32_t length)
     (*src) += length;
     return data;
 }
+
+void varint_to_byte(uint64_t data, char **dst)
+{
+    while(data >= 0x80){
+        **dst = (char)(data | 0x80);
+        (*dst) += 1;
+        data >>= 7;
+    }
+    **dst = (char)data;
+    (*dst) += 1;
+}
+
+uint64_t byte_to_varint(char ** src)
+{
+    uint64_t data = 0;
+    for(int shift = 0; ; shift += 7){
+        uint8_t byte = (uint8_t)**src;
+        (*src) += 1;
+        data |= (uint64_t)(byte & 0x7f) << shift;
+        if(byte < 0x80) break;
+    }
+    return data;
+}
+
+bool byte_to_varint(char ** src, const char *end, uint64_t &data)
+{
+    data = 0;
+    for(int shift = 0; shift < 64 && *src < end; shift += 7){
+        uint8_t byte = (uint8_t)**src;
+        (*src) += 1;
+        data |= (uint64_t)(byte & 0x7f) << shift;
+        if(byte < 0x80) return true;
+    }
+    return false;
+}
+
+/*
+ * 分块写入fd的[begin, begin + size)，每块先申请令牌
+ * 每写满IO_BYTES_PER_SYNC字节发起一次范围回写，不等待完成，使脏页随写入逐步落盘，最后的fsync不会一次积压大量回写而阻塞读操作
+ */
+static bool write_chunks(int fd, const char *data, uint64_t size, uint64_t begin, RateLimiter *limiter, IOPriority priority)
+{
+    uint64_t written = 0;
+    uint64_t synced = 0;
+    while(written < size){
+        uint64_t chunk = std::min<uint64_t>(size - written, IO_CHUNK_BYTES);
+        if(limiter){
+            limiter->request(chunk, priority);
+        }
+        ssize_t result = write(fd, data + written, chunk);
+        if(result <= 0){
+            return false;
+        }
+        written += result;
+#ifdef __linux__
+        if(written - synced >= IO_BYTES_PER_SYNC){
+            sync_file_range(fd, begin + synced, written - synced, SYNC_FILE_RANGE_WRITE);
+            synced = written;
+        }
+#endif
+    }
+    return true;
+}
+
+bool write_file(const std::string &path, const char *data, uint64_t size, bool sync, RateLimiter *limiter, IOPriority priority)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0){
+        return false;
+    }
+    bool ok = write_chunks(fd, data, size, 0, limiter, priority);
+    if(ok && sync){
+        ok = (fsync(fd) == 0);
+    }
+    close(fd);
+    return ok;
+}
+
+bool append_file(const std::string &path, const char *data, uint64_t size, uint64_t &offset, RateLimiter *limiter, IOPriority priority)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if(fd < 0){
+        return false;
+    }
+    off_t end = lseek(fd, 0, SEEK_END);
+    bool ok = (end >= 0);
+    if(ok){
+        offset = end;
+        ok = write_chunks(fd, data, size, end, limiter, priority);
+        if(!ok){
+            ftruncate(fd, end); // 截去写了一半的数据，使下一次追加的位置不变
+        }
+    }
+    close(fd);
+    return ok;
+}
+
+void sync_path(const std::string &path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd >= 0){
+        fsync(fd);
+        close(fd);
+    }
+}
@@ -22,11 +22,90 @@
 // 有关SSTable
 #define SSTABLE_MAX_BYTES 16 * 1024 // SSTable的字节长度上限
 extern uint64_t currentTimeStamp; // 最新的时间戳
-#define HASH_LENGTH 2048 // 哈希数组大小
+#define HASH_LENGTH 2048 // 旧格式中布隆过滤器的数组大小
 #define HEAD_LENGTH 32
 #define BLOOM_LENGTH 8196
 #define CELL_LENGTH 20
 
+// 有关过滤器
+#define BLOOM_BITS_PER_KEY 10 // 默认每个键分配的布隆过滤器位数
+#define BLOOM_BLOCK_BYTES 64 // 布隆过滤器的块大小，恰为一个缓存行
+#define BLOOM_BLOCK_WORDS 8 // 每块的64位字数，每个键在每个字中各探测一位
+#define FILTER_MAGIC 0xF17E0000 // 过滤器段的魔数，旧格式中该位置为0或1
+#define FILTER_MAGIC_MASK 0xFFFF0000
+#define FILTER_TYPE_NONE 0 // 不使用过滤器
+#define FILTER_TYPE_BLOOM 1 // 分块布隆过滤器
+#define FILTER_TYPE_XOR8 2 // 8位指纹的异或过滤器
+#define FILTER_TYPE_XOR16 3 // 16位指纹的异或过滤器
+#define XOR_SIZE_FACTOR 1.23 // 异或过滤器的槽数与键数之比
+#define MAX_FILTER_BITS_PER_KEY 32 // 按层分配时每个键最多分配的位数
+#define FILTER_TYPE_PREFIX 4 // 键前缀上的范围过滤器
+#define RANGE_FILTER_PREFIX_BITS 8 // 默认的前缀粒度，即每个前缀覆盖256个键
+#define RANGE_FILTER_MAX_PROBES 16 // 扫描区间覆盖的前缀数超过该值时不再查询范围过滤器
+
+// 有关SSTable的内存索引
+#define LEARNED_INDEX_EPSILON 16 // 学习索引预测位置的误差上界
+#define CACHE_LINE_BYTES 64
+#define EYTZINGER_PREFETCH_STRIDE 8 // 一个缓存行的键数，预取3层之后的节点
+#define PACKED_BLOCK_SIZE 128 // 位压缩数组每块的值数
+
+// 有关按需加载与块缓存
+#define LAZY_BLOCK_CELLS 128 // 按需读取时每块的元组数，每块2560字节
+#define BLOCK_CACHE_SHARDS 16 // 块缓存的分片数，每片各有一把锁
+#define BLOCK_CACHE_BYTES 8 * 1024 * 1024 // 默认的块缓存容量
+
+// 有关打开数据目录
+#define OPEN_ASYNC_LEVELS 1 // 打开时在后台加载、不等待的最深层数
+
+// 有关后台合并
+#define COMPACTION_THREADS 2 // 默认的后台合并线程数，为0时在写入时同步合并
+#define L0_SLOWDOWN_FILES 8 // level-0的文件数达到该值时每次写入level-0后暂停
+#define L0_STOP_FILES 12 // level-0的文件数达到该值时等待合并
+#define WRITE_SLOWDOWN_MICROS 1000 // 每次暂停的微秒数
+#define MAX_SUBCOMPACTIONS 4 // 一次合并最多按键区间切分成的子合并数
+#define SUBCOMPACTION_MIN_TABLES 4 // 每个子合并至少的键数，以文件数计；每段末尾各有一个不满的文件，段过小时文件数明显增加
+#define COMPACTION_FANOUT 2 // 相邻两层文件数容量之比
+#define GUARD_TOP_BITS 14 // level-1的守卫键为哈希值末尾至少有这么多个0的键，平均每16384个不同的键一个
+#define GUARD_MIN_BITS 10 // 较深的层守卫更密，但守卫位数不少于此值，避免片段过小
+#define SEEK_COMPACTION_MIN_PROBES 100 // 查找触发合并前每个文件至少允许的无效探查次数
+#define SEEK_COMPACTION_BYTES_PER_PROBE 16384 // 文件每这么多字节多允许一次无效探查，重写一个文件的代价与它的大小成正比
+#define L0_PARTITIONS 1 // level-0按键区间划分的分区数，每个分区有自己的Memtable；为1时不分区
+#define FLUSH_THREADS 0 // 默认的后台刷写线程数，为0时在写入时同步刷写
+#define FLUSH_RETRY_MICROS 100000 // 刷写失败后重试前等待的微秒数
+#define FLUSH_MAX_RETRIES 5 // 刷写连续失败这么多次后放弃，不再阻塞写入或刷写线程
+
+// 有关写入限速
+#define RATE_LIMIT_REFILL_MICROS 100000 // 补充令牌的周期
+#define RATE_LIMIT_TUNE_MICROS 1000000 // 自动调节速率的周期
+#define IO_CHUNK_BYTES 1024 * 1024 // 写入文件时每次系统调用的最大字节数
+#define IO_BYTES_PER_SYNC 1024 * 1024 // 写入文件时每写满这么多字节发起一次范围回写
+
+// 有关SSTable的文件格式
+#define TABLE_FORMAT_V1 1 // 32字节头部、过滤器段与固定20字节的元组
+#define TABLE_FORMAT_V2 2 // 增量编码的数据块、过滤器段、块索引与尾部
+#define TABLE_MAGIC 0x55AA7AB1 // v2及以后的格式在文件末尾写入的魔数
+#define TABLE_FOOTER_LENGTH 64 // 尾部的字节数
+#define TABLE_BLOCK_BYTES 4096 // 数据块的目标字节数
+#define TABLE_RESTART_INTERVAL 16 // 数据块中每隔多少个元组设置一个重启点
+#define TABLE_KEY_FACTOR 16 // v2格式下合并生成的文件的键数为MAX_KEY_NUMBER的倍数
+#define TABLE_FORMAT_V3 3 // 与v2相同，但每个数据块都经过压缩层编码
+#define TABLE_FORMAT_V4 4 // 按列存放、各段对齐的小端数组，通过mmap原地使用
+#define TABLE_SECTION_ALIGN 64 // v4格式各段的对齐字节数，恰为一个缓存行
+
+// 有关压缩
+#define LZ_HASH_BITS 14 // 内置LZ编码器哈希表的位数
+#define LZ_MIN_MATCH 4 // 最短的匹配长度
+#define LZ_MAX_OFFSET 65535 // 匹配的最远距离
+#define DICT_GRAM_LENGTH 8 // 训练字典时统计的片段长度
+#define VLOG_COMPRESSED_FLAG 0x80000000 // vlen的最高位表示值经过压缩
+#define VLOG_DICT_SAMPLE_BYTES 64 * 1024 // 收集到这么多样本后训练字典
+#define VLOG_DICT_BYTES 8 * 1024 // 字典的字节数
+
+// 有关MANIFEST
+#define MANIFEST_NAME "MANIFEST" // 数据目录下版本日志的文件名
+#define MANIFEST_RECORD_HEAD 8 // 每条记录的长度与校验和
+#define MANIFEST_REWRITE_RECORDS 1024 // 日志中的记录数超过该值时以当前版本为快照重写
+
 // 有关vLog
 #define VLOG_ENTRY_HEAD 15 // entry除了value之外部分的字节数
 #define VLOG_CHECK_HEAD 3 // entry在key之前的字节数
@@ -51,3 +130,35 @@ uint32_t byte_to_uint32(char ** src);
 uint64_t byte_to_uint64(char ** src);
 
 std::string byte_to_string(char ** src, uint32_t length);
+
+// 变长整数，每字节7位，最高位表示后面还有字节
+void varint_to_byte(uint64_t data, char **dst);
+
+uint64_t byte_to_varint(char ** src);
+
+// 不读过end的变长整数，数据在结束前用尽或超过64位时返回false
+bool byte_to_varint(char ** src, const char *end, uint64_t &data);
+
+// 将有符号的差值映射为无符号数，使绝对值小的差值编码较短
+inline uint64_t zigzag_encode(int64_t data) { return ((uint64_t)data << 1) ^ (uint64_t)(data >> 63); }
+
+inline int64_t zigzag_decode(uint64_t data) { return (int64_t)(data >> 1) ^ -(int64_t)(data & 1); }
+
+class RateLimiter;
+
+// 写入硬盘的优先级，令牌不足时高优先级的请求先得到满足
+enum IOPriority{
+    IO_PRIORITY_HIGH, // 刷写memtable，前台写入在等待
+    IO_PRIORITY_LOW // 合并与GC
+};
+
+// 将数据写入文件，sync为真时落盘后返回；按IO_CHUNK_BYTES分块写入，给出limiter时每块先申请令牌
+bool write_file(const std::string &path, const char *data, uint64_t size, bool sync,
+    RateLimiter *limiter = nullptr, IOPriority priority = IO_PRIORITY_LOW);
+
+// 将数据追加到文件末尾，offset为写入的位置；分块与限速同write_file，失败时截去已写入的部分
+bool append_file(const std::string &path, const char *data, uint64_t size, uint64_t &offset,
+    RateLimiter *limiter = nullptr, IOPriority priority = IO_PRIORITY_LOW);
+
+// 将文件或目录已写入的内容落盘，新建或重命名文件后需要对所在目录调用
+void sync_path(const std::string &path);
@@ -0,0 +1,342 @@
+#include "iterator.h"
+#include "kvstore.h"
+
+Iterator::Iterator(KVStore &store, uint64_t lower, uint64_t upper) : store(store), lower(lower), upper(upper)
+{
+}
+
+// Memtable在前，各分区的键互不相交；正在刷写的按时间戳从新到旧；SSTable按scan_tables的顺序
+bool Iterator::refresh()
+{
+    uint64_t tables = store.sstable.tableVersion;
+    if(built && tables == tableVersion && store.memtableVersion == memtableVersion){
+        return false;
+    }
+    sources.clear();
+    heap.clear();
+    std::vector<const MemtablePartition *> immutables;
+    for(auto &memtable : store.memtables){
+        sources.emplace_back();
+        sources.back().memtable = memtable.active;
+        if(memtable.immutable){
+            immutables.push_back(&memtable);
+        }
+    }
+    std::sort(immutables.begin(), immutables.end(), [](const MemtablePartition *a, const MemtablePartition *b){
+        return a->immutableStamp > b->immutableStamp;
+    });
+    for(const MemtablePartition *memtable : immutables){
+        sources.emplace_back();
+        sources.back().memtable = memtable->immutable;
+    }
+    std::vector<std::pair<uint32_t, const CacheTable *>> files;
+    store.sstable.scan_tables(lower, upper, files);
+    for(auto &file : files){
+        sources.emplace_back();
+        sources.back().level = file.first;
+        sources.back().table = file.second;
+    }
+    tableVersion = tables;
+    memtableVersion = store.memtableVersion;
+    built = true;
+    return true;
+}
+
+void Iterator::load(Source &source)
+{
+    if(source.memtable){
+        source.valid = (source.node != NULL);
+        if(source.valid){
+            source.key = source.node->key;
+            source.deleted = (source.node->value == "~DELETED~");
+        }
+    } else if(source.table->lazy()){
+        source.valid = source.cells->valid();
+        if(source.valid){
+            source.key = source.cells->key();
+            source.offset = source.cells->offset();
+            source.vlen = source.cells->vlen();
+            source.deleted = (source.vlen == 0);
+        }
+    } else {
+        source.valid = (source.pos < source.table->KVNumber);
+        if(source.valid){
+            source.key = source.table->key(source.pos);
+            source.offset = source.table->offset(source.pos);
+            source.vlen = source.table->vlen(source.pos);
+            source.deleted = (source.vlen == 0);
+        }
+    }
+    source.valid = source.valid && source.key >= lower && source.key <= upper;
+}
+
+void Iterator::load_block(Source &source)
+{
+    source.cells.emplace(store.sstable.load_block(*source.table, source.block, source.level));
+}
+
+void Iterator::source_seek(Source &source, uint64_t key)
+{
+    if(source.memtable){
+        source.node = source.memtable->seek(key);
+    } else if(source.table->lazy()){
+        // 从key所在的块开始，块内没有不小于key的元组时移到下一块
+        const std::vector<uint64_t> &fenceKeys = source.table->fenceKeys;
+        uint64_t blockIndex = std::upper_bound(fenceKeys.begin(), fenceKeys.end(), key) - fenceKeys.begin();
+        source.block = (blockIndex > 0) ? blockIndex - 1 : 0;
+        load_block(source);
+        source.cells->seek(key);
+        while(!source.cells->valid() && source.block + 1 < fenceKeys.size()){
+            source.block++;
+            load_block(source);
+        }
+    } else {
+        source.pos = source.table->lower_bound(key);
+    }
+    load(source);
+}
+
+void Iterator::source_seek_for_prev(Source &source, uint64_t key)
+{
+    if(source.memtable){
+        source.node = source.memtable->seek_for_prev(key);
+    } else if(source.table->lazy()){
+        // 块内的元组只能顺序解码，先找到不大于key的最后一个键，再定位到它
+        const std::vector<uint64_t> &fenceKeys = source.table->fenceKeys;
+        uint64_t blockIndex = std::upper_bound(fenceKeys.begin(), fenceKeys.end(), key) - fenceKeys.begin();
+        if(blockIndex == 0){
+            source.valid = false;
+            return;
+        }
+        source.block = blockIndex - 1;
+        load_block(source);
+        uint64_t last = source.cells->key();
+        for(; source.cells->valid() && source.cells->key() <= key; source.cells->next()){
+            last = source.cells->key();
+        }
+        load_block(source);
+        source.cells->seek(last);
+    } else {
+        uint64_t pos = source.table->lower_bound(key);
+        if(pos == source.table->KVNumber || source.table->key(pos) != key){
+            if(pos == 0){
+                source.valid = false;
+                return;
+            }
+            pos--;
+        }
+        source.pos = pos;
+    }
+    load(source);
+}
+
+void Iterator::source_next(Source &source)
+{
+    if(source.memtable){
+        source.node = Skiplist::next(source.node);
+    } else if(source.table->lazy()){
+        source.cells->next();
+        if(!source.cells->valid() && source.block + 1 < source.table->fenceKeys.size()){
+            source.block++;
+            load_block(source);
+        }
+    } else {
+        source.pos++;
+    }
+    load(source);
+}
+
+// 堆的比较函数，a排在b之后时返回真；同一个键优先级高的来源在堆顶
+bool Iterator::after(uint32_t a, uint32_t b) const
+{
+    if(sources[a].key != sources[b].key){
+        return forward ? sources[a].key > sources[b].key : sources[a].key < sources[b].key;
+    }
+    return a > b;
+}
+
+void Iterator::position_forward(uint64_t key)
+{
+    forward = true;
+    heap.clear();
+    key = std::max(key, lower);
+    for(uint32_t i = 0; i < sources.size(); i++){
+        source_seek(sources[i], key);
+        if(sources[i].valid){
+            heap.push_back(i);
+        }
+    }
+    std::make_heap(heap.begin(), heap.end(), [this](uint32_t a, uint32_t b){ return after(a, b); });
+    find_forward();
+}
+
+void Iterator::position_backward(uint64_t key)
+{
+    forward = false;
+    heap.clear();
+    key = std::min(key, upper);
+    for(uint32_t i = 0; i < sources.size() && key >= lower; i++){
+        source_seek_for_prev(sources[i], key);
+        if(sources[i].valid){
+            heap.push_back(i);
+        }
+    }
+    std::make_heap(heap.begin(), heap.end(), [this](uint32_t a, uint32_t b){ return after(a, b); });
+    find_backward();
+}
+
+void Iterator::find_forward()
+{
+    auto cmp = [this](uint32_t a, uint32_t b){ return after(a, b); };
+    while(!heap.empty()){
+        std::pop_heap(heap.begin(), heap.end(), cmp);
+        Source &top = sources[heap.back()];
+        currentKey = top.key;
+        currentOffset = top.offset;
+        currentVlen = top.vlen;
+        bool deleted = top.deleted;
+        // 堆顶与其他来源中同一个键的旧版本都移到下一个元组
+        while(true){
+            Source &source = sources[heap.back()];
+            source_next(source);
+            if(source.valid){
+                std::push_heap(heap.begin(), heap.end(), cmp);
+            } else {
+                heap.pop_back();
+            }
+            if(heap.empty() || sources[heap.front()].key != currentKey){
+                break;
+            }
+            std::pop_heap(heap.begin(), heap.end(), cmp);
+        }
+        if(!deleted){
+            isValid = true;
+            return;
+        }
+    }
+    isValid = false;
+}
+
+void Iterator::find_backward()
+{
+    auto cmp = [this](uint32_t a, uint32_t b){ return after(a, b); };
+    while(!heap.empty()){
+        std::pop_heap(heap.begin(), heap.end(), cmp);
+        Source &top = sources[heap.back()];
+        currentKey = top.key;
+        currentOffset = top.offset;
+        currentVlen = top.vlen;
+        bool deleted = top.deleted;
+        while(true){
+            Source &source = sources[heap.back()];
+            if(currentKey > 0){
+                source_seek_for_prev(source, currentKey - 1);
+            } else {
+                source.valid = false;
+            }
+            if(source.valid){
+                std::push_heap(heap.begin(), heap.end(), cmp);
+            } else {
+                heap.pop_back();
+            }
+            if(heap.empty() || sources[heap.front()].key != currentKey){
+                break;
+            }
+            std::pop_heap(heap.begin(), heap.end(), cmp);
+        }
+        if(!deleted){
+            isValid = true;
+            return;
+        }
+    }
+    isValid = false;
+}
+
+void Iterator::seek(uint64_t key)
+{
+    std::shared_lock<std::shared_mutex> lock(store.sstable.versionMutex);
+    refresh();
+    position_forward(key);
+}
+
+void Iterator::seek_for_prev(uint64_t key)
+{
+    std::shared_lock<std::shared_mutex> lock(store.sstable.versionMutex);
+    refresh();
+    position_backward(key);
+}
+
+// 来源被重建或方向改变时，从当前键的下一个键重新定位
+void Iterator::next()
+{
+    if(!isValid){
+        return;
+    }
+    std::shared_lock<std::shared_mutex> lock(store.sstable.versionMutex);
+    if(refresh() || !forward){
+        if(currentKey == UINT64_MAX){
+            heap.clear();
+            isValid = false;
+            return;
+        }
+        position_forward(currentKey + 1);
+        return;
+    }
+    find_forward();
+}
+
+void Iterator::prev()
+{
+    if(!isValid){
+        return;
+    }
+    std::shared_lock<std::shared_mutex> lock(store.sstable.versionMutex);
+    if(refresh() || forward){
+        if(currentKey == 0){
+            heap.clear();
+            isValid = false;
+            return;
+        }
+        position_backward(currentKey - 1);
+        return;
+    }
+    find_backward();
+}
+
+std::string Iterator::value()
+{
+    if(!isValid){
+        return "";
+    }
+    {
+        std::shared_lock<std::shared_mutex> lock(store.sstable.versionMutex);
+        bool moved = refresh();
+        while(true){
+            if(moved){
+                // 当前键可能已被删除，此时移到同一方向上的下一个键
+                if(forward){
+                    position_forward(currentKey);
+                } else {
+                    position_backward(currentKey);
+                }
+                if(!isValid){
+                    return "";
+                }
+            }
+            // 定位之后写入Memtable的版本更新，被删除时同样移到下一个键
+            std::string value;
+            if(store.memtable_get(currentKey, value)){
+                return value;
+            }
+            if(value != "~DELETED~"){
+                break;
+            }
+            moved = true;
+        }
+    }
+    std::string value;
+    if(!store.VLog.get(currentOffset, currentVlen, value)){
+        return "";
+    }
+    return value;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "skiplist.h"
+#include "sstable.h"
+#include "block.h"
+#include <optional>
+
+class KVStore;
+
+/*
+ * KVStore上的流式迭代器
+ * 以二叉堆归并各分区的Memtable与每个SSTable的游标，同一个键只输出优先级最高的版本：先Memtable，
+ * 再按时间戳从新到旧、层从浅到深、同一层编号从大到小，与get的规则一致；最高的版本是删除标记时跳过该键
+ * 值在调用value()时才从vLog读取，内存只与来源数成正比，按需加载的文件每个来源只持有一块
+ * 不是快照：每次操作前检查版本，合并删除了文件或Memtable被刷写后重建来源，并在当前键处重新定位；迭代期间的写入不一定可见
+ * 只输出[lower, upper]内的键，键区间在此之外或被范围过滤器否定的文件不作为来源
+ */
+class Iterator{
+private:
+    // 一个Memtable或SSTable上的游标
+    struct Source{
+        Skiplist *memtable = nullptr;
+        Skiplist_Node *node = nullptr;
+        const CacheTable *table = nullptr;
+        uint32_t level = 0;
+        uint64_t pos = 0; // 常驻内存的文件中的位置
+        uint64_t block = 0; // 按需加载的文件所在的块
+        std::optional<BlockIterator> cells;
+        bool valid = false;
+        uint64_t key = 0;
+        uint64_t offset = 0;
+        uint32_t vlen = 0;
+        bool deleted = false;
+    };
+
+    KVStore &store;
+    uint64_t lower;
+    uint64_t upper;
+    std::vector<Source> sources; // 下标即优先级，小者为准
+    std::vector<uint32_t> heap; // 有效的来源
+    bool forward = true; // 向前时各来源位于当前键之后，向后时位于当前键之前
+    uint64_t tableVersion = 0; // 建立来源时的版本
+    uint64_t memtableVersion = 0;
+    bool built = false;
+
+    // 当前的键与输出它的版本
+    bool isValid = false;
+    uint64_t currentKey = 0;
+    uint64_t currentOffset = 0;
+    uint32_t currentVlen = 0;
+
+    // 版本变化时重建来源，返回是否重建；调用者持有共享锁
+    bool refresh();
+
+    // 读出游标当前位置的元组，超出范围时无效
+    void load(Source &source);
+    void load_block(Source &source);
+
+    void source_seek(Source &source, uint64_t key);
+    void source_seek_for_prev(Source &source, uint64_t key);
+    void source_next(Source &source);
+
+    // 各来源定位到第一个不小于key（最后一个不大于key）的元组，再取出第一个未删除的键
+    void position_forward(uint64_t key);
+    void position_backward(uint64_t key);
+
+    // 弹出堆顶的键，跳过其他来源中同一个键的旧版本，直到找到未删除的键
+    void find_forward();
+    void find_backward();
+
+    bool after(uint32_t a, uint32_t b) const;
+
+public:
+    Iterator(KVStore &store, uint64_t lower = 0, uint64_t upper = UINT64_MAX);
+
+    bool valid() const { return isValid; }
+
+    void seek_to_first() { seek(lower); }
+
+    void seek_to_last() { seek_for_prev(upper); }
+
+    // 移动到第一个不小于key的键
+    void seek(uint64_t key);
+
+    // 移动到最后一个不大于key的键
+    void seek_for_prev(uint64_t key);
+
+    void next();
+
+    void prev();
+
+    uint64_t key() const { return currentKey; }
+
+    // 从Memtable或vLog读出当前键的值，值损坏时返回空串；来源在上次移动后被替换、或当前键在Memtable中被删除时先重新定位
+    std::string value();
+};
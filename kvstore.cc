@@ -1,38 +1,180 @@
 #include "kvstore.h"
 #include <string>
 
-KVStore::KVStore(const std::string &dir, const std::string &vlog) : KVStoreAPI(dir, vlog)
+KVStore::KVStore(const std::string &dir, const std::string &vlog, const OpenOptions &options) : KVStoreAPI(dir, vlog)
 {
 	currentTimeStamp = 1;
 	sstable.dir_path = dir;
 	VLog.path = vlog;
-	Memtable = new Skiplist();
+	memtables.resize(sstable.l0Partitions);
+	for(auto &memtable : memtables){
+		memtable.active = new Skiplist();
+	}
+	sstable.set_flush_threads(FLUSH_THREADS);
 	// 进行相关的初始化
-	sstable.diskToCache();
+	sstable.diskToCache(options);
 	VLog.setHeadAndTail();
+	sstable.vlogTail = VLog.tail;
 }
 
 KVStore::~KVStore()
 {
-	std::string file_path = sstable.putNewFile();
-	Memtable->to_disk(file_path,VLog,sstable.cacheMap);
-	delete Memtable;
+	flush_all(IO_PRIORITY_HIGH);
+	for(auto &memtable : memtables){
+		delete memtable.active;
+		delete memtable.immutable; // 只有刷写持续失败时才留下
+	}
 	// 是否需要清除缓存
 }
 
+bool KVStore::memtable_get(uint64_t key, std::string &value)
+{
+	MemtablePartition &memtable = memtables[sstable.partition_of(key)];
+	if(memtable.active->get(key, value) || value == "~DELETED~"){
+		return value != "~DELETED~";
+	}
+	if(memtable.immutable){
+		return memtable.immutable->get(key, value);
+	}
+	return false;
+}
+
+bool KVStore::flush_partition(uint32_t partition, IOPriority priority)
+{
+	MemtablePartition &memtable = memtables[partition];
+	// 分界确定之前只有第一个分区接受写入，它的键跨越所有分区，同步刷写；刷写成功后才确定分界
+	bool unbounded = (memtables.size() > 1 && sstable.l0Bounds.empty());
+	memtableVersion++;
+	if(!sstable.background_flush() || unbounded){
+		std::vector<uint64_t> keys;
+		if(unbounded){
+			keys = memtable.active->keys();
+		}
+		std::string file_path = sstable.putNewFile();
+		if(!memtable.active->to_disk(file_path, VLog, sstable, priority)){
+			return false;
+		}
+		if(unbounded){
+			sstable.set_partition_bounds(keys);
+		}
+		delete memtable.active;
+	} else {
+		{
+			// 每个分区最多一个跳表在刷写
+			std::unique_lock<std::mutex> lock(flushMutex);
+			if(memtable.flushing){
+				auto start = std::chrono::steady_clock::now();
+				flushDone.wait(lock, [&memtable]{ return !memtable.flushing; });
+				auto end = std::chrono::steady_clock::now();
+				sstable.stallStats.flushWaits++;
+				sstable.stallStats.flushWaitMicros += std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+			}
+		}
+		if(!retry_unflushed(memtable, priority)){
+			return false; // 上一个跳表仍未写入level-0，不能接着刷写更新的跳表
+		}
+		// vLog只在前台写入，后台线程只生成SSTable
+		auto cacheTable = std::make_shared<CacheTable>();
+		if(memtable.active->empty()){
+			delete memtable.active;
+		} else if(!memtable.active->to_vlog(VLog, sstable, *cacheTable, priority)){
+			return false; // 写入vLog失败，跳表留在原处，之后重试
+		} else {
+			memtable.immutable = memtable.active;
+			memtable.immutableStamp = currentTimeStamp++;
+			{
+				std::lock_guard<std::mutex> lock(flushMutex);
+				memtable.flushing = true;
+			}
+			sstable.flush_async(cacheTable, memtable.immutableStamp, VLog.path, priority, [this, partition, cacheTable](bool flushed){
+				// 持锁通知，等待者返回时本函数已不再访问KVStore
+				std::lock_guard<std::mutex> lock(flushMutex);
+				if(!flushed){
+					memtables[partition].unflushed = cacheTable;
+				}
+				memtables[partition].flushing = false;
+				flushDone.notify_all();
+			});
+		}
+	}
+	memtable.active = new Skiplist();
+	sstable.compaction(); // 进行合并
+	sstable.throttle_writes(); // level-0的文件过多时放慢写入
+	return true;
+}
+
+bool KVStore::retry_unflushed(MemtablePartition &memtable, IOPriority priority)
+{
+	if(memtable.unflushed && !sstable.flush_table(sstable.putNewFile(), *memtable.unflushed, memtable.immutableStamp, VLog.path, priority)){
+		return false;
+	}
+	memtable.unflushed.reset();
+	delete memtable.immutable;
+	memtable.immutable = nullptr;
+	return true;
+}
+
+bool KVStore::wait_flushes()
+{
+	{
+		std::unique_lock<std::mutex> lock(flushMutex);
+		flushDone.wait(lock, [this]{
+			for(auto &memtable : memtables){
+				if(memtable.flushing){
+					return false;
+				}
+			}
+			return true;
+		});
+	}
+	bool flushed = true;
+	for(auto &memtable : memtables){
+		if(!retry_unflushed(memtable, flushPriority)){
+			flushed = false;
+		}
+	}
+	memtableVersion++;
+	return flushed;
+}
+
+bool KVStore::flush_all(IOPriority priority)
+{
+	bool flushed = wait_flushes(); // 同时使迭代器重建
+	for(auto &memtable : memtables){
+		std::string file_path = sstable.putNewFile();
+		if(!memtable.active->to_disk(file_path, VLog, sstable, priority)){
+			flushed = false;
+			continue;
+		}
+		delete memtable.active;
+		memtable.active = new Skiplist();
+	}
+	return flushed;
+}
+
 /**
  * Insert/Update the key-value pair.
- * No return values for simplicity.
+ * No return values for simplicity. If flushing the full memtable fails FLUSH_MAX_RETRIES
+ * times in a row, the write is dropped and counted in the compaction report; later writes
+ * then try to flush only once until a flush succeeds.
  */
 void KVStore::put(uint64_t key, const std::string &s)
 {
-	if(!Memtable->put(key, s)){ // 超过16KB，压入硬盘
-		std::string file_path = sstable.putNewFile();
-		Memtable->to_disk(file_path, VLog, sstable.cacheMap);
-		sstable.compaction(); // 进行合并
-		delete Memtable;
-		Memtable = new Skiplist();
-		Memtable->put(key,s); // 重新插入
+	uint32_t partition = sstable.partition_of(key);
+	uint32_t failures = 0;
+	while(!memtables[partition].active->put(key, s)){ // 超过16KB，压入硬盘
+		if(flush_partition(partition, flushPriority)){
+			flushFailing = false;
+		} else {
+			// 刷写失败时数据仍在跳表中，等待一段时间后重试；持续失败时放弃这次写入，不再阻塞
+			if(++failures >= (flushFailing ? 1 : FLUSH_MAX_RETRIES)){
+				flushFailing = true;
+				sstable.stallStats.droppedWrites++;
+				return;
+			}
+			std::this_thread::sleep_for(std::chrono::microseconds(FLUSH_RETRY_MICROS));
+		}
+		partition = sstable.partition_of(key); // 第一次写满时才确定分界，键可能属于另一个分区，重新插入
 	}
 }
 /**
@@ -42,7 +184,7 @@ void KVStore::put(uint64_t key, const std::string &s)
 std::string KVStore::get(uint64_t key)
 {
 	std::string value = "";
-	if(Memtable->get(key,value)){
+	if(memtable_get(key,value)){
 		// 查找成功，返回
 		return value;
 	}
@@ -52,7 +194,17 @@ std::string KVStore::get(uint64_t key)
 	}
 	value = "";
 	uint64_t offset;
-	if(sstable.get(key,value,VLog,offset)){
+	// 自动调节限速时记录在SSTable中查找的延迟
+	bool tuning = sstable.rateLimiter.auto_tuning();
+	auto start = tuning ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+	bool found = sstable.get(key,value,VLog,offset);
+	if(tuning){
+		auto end = std::chrono::steady_clock::now();
+		sstable.rateLimiter.record_latency(std::chrono::duration_cast<std::chrono::microseconds>(end - start).count());
+	}
+	// 无效探查达到预算的文件合并到下一层
+	sstable.schedule_seek_compaction();
+	if(found){
 		// 在SSTable中查找
 		return value;
 	}
@@ -78,23 +230,61 @@ bool KVStore::del(uint64_t key)
  */
 void KVStore::reset()
 {
-	delete Memtable;
-	for(auto &sstableLevel : sstable.cacheMap){ // 遍历每层
-		for(auto &sstable : sstableLevel.second){ // 遍历每层每个文件
-			utils::rmfile(sstable.first);
+	wait_flushes();
+	for(auto &memtable : memtables){
+		delete memtable.active;
+		delete memtable.immutable; // 刷写持续失败时留下的内容也一并清除
+		memtable.immutable = nullptr;
+		memtable.unflushed.reset();
+	}
+	sstable.quiesce();
+	// 先提交空版本，再删除文件，崩溃后留下的未提交文件也一并删除
+	sstable.manifest.clear();
+	for(int level = 0; ; level++){ // 遍历每层
+		std::string levelPath = sstable.dir_path + "/level-" + std::to_string(level);
+		if(!utils::dirExists(levelPath)){
+			break;
+		}
+		std::vector<std::string> fileList;
+		utils::scanDir(levelPath, fileList);
+		for(auto &name : fileList){ // 遍历每层每个文件
+			utils::rmfile(levelPath + "/" + name);
 		}
 		// 删除整层目录
-		std::string levelPath = sstable.dir_path + "/level-" + std::to_string(sstableLevel.first);
 		utils::rmdir(levelPath);
-		sstableLevel.second.clear();
 	}
 	sstable.cacheMap.clear(); // 清除缓存
+	sstable.tableVersion++;
+	sstable.levelFileNum.clear(); // 层数恢复为初始状态
+	sstable.levelFileNum[0] = 2 * sstable.l0Partitions;
+	sstable.l0Bounds.clear();
+	sstable.flushingStamps.clear();
+	sstable.filterStats.clear();
+	sstable.scanStats = ScanStats();
+	sstable.stallStats = WriteStallStats();
+	sstable.writeAmpStats.clear();
+	sstable.subcompactions = 0;
+	sstable.garbageStats.clear();
+	sstable.compactCursor.clear();
+	sstable.pickStats.clear();
+	sstable.guards.clear();
+	sstable.guardIndex.clear();
+	sstable.rateLimiter.clear_stats();
+	sstable.seekStats.clear();
+	sstable.seekPending = false;
+	sstable.seekTriggered = false;
+	sstable.vlogTail = 0;
+	sstable.blockCache.clear();
+	sstable.rebalance_filters();
 	utils::rmfile(VLog.path);
+	VLog.clear_dictionaries();
 	VLog.head = VLog.tail = 0;
 	
 	// 清除后应当重新初始化
 	currentTimeStamp = 1;
-	Memtable = new Skiplist();
+	for(auto &memtable : memtables){
+		memtable.active = new Skiplist();
+	}
 }
 
 /**
@@ -104,19 +294,22 @@ void KVStore::reset()
  */
 void KVStore::scan(uint64_t key1, uint64_t key2, std::list<std::pair<uint64_t, std::string>> &list)
 {
-	// 维护两个map，方便自动递增放置
-	std::map<uint64_t,std::string> map; // KVmap
-	std::map<uint64_t,uint64_t> timeStamp; // 维护每个键的时间戳，最新的时间戳才正确
-	// 先扫描Memtable，其时间戳最大
-	Memtable->scan(key1,key2,map,timeStamp);
-	// 再扫描硬盘
-	sstable.scan(key1,key2,map,timeStamp,VLog);
-	// map->list
-	for(auto & pair : map){
-		list.push_back(pair);
+	// 堆归并Memtable与各SSTable，按键的顺序逐个输出，不再先把区间内的所有版本放入map
+	Iterator it(*this, key1, key2);
+	for(it.seek(key1); it.valid(); it.next()){
+		list.emplace_back(it.key(), it.value());
 	}
 }
 
+/**
+ * Create an iterator over keys in [lower, upper]. Position it with seek(), seek_for_prev(),
+ * seek_to_first() or seek_to_last() before use; values are read from the vLog only when value() is called.
+ */
+std::unique_ptr<Iterator> KVStore::newIterator(uint64_t lower, uint64_t upper)
+{
+	return std::make_unique<Iterator>(*this, lower, upper);
+}
+
 /**
  * This reclaims space from vLog by moving valid value and discarding invalid value.
  * chunk_size is the size in byte you should AT LEAST recycle.
@@ -124,9 +317,17 @@ void KVStore::scan(uint64_t key1, uint64_t key2, std::list<std::pair<uint64_t, s
 void KVStore::gc(uint64_t chunk_size)
 {
 	uint64_t current = VLog.tail;
+	// 值压缩后一段chunk_size可能覆盖整个vLog，扫描不能越过开始GC时的head
+	uint64_t head = VLog.head;
+	uint64_t reclaimed = 0; // 不再被引用的字节
+	flushPriority = IO_PRIORITY_LOW; // 重新写入的有效值与合并一起让位于前台的刷写
+	if(!wait_flushes()){ // 正在刷写的值都已进入SSTable，在Memtable中找到的才是更新的版本
+		flushPriority = IO_PRIORITY_HIGH;
+		return;
+	}
 	std::fstream file;
 	Entry * entry;
-	while((current - VLog.tail) < chunk_size){
+	while((current - VLog.tail) < chunk_size && current < head){
 		file.open(VLog.path, std::fstream::in | std::fstream::binary);
 		file.seekg(current, std::ios::beg);
 
@@ -136,9 +337,9 @@ void KVStore::gc(uint64_t chunk_size)
 		file.read(reinterpret_cast<char*>(&entry->checkNum),sizeof(uint16_t));
 		file.read(reinterpret_cast<char*>(&entry->key),sizeof(uint64_t));
 		file.read(reinterpret_cast<char*>(&entry->vlen), sizeof(uint32_t));
-		char* buffer = new char[entry->vlen];
-		file.read(buffer, entry->vlen);
-		entry->value = std::string(buffer, entry->vlen);
+		char* buffer = new char[vLog::stored_length(entry->vlen)];
+		file.read(buffer, vLog::stored_length(entry->vlen));
+		bool intact = VLog.decode_value(std::string(buffer, vLog::stored_length(entry->vlen)), entry->vlen, entry->value);
 		delete [] buffer;
 		
 		uint64_t tmp = current;
@@ -149,34 +350,319 @@ void KVStore::gc(uint64_t chunk_size)
 		uint64_t offset;
 		std::string value;
 		// 先在跳表中找，找到说明不是最新记录
-		if(Memtable->get(entry->key,value)){
+		if(memtable_get(entry->key,value)){
 			// 不是最新记录
+			reclaimed += current - tmp;
 			delete entry;
 			continue;
 		}
 		if(value == "~DELETED~"){
 			// 也要跳
+			reclaimed += current - tmp;
 			delete entry;
 			continue;
 		}
 		value = "";
 		// 再在缓存中找，找到的offset对应上，就放回去，免得覆写了Memtable
-		if(sstable.get(entry->key,value,VLog,offset)){
-			if(offset == tmp){
-				// 插入到Memtable中
+		if(sstable.get(entry->key,value,VLog,offset) && offset == tmp){
+			// 插入到Memtable中；损坏的值无法还原，不能当作空值写回
+			if(intact){
 				put(entry->key,entry->value);
 			}
+		} else {
+			// 否则不处理
+			reclaimed += current - tmp;
 		}
-		// 否则不处理
 		delete entry;
 	}
 
-	// Memtable写入硬盘
-	std::string file_path = sstable.putNewFile();
-	Memtable->to_disk(file_path,VLog,sstable.cacheMap);
-	delete Memtable;
-	Memtable = new Skiplist();
+	// Memtable写入硬盘，重新写入的值都落盘后才能打洞
+	bool flushed = flush_all(IO_PRIORITY_LOW);
+	flushPriority = IO_PRIORITY_HIGH;
+	if(!flushed){
+		return;
+	}
 	// 打空洞
 	utils::de_alloc_file(VLog.path, VLog.tail, (current - VLog.tail));
 	VLog.tail = current;
-}
\ No newline at end of file
+	sstable.vlogTail = current;
+	sstable.release_garbage(reclaimed);
+}
+
+/**
+ * Wait until SSTables left loading in the background at open are all loaded.
+ */
+void KVStore::waitOpen()
+{
+	sstable.finish_open();
+}
+
+/**
+ * Set bits per key of filters in SSTables created afterwards.
+ */
+void KVStore::setBitsPerKey(uint32_t bitsPerKey)
+{
+	sstable.quiesce();
+	sstable.bitsPerKey = bitsPerKey;
+	sstable.rebalance_filters();
+}
+
+/**
+ * Set the filter policy of SSTables created afterwards in the given level.
+ */
+void KVStore::setFilterPolicy(uint32_t level, FilterPolicy policy)
+{
+	sstable.quiesce();
+	sstable.filterPolicy[level] = policy;
+	sstable.rebalance_filters();
+}
+
+/**
+ * Set the total memory budget of filters in bytes, and whether bits are
+ * allocated per level (Monkey) or uniformly. Filters use bitsPerKey uniformly
+ * until this is called.
+ */
+void KVStore::setFilterBudget(uint64_t bytes, bool monkey)
+{
+	sstable.quiesce();
+	sstable.filterMemoryBudget = bytes;
+	sstable.monkeyAllocation = monkey;
+	sstable.rebalance_filters();
+}
+
+/**
+ * Print bits per key, projected and observed false positive rate of each level.
+ */
+void KVStore::filterReport(std::ostream &os)
+{
+	sstable.filter_report(os);
+}
+
+/**
+ * Enable or disable range filters of SSTables created afterwards.
+ * prefixBits is clamped to 63, the largest shift defined for 64-bit keys.
+ */
+void KVStore::setRangeFilter(bool enabled, uint32_t prefixBits)
+{
+	sstable.quiesce();
+	sstable.rangeFilterEnabled = enabled;
+	sstable.rangeFilterBits = std::min(prefixBits, 63u);
+}
+
+/**
+ * Print how many files scans skipped with range filters.
+ */
+void KVStore::scanReport(std::ostream &os)
+{
+	sstable.scan_report(os);
+}
+
+/**
+ * Set the in-memory index of SSTables created or loaded afterwards.
+ * Binary search over the sorted keys is the default; learned and Eytzinger indexes are opt-in.
+ * The learned index replaces the key array with its segments plus bit-packed key residuals.
+ */
+void KVStore::setIndexType(IndexType indexType)
+{
+	sstable.quiesce();
+	sstable.indexType = indexType;
+}
+
+/**
+ * Pack keys, offsets and value lengths of SSTables created or loaded afterwards.
+ */
+void KVStore::setPackedMetadata(bool enabled)
+{
+	sstable.quiesce();
+	sstable.packedMetadata = enabled;
+}
+
+/**
+ * Keep only headers, filters and fence keys of SSTables created or loaded afterwards
+ * resident, and read cells on demand through a block cache of the given size.
+ * Set OpenOptions::lazyLoading to open existing tables this way without decoding their cells.
+ */
+void KVStore::setLazyLoading(bool enabled, uint64_t cacheBytes)
+{
+	sstable.quiesce();
+	sstable.lazyLoading = enabled;
+	sstable.blockCache.set_capacity(cacheBytes);
+}
+
+/**
+ * Set whether new SSTables, vLog appends and MANIFEST records are synced to disk before use.
+ */
+void KVStore::setSyncWrites(bool enabled)
+{
+	sstable.quiesce();
+	sstable.syncWrites = enabled;
+	sstable.manifest.sync = enabled;
+}
+
+/**
+ * Set the on-disk format of SSTables created afterwards. Files in any format stay readable.
+ */
+void KVStore::setTableFormat(uint32_t format, uint64_t keysPerTable)
+{
+	sstable.quiesce();
+	sstable.tableFormat = format;
+	sstable.tableKeyNumber = keysPerTable;
+	sstable.rebalance_filters(); // 每层容纳的键数随之变化
+}
+
+/**
+ * Set how data blocks of SSTables created afterwards in the given level are compressed.
+ */
+void KVStore::setBlockCompression(uint32_t level, CompressionOptions options)
+{
+	sstable.quiesce();
+	sstable.blockCompression[level] = options;
+}
+
+/**
+ * Set how values of at least minLength bytes are compressed in vLog,
+ * up to the next larger size class.
+ */
+void KVStore::setValueCompression(uint32_t minLength, CompressionOptions options)
+{
+	VLog.valueCompression[minLength] = options;
+}
+
+/**
+ * Print compression ratio and CPU time of each codec.
+ */
+void KVStore::compressionReport(std::ostream &os)
+{
+	Compressor::report(os);
+}
+
+/**
+ * Set the number of background compaction threads, 0 for compacting inside put(),
+ * and the level-0 file counts at which writes are slowed down and stopped.
+ */
+void KVStore::setCompaction(uint32_t threads, uint64_t slowdownFiles, uint64_t stopFiles)
+{
+	sstable.set_compaction_threads(threads);
+	sstable.l0SlowdownFiles = slowdownFiles;
+	sstable.l0StopFiles = stopFiles;
+}
+
+/**
+ * Set how many key ranges a single compaction may be split into and merged in parallel.
+ */
+void KVStore::setSubcompactions(uint32_t maxSubcompactions)
+{
+	sstable.set_subcompactions(maxSubcompactions);
+}
+
+/**
+ * Select the compaction strategy: leveled, size-tiered, lazy leveling or guarded (fragmented) levels.
+ * fanout is the capacity ratio of adjacent levels; dynamicLevelBytes sizes leveled targets from the last level.
+ */
+void KVStore::setCompactionStyle(CompactionStyle style, uint32_t fanout, bool dynamicLevelBytes)
+{
+	sstable.set_compaction_style(style, fanout, dynamicLevelBytes);
+}
+
+/**
+ * Select which files a leveled compaction takes when only part of a level overflows.
+ * The default takes the oldest files; min-overlap and round-robin are opt-in.
+ */
+void KVStore::setCompactionPriority(CompactionPriority priority)
+{
+	sstable.quiesce();
+	sstable.compactionPriority = priority;
+}
+
+/**
+ * Estimated vLog bytes no longer referenced by any SSTable, found by compactions and not yet reclaimed by gc().
+ */
+uint64_t KVStore::garbageBytes()
+{
+	return sstable.garbageStats.garbageBytes;
+}
+
+/**
+ * Print file counts, sorted runs and sizes of each level, amplification and how long writes were stalled.
+ */
+void KVStore::compactionReport(std::ostream &os)
+{
+	sstable.compaction_report(os);
+}
+
+/**
+ * Report the memory used by cached metadata, filters and the block cache.
+ */
+void KVStore::memoryReport(std::ostream &os)
+{
+	sstable.memory_report(os);
+}
+
+/**
+ * Limit the rate at which flushes, compactions and gc write SSTables and the vLog; 0 disables the limit.
+ * Flushes are served before compaction and gc writes. Takes effect immediately, including for writes already waiting.
+ */
+void KVStore::setRateLimit(uint64_t bytesPerSecond)
+{
+	sstable.rateLimiter.set_rate(bytesPerSecond);
+}
+
+/**
+ * Tune the rate limit from foreground read latency: lower it while the average get latency exceeds targetMicros,
+ * raise it while reads are fast and writes are waiting for tokens. targetMicros = 0 stops tuning.
+ */
+void KVStore::setRateLimitAutoTune(uint64_t targetMicros, uint64_t minBytesPerSecond, uint64_t maxBytesPerSecond)
+{
+	sstable.rateLimiter.set_auto_tune(targetMicros, minBytesPerSecond, maxBytesPerSecond);
+}
+
+/**
+ * Print the current rate and the bytes requested and time waited per priority.
+ */
+void KVStore::rateLimitReport(std::ostream &os)
+{
+	sstable.rateLimiter.report(os);
+}
+
+/**
+ * Compact a file into the next level once point lookups have probed it without finding their answer
+ * max(minProbes, fileSize / bytesPerProbe) times, even when no level overflows. Off until this enables it.
+ */
+void KVStore::setSeekCompaction(bool enabled, uint64_t minProbes, uint64_t bytesPerProbe)
+{
+	sstable.quiesce();
+	sstable.seekCompaction = enabled;
+	sstable.seekMinProbes = minProbes;
+	sstable.seekBytesPerProbe = bytesPerProbe;
+}
+
+/**
+ * Print wasted probes, triggers and seek compactions per level and the most probed file of each level.
+ */
+void KVStore::seekReport(std::ostream &os)
+{
+	sstable.seek_report(os);
+}
+
+/**
+ * Split level-0 into the given number of key-range partitions, each with its own memtable,
+ * and flush full memtables on flushThreads background threads (0 flushes inside put()).
+ * Partition bounds are chosen from the key distribution the next time a memtable fills up.
+ */
+void KVStore::setL0Partitions(uint32_t partitions, uint32_t flushThreads)
+{
+	if(!flush_all(IO_PRIORITY_HIGH)){
+		return; // 多出的分区中还有未落盘的数据，不能删除
+	}
+	sstable.set_flush_threads(flushThreads);
+	sstable.set_l0_partitions(partitions);
+	for(uint64_t i = sstable.l0Partitions; i < memtables.size(); i++){
+		delete memtables[i].active;
+	}
+	memtables.resize(sstable.l0Partitions);
+	for(auto &memtable : memtables){
+		if(!memtable.active){
+			memtable.active = new Skiplist();
+		}
+	}
+}
@@ -6,19 +6,61 @@
 #include "vlog.h"
 #include "global.h"
 #include "bloomfilter.h"
+#include "iterator.h"
 #include <iostream>
+#include <mutex>
+#include <condition_variable>
+
+// level-0一个分区的Memtable
+struct MemtablePartition{
+	Skiplist *active = nullptr; // 接受写入的跳表
+	Skiplist *immutable = nullptr; // 写满后交给后台刷写的跳表，刷写完成后保留到该分区下一次写满，读操作仍然先查它
+	uint64_t immutableStamp = 0; // immutable写满时分配的时间戳
+	bool flushing = false; // immutable尚未放入level-0，在flushMutex下读写
+	std::shared_ptr<CacheTable> unflushed; // 后台刷写放弃时留下的level-0内容，值已在vLog中；同步重试成功前保留immutable
+};
 
 class KVStore : public KVStoreAPI
 {
 	// You can add your implementation here
+	friend class Iterator;
 private:
-	Skiplist * Memtable;
+	/*
+	 * 各分区的Memtable，不分区时只有一个
+	 * 每个immutable只含本分区的键，并且比已写入SSTable的同一个键的版本都新：同一分区的刷写依次进行，
+	 * 而分界确定之前跨分区的Memtable总是同步刷写；因此读操作依次查找active、immutable与SSTable即可
+	 */
+	std::vector<MemtablePartition> memtables;
+	uint64_t memtableVersion = 0; // 释放跳表时加一，迭代器据此重建
 
 	SSTable sstable;
 
 	vLog VLog;
+
+	IOPriority flushPriority = IO_PRIORITY_HIGH; // GC期间的刷写以低优先级申请令牌
+	bool flushFailing = false; // 上一次写入因刷写持续失败被放弃，此后每次写入只尝试刷写一次，成功后恢复
+
+	// 保护各分区的flushing，后台刷写完成时通知
+	std::mutex flushMutex;
+	std::condition_variable flushDone;
+
+	// 在key所在分区的Memtable中查找，value为"~DELETED~"时表示已删除
+	bool memtable_get(uint64_t key, std::string &value);
+
+	// 第partition个分区写满时调用：同步刷写，或把值写入vLog后交给后台线程；该分区上一次刷写尚未完成时先等待
+	// 写入失败时跳表留在原处并返回false
+	bool flush_partition(uint32_t partition, IOPriority priority);
+
+	// 把后台刷写放弃的immutable同步写入level-0，成功后释放；失败时保留并返回false
+	bool retry_unflushed(MemtablePartition &memtable, IOPriority priority);
+
+	// 等待所有后台刷写完成，并释放已刷写的跳表；有immutable仍未写入level-0时返回false
+	bool wait_flushes();
+
+	// 等待后台刷写后同步刷写所有分区，有分区写入失败时返回false
+	bool flush_all(IOPriority priority);
 public:
-	KVStore(const std::string &dir, const std::string &vlog);
+	KVStore(const std::string &dir, const std::string &vlog, const OpenOptions &options = OpenOptions());
 
 	~KVStore();
 
@@ -32,5 +74,93 @@ public:
 
 	void scan(uint64_t key1, uint64_t key2, std::list<std::pair<uint64_t, std::string>> &list) override;
 
+	// 只输出[lower, upper]内的键的迭代器，创建后需要先定位
+	std::unique_ptr<Iterator> newIterator(uint64_t lower = 0, uint64_t upper = UINT64_MAX);
+
 	void gc(uint64_t chunk_size) override;
+
+	// 等待打开时在后台加载的SSTable全部加载完成
+	void waitOpen();
+
+	// 设置此后新生成的SSTable中过滤器每个键的位数
+	void setBitsPerKey(uint32_t bitsPerKey);
+
+	// 设置某一层此后新生成的SSTable使用的过滤器策略
+	void setFilterPolicy(uint32_t level, FilterPolicy policy);
+
+	// 设置过滤器的总内存预算（字节），为0时与均匀分配的内存相同；monkey为false时各层均匀分配
+	void setFilterBudget(uint64_t bytes, bool monkey = true);
+
+	// 输出各层过滤器的分配结果与误报统计
+	void filterReport(std::ostream &os);
+
+	// 为此后新生成的SSTable启用或关闭范围过滤器，prefixBits为前缀的粒度，超过63时取63
+	void setRangeFilter(bool enabled, uint32_t prefixBits = RANGE_FILTER_PREFIX_BITS);
+
+	// 输出扫描时范围过滤器跳过的文件数
+	void scanReport(std::ostream &os);
+
+	// 设置此后新生成或读入的SSTable在内存中查找键的方式
+	void setIndexType(IndexType indexType);
+
+	// 设置此后新生成或读入的SSTable是否压缩缓存的键、偏移量与值长度
+	void setPackedMetadata(bool enabled);
+
+	// 设置此后新生成或读入的SSTable是否按需加载元组，以及块缓存的容量（字节）
+	void setLazyLoading(bool enabled, uint64_t cacheBytes = BLOCK_CACHE_BYTES);
+
+	// 设置新文件、vLog与MANIFEST记录是否落盘后才使用，关闭时仍保证合并的原子性，但断电可能丢失最近的写入
+	void setSyncWrites(bool enabled);
+
+	// 设置此后新生成的SSTable的格式，以及v2及以后的格式下合并生成的文件的键数；v4格式的文件通过mmap原地使用
+	void setTableFormat(uint32_t format, uint64_t keysPerTable = MAX_KEY_NUMBER * TABLE_KEY_FACTOR);
+
+	// 设置某一层此后新生成的SSTable的数据块压缩选项
+	void setBlockCompression(uint32_t level, CompressionOptions options);
+
+	// 设置长度不小于minLength的值此后写入vLog时的压缩选项，直到下一个更大的类
+	void setValueCompression(uint32_t minLength, CompressionOptions options);
+
+	// 输出各编码器的压缩率与耗时
+	void compressionReport(std::ostream &os);
+
+	// 设置后台合并的线程数，为0时在写入时同步合并；以及level-0的文件数达到多少时放慢与停止写入
+	void setCompaction(uint32_t threads, uint64_t slowdownFiles = L0_SLOWDOWN_FILES, uint64_t stopFiles = L0_STOP_FILES);
+
+	// 设置一次合并最多切分成的子合并数，各段按键区间并行归并与写入
+	void setSubcompactions(uint32_t maxSubcompactions);
+
+	// 选择合并策略；fanout为相邻两层容量之比，dynamicLevelBytes只对分层合并有效，按最深层的字节数确定各层目标
+	void setCompactionStyle(CompactionStyle style, uint32_t fanout = COMPACTION_FANOUT, bool dynamicLevelBytes = false);
+
+	// 选择分层合并只取一层中部分文件时的优先顺序
+	void setCompactionPriority(CompactionPriority priority);
+
+	// 合并发现的、尚未被GC回收的无效值字节数的估计
+	uint64_t garbageBytes();
+
+	// 输出各层的文件数与有序段数、读写与空间放大，以及写入受到的限制
+	void compactionReport(std::ostream &os);
+
+	// 输出缓存的元数据、过滤器与块缓存占用的内存
+	void memoryReport(std::ostream &os);
+
+	// 限制刷写、合并与GC写入硬盘的速率（字节每秒），为0时不限速；可以在运行中修改
+	void setRateLimit(uint64_t bytesPerSecond);
+
+	// 按前台读的平均延迟自动调节限速，速率在[minBytesPerSecond, maxBytesPerSecond]内；targetMicros为0时关闭调节，保留当前速率
+	void setRateLimitAutoTune(uint64_t targetMicros, uint64_t minBytesPerSecond, uint64_t maxBytesPerSecond);
+
+	// 输出当前速率与各优先级申请的字节数和等待时间
+	void rateLimitReport(std::ostream &os);
+
+	// 设置查找触发的合并：文件的无效探查达到max(minProbes, 文件字节数 / bytesPerProbe)时合并到下一层
+	void setSeekCompaction(bool enabled, uint64_t minProbes = SEEK_COMPACTION_MIN_PROBES, uint64_t bytesPerProbe = SEEK_COMPACTION_BYTES_PER_PROBE);
+
+	// 输出各层的无效探查次数与查找触发的合并次数
+	void seekReport(std::ostream &os);
+
+	// 把level-0按键区间分为partitions个分区，各有一个Memtable；flushThreads为后台刷写的线程数，为0时在写入时同步刷写
+	// 分界在此后第一次写满Memtable时按键的分布确定；每个分区最多同时持有两个跳表
+	void setL0Partitions(uint32_t partitions, uint32_t flushThreads = FLUSH_THREADS);
 };
@@ -0,0 +1,122 @@
+#include "learnedindex.h"
+#include <cmath>
+
+// 收缩锥算法：维护当前段可行斜率的上下界，新键使上下界交叉时结束本段
+LearnedIndex::LearnedIndex(const std::vector<uint64_t> &keyList, uint32_t epsilon) : size(keyList.size()), epsilon(epsilon)
+{
+    uint64_t i = 0;
+    while(i < size){
+        double low = 0;
+        double high = INFINITY;
+        uint64_t j = i + 1;
+        for(; j < size; j++){
+            double dx = (double)(keyList[j] - keyList[i]);
+            double dy = (double)(j - i);
+            double newLow = std::max(low, (dy - epsilon) / dx);
+            double newHigh = std::min(high, (dy + epsilon) / dx);
+            if(newLow > newHigh) break;
+            low = newLow;
+            high = newHigh;
+        }
+        LearnedSegment segment;
+        segment.firstKey = keyList[i];
+        segment.firstPos = i;
+        segment.exact = (keyList[j - 1] - keyList[i] == j - 1 - i);
+        if(segment.exact){
+            segment.slope = 1;
+        } else {
+            segment.slope = (high == INFINITY) ? 0 : (low + high) / 2;
+        }
+        segments.push_back(segment);
+        i = j;
+    }
+    for(auto &segment : segments){
+        if(!segment.exact){
+            residuals = std::make_shared<PackedArray>(keyList);
+            break;
+        }
+    }
+}
+
+int64_t LearnedIndex::find_segment(uint64_t key) const
+{
+    int64_t low = 0;
+    int64_t high = (int64_t)segments.size() - 1;
+    int64_t result = -1;
+    while(low <= high){
+        int64_t mid = (low + high) / 2;
+        if(segments[mid].firstKey <= key){
+            result = mid;
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return result;
+}
+
+// 预测位置被限制在本段内，第一个不小于key的键一定落在预测位置的误差范围内
+void LearnedIndex::window(uint64_t key, uint64_t &low, uint64_t &high) const
+{
+    int64_t index = find_segment(key);
+    if(index < 0){
+        low = high = 0;
+        return;
+    }
+    const LearnedSegment &segment = segments[index];
+    uint64_t end = ((uint64_t)index + 1 < segments.size()) ? segments[index + 1].firstPos : size;
+    double predict = segment.firstPos + segment.slope * (double)(key - segment.firstKey);
+    predict = std::min<double>(predict, (double)end);
+    uint64_t pos = (uint64_t)predict;
+    low = (pos > segment.firstPos + epsilon) ? pos - epsilon : segment.firstPos;
+    high = std::min<uint64_t>(pos + epsilon + 2, end + 1);
+    high = std::min<uint64_t>(high, size);
+}
+
+uint64_t LearnedIndex::lower_bound(uint64_t key) const
+{
+    if(!residuals){
+        return exact_lower_bound(key);
+    }
+    uint64_t low, high;
+    window(key, low, high);
+    while(low < high){
+        uint64_t mid = (low + high) / 2;
+        if(residuals->get(mid) < key) low = mid + 1;
+        else high = mid;
+    }
+    // 窗口内的答案还需确认前一个键小于key、本身不小于key
+    if((low == 0 || residuals->get(low - 1) < key) && (low == size || residuals->get(low) >= key)){
+        return low;
+    }
+    return residuals->lower_bound(key);
+}
+
+uint64_t LearnedIndex::exact_lower_bound(uint64_t key) const
+{
+    int64_t index = find_segment(key);
+    if(index < 0){
+        return 0;
+    }
+    const LearnedSegment &segment = segments[index];
+    uint64_t end = ((uint64_t)index + 1 < segments.size()) ? segments[index + 1].firstPos : size;
+    uint64_t distance = key - segment.firstKey;
+    return (distance < end - segment.firstPos) ? segment.firstPos + distance : end;
+}
+
+uint64_t LearnedIndex::exact_key(uint64_t pos) const
+{
+    int64_t low = 0;
+    int64_t high = (int64_t)segments.size() - 1;
+    int64_t result = 0;
+    while(low <= high){
+        int64_t mid = (low + high) / 2;
+        if(segments[mid].firstPos <= pos){
+            result = mid;
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return segments[result].firstKey + (pos - segments[result].firstPos);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include "global.h"
+#include "packedarray.h"
+
+// 学习索引中的一段线性模型
+struct LearnedSegment{
+    uint64_t firstKey; // 本段第一个键
+    uint64_t firstPos; // 本段第一个键在有序数组中的位置
+    double slope; // 位置随键增长的斜率
+    bool exact; // 本段的键恰为连续整数，此时预测没有误差
+};
+
+/*
+ * 分段线性的学习索引
+ * 构建时用收缩锥（shrinking cone）算法贪心地划分线段，保证每个键的预测位置与真实位置相差不超过epsilon
+ * 查询时先在段的首键上二分找到线段，再预测位置，最终只需在[pos - epsilon, pos + epsilon + 1]内查找
+ * 索引代替缓存中的键数组：每段都是exact时由线段直接算出键；否则另存键的残差，即每块的键减去块内最小值后位压缩，
+ * 查找时只解码预测窗口内的键
+ */
+class LearnedIndex{
+private:
+    std::vector<LearnedSegment> segments;
+    uint64_t size; // 键数
+    uint32_t epsilon; // 误差上界
+    std::shared_ptr<PackedArray> residuals; // 有误差的段存在时保存的键，每段都是exact时为空
+
+    // 找到首键不大于key的最后一段，key小于所有键时返回-1
+    int64_t find_segment(uint64_t key) const;
+
+    // 计算第一个不小于key的键所在的区间[low, high)
+    void window(uint64_t key, uint64_t &low, uint64_t &high) const;
+
+    // 每段都是exact时，由线段求出第一个不小于key的位置与任意位置的键
+    uint64_t exact_lower_bound(uint64_t key) const;
+
+    uint64_t exact_key(uint64_t pos) const;
+
+public:
+    LearnedIndex(const std::vector<uint64_t> &keyList, uint32_t epsilon = LEARNED_INDEX_EPSILON);
+
+    // 第一个不小于key的键的位置，不存在时为键数；窗口因浮点误差失效时退回在残差上二分查找
+    uint64_t lower_bound(uint64_t key) const;
+
+    // 第pos个键
+    uint64_t key(uint64_t pos) const { return residuals ? residuals->get(pos) : exact_key(pos); }
+
+    // 每段都没有误差，不需要残差
+    bool exact() const { return !residuals; }
+
+    uint64_t segmentNumber() const { return segments.size(); }
+
+    uint64_t byteSize() const { return segments.size() * sizeof(LearnedSegment) + (residuals ? residuals->byteSize() : 0); }
+};
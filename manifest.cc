@@ -0,0 +1,223 @@
+#include "manifest.h"
+#include "MurmurHash3.h"
+
+// 记录的校验和取MurmurHash3的低32位
+static uint32_t record_checksum(const char *data, uint64_t size)
+{
+    uint64_t hash[2] = {0};
+    MurmurHash3_x64_128(data, (int)size, 0, hash);
+    return (uint32_t)hash[0];
+}
+
+// 所有字段均为变长整数：下一个文件编号、新增文件数与各文件、删除文件数与各文件
+void VersionEdit::encode(std::string &dst) const
+{
+    char bytes[7 * 10];
+    char *out = bytes;
+    varint_to_byte(nextFileNumber, &out);
+    varint_to_byte(added.size(), &out);
+    dst.append(bytes, out - bytes);
+    for(auto &filePair : added){
+        out = bytes;
+        const FileMeta &meta = filePair.second;
+        varint_to_byte(filePair.first, &out);
+        varint_to_byte(meta.number, &out);
+        varint_to_byte(meta.timeStamp, &out);
+        varint_to_byte(meta.KVNumber, &out);
+        varint_to_byte(meta.minKey, &out);
+        varint_to_byte(meta.maxKey, &out);
+        varint_to_byte(meta.fileSize, &out);
+        dst.append(bytes, out - bytes);
+    }
+    out = bytes;
+    varint_to_byte(removed.size(), &out);
+    dst.append(bytes, out - bytes);
+    for(auto &filePair : removed){
+        out = bytes;
+        varint_to_byte(filePair.first, &out);
+        varint_to_byte(filePair.second, &out);
+        dst.append(bytes, out - bytes);
+    }
+}
+
+bool VersionEdit::decode(const char *src, uint64_t size)
+{
+    char *in = const_cast<char *>(src);
+    const char *end = src + size;
+    added.clear();
+    removed.clear();
+    nextFileNumber = byte_to_varint(&in);
+    uint64_t addedNumber = byte_to_varint(&in);
+    for(uint64_t i = 0; i < addedNumber && in < end; i++){
+        FileMeta meta;
+        uint32_t level = (uint32_t)byte_to_varint(&in);
+        meta.number = byte_to_varint(&in);
+        meta.timeStamp = byte_to_varint(&in);
+        meta.KVNumber = byte_to_varint(&in);
+        meta.minKey = byte_to_varint(&in);
+        meta.maxKey = byte_to_varint(&in);
+        meta.fileSize = byte_to_varint(&in);
+        added.emplace_back(level, meta);
+    }
+    if(in >= end || added.size() != addedNumber) return false;
+    uint64_t removedNumber = byte_to_varint(&in);
+    for(uint64_t i = 0; i < removedNumber && in < end; i++){
+        uint32_t level = (uint32_t)byte_to_varint(&in);
+        removed.emplace_back(level, byte_to_varint(&in));
+    }
+    return removed.size() == removedNumber && in == end;
+}
+
+Manifest::~Manifest()
+{
+    close_log();
+}
+
+void Manifest::close_log()
+{
+    if(fd >= 0){
+        close(fd);
+        fd = -1;
+    }
+}
+
+void Manifest::apply(const VersionEdit &edit)
+{
+    for(auto &filePair : edit.removed){
+        auto levelIt = levels.find(filePair.first);
+        if(levelIt == levels.end()) continue;
+        levelIt->second.erase(filePair.second);
+        if(levelIt->second.empty()) levels.erase(levelIt);
+    }
+    for(auto &filePair : edit.added){
+        levels[filePair.first][filePair.second.number] = filePair.second;
+    }
+    nextFileNumber = std::max(nextFileNumber, edit.nextFileNumber);
+}
+
+bool Manifest::recover(const std::string &manifestPath)
+{
+    close_log();
+    path = manifestPath;
+    levels.clear();
+    records = 0;
+    std::fstream file;
+    file.open(path, std::fstream::in | std::fstream::binary);
+    if(!file.is_open()){
+        return false;
+    }
+    file.seekg(0, std::ios::end);
+    uint64_t fileSize = file.tellg();
+    file.seekg(0, std::ios::beg);
+    std::string content(fileSize, '\0');
+    file.read(&content[0], fileSize);
+    file.close();
+
+    uint64_t valid = 0; // 最后一条完整记录的结束位置
+    while(valid + MANIFEST_RECORD_HEAD <= fileSize){
+        char *head = &content[valid];
+        uint32_t length = byte_to_uint32(&head);
+        uint32_t checksum = byte_to_uint32(&head);
+        if(length > fileSize - valid - MANIFEST_RECORD_HEAD || record_checksum(head, length) != checksum){
+            break;
+        }
+        VersionEdit edit;
+        if(!edit.decode(head, length)){
+            break;
+        }
+        apply(edit);
+        records++;
+        valid += MANIFEST_RECORD_HEAD + length;
+    }
+    if(valid < fileSize){
+        truncate(path.c_str(), valid);
+    }
+    fd = open(path.c_str(), O_WRONLY | O_APPEND);
+    return true;
+}
+
+bool Manifest::create(const std::string &manifestPath, const VersionEdit &snapshot)
+{
+    path = manifestPath;
+    levels.clear();
+    apply(snapshot);
+    return rewrite();
+}
+
+bool Manifest::log_and_apply(VersionEdit &edit)
+{
+    edit.nextFileNumber = nextFileNumber;
+    if(fd < 0 || records >= MANIFEST_REWRITE_RECORDS){
+        std::map<uint32_t, std::map<uint64_t, FileMeta>> previous = levels;
+        apply(edit);
+        if(rewrite()){
+            return true;
+        }
+        // 重写失败时旧日志仍然有效，撤销变更后改为追加
+        levels = previous;
+        if(fd < 0){
+            return false;
+        }
+    }
+    std::string payload;
+    edit.encode(payload);
+    std::string record(MANIFEST_RECORD_HEAD, '\0');
+    char *head = &record[0];
+    uint32_to_byte(payload.size(), &head);
+    uint32_to_byte(record_checksum(payload.data(), payload.size()), &head);
+    record += payload;
+    off_t end = lseek(fd, 0, SEEK_END);
+    if(write(fd, record.data(), record.size()) != (ssize_t)record.size() || (sync && fsync(fd) != 0)){
+        // 截去写了一半的记录，否则回放在此停止，之后追加的记录都会丢失
+        if(end >= 0 && ftruncate(fd, end) == 0 && sync){
+            fsync(fd);
+        }
+        return false;
+    }
+    records++;
+    apply(edit);
+    return true;
+}
+
+// 快照只有一条记录，包含当前版本的全部文件；先写临时文件，重命名是原子的
+bool Manifest::rewrite()
+{
+    if(path.empty()){
+        return true;
+    }
+    VersionEdit snapshot;
+    snapshot.nextFileNumber = nextFileNumber;
+    for(auto &levelPair : levels){
+        for(auto &filePair : levelPair.second){
+            snapshot.added.emplace_back(levelPair.first, filePair.second);
+        }
+    }
+    std::string payload;
+    snapshot.encode(payload);
+    std::string record(MANIFEST_RECORD_HEAD, '\0');
+    char *head = &record[0];
+    uint32_to_byte(payload.size(), &head);
+    uint32_to_byte(record_checksum(payload.data(), payload.size()), &head);
+    record += payload;
+
+    // 临时文件写入或重命名失败时旧日志保持打开，仍可继续追加
+    std::string temp = path + ".tmp";
+    if(!write_file(temp, record.data(), record.size(), sync) || std::rename(temp.c_str(), path.c_str()) != 0){
+        utils::rmfile(temp);
+        return false;
+    }
+    close_log();
+    if(sync){
+        std::string::size_type slash = path.find_last_of('/');
+        sync_path(slash == std::string::npos ? "." : path.substr(0, slash));
+    }
+    fd = open(path.c_str(), O_WRONLY | O_APPEND);
+    records = 1;
+    return fd >= 0;
+}
+
+bool Manifest::clear()
+{
+    levels.clear();
+    return rewrite();
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include "global.h"
+
+// 版本中的一个SSTable
+struct FileMeta{
+    uint64_t number = 0; // 文件编号，全局唯一且单调递增
+    uint64_t timeStamp = 0; // 时间戳
+    uint64_t KVNumber = 0; // 键值对数目
+    uint64_t minKey = 0; // 键最小值
+    uint64_t maxKey = 0; // 键最大值
+    uint64_t fileSize = 0; // 文件的字节数
+};
+
+// 一次版本变更：各层新增与删除的文件，以及变更后下一个可用的文件编号
+struct VersionEdit{
+    std::vector<std::pair<uint32_t, FileMeta>> added; // <层，文件>
+    std::vector<std::pair<uint32_t, uint64_t>> removed; // <层，文件编号>
+    uint64_t nextFileNumber = 0;
+
+    bool empty() const { return added.empty() && removed.empty(); }
+
+    void encode(std::string &dst) const;
+
+    // 记录已通过校验，只检查是否越界
+    bool decode(const char *src, uint64_t size);
+};
+
+/*
+ * MANIFEST，SSTable集合的变更日志
+ * 每条记录为[长度][校验和][VersionEdit]，追加后落盘
+ * 新文件先写入并落盘，再追加一条同时包含新增与删除文件的记录，之后才删除旧文件，
+ * 因此合并中途崩溃时，重启后看到的要么是合并前、要么是合并后的完整版本
+ * 启动时按顺序回放日志得到当前版本，不需要扫描目录；末尾不完整或校验失败的记录视为未发生
+ * 记录过多时以当前版本为快照写入临时文件，落盘后原子地重命名替换原日志
+ */
+class Manifest{
+private:
+    std::string path; // 日志文件
+    int fd = -1; // 追加写入的文件描述符
+    uint64_t records = 0; // 日志中的记录数
+    std::map<uint32_t, std::map<uint64_t, FileMeta>> levels; // 当前版本，<层，<文件编号，文件>>
+    uint64_t nextFileNumber = 1;
+
+    void apply(const VersionEdit &edit);
+
+    void close_log();
+
+public:
+    bool sync = true; // 追加与重写后是否落盘
+
+    ~Manifest();
+
+    // 回放path处的日志，截去末尾损坏的记录；日志不存在时返回false
+    bool recover(const std::string &manifestPath);
+
+    // 以snapshot为当前版本新建日志，用于首次打开或迁移旧的数据目录；写入失败时返回false
+    bool create(const std::string &manifestPath, const VersionEdit &snapshot);
+
+    // 分配新文件的编号，编号随下一条记录持久化
+    uint64_t new_file_number() { return nextFileNumber++; }
+
+    // 保证此后分配的编号大于number
+    void mark_file_number(uint64_t number) { nextFileNumber = std::max(nextFileNumber, number + 1); }
+
+    // 追加记录并落盘后应用到当前版本；写入或落盘失败时不应用，返回false
+    bool log_and_apply(VersionEdit &edit);
+
+    // 以当前版本为快照重写日志；失败时删除临时文件，旧日志保持打开，返回false
+    bool rewrite();
+
+    // 清空当前版本，保留文件编号，使新文件不会与残留的文件重名
+    bool clear();
+
+    const std::map<uint32_t, std::map<uint64_t, FileMeta>> &version() const { return levels; }
+};
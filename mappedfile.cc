@@ -0,0 +1,30 @@
+#include "mappedfile.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// 映射后即可关闭文件描述符，映射本身会保持对文件的引用
+MappedFile::MappedFile(const std::string &path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0){
+        return;
+    }
+    struct stat st;
+    if(fstat(fd, &st) == 0 && st.st_size > 0){
+        void *address = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if(address != MAP_FAILED){
+            bytes = (const char *)address;
+            length = st.st_size;
+        }
+    }
+    close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if(bytes){
+        munmap((void *)bytes, length);
+    }
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include "global.h"
+
+/*
+ * 只读映射的文件
+ * 整个文件映射到内存后由操作系统的页缓存决定哪些页常驻，打开时不读取也不复制任何内容
+ * 映射在析构时解除；文件被删除后映射仍然有效，因此合并时旧文件可以先删除再读取
+ */
+class MappedFile{
+private:
+    const char *bytes = nullptr; // 映射的起始地址，按页对齐
+    uint64_t length = 0; // 文件长度
+
+public:
+    explicit MappedFile(const std::string &path);
+
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // 映射成功且文件非空
+    bool valid() const { return bytes != nullptr; }
+
+    const char *data() const { return bytes; }
+
+    uint64_t size() const { return length; }
+};
@@ -0,0 +1,43 @@
+#include "mergeiterator.h"
+
+MergeIterator::MergeIterator(const std::vector<CacheTable> &tables, const std::vector<uint64_t> &begin, const std::vector<uint64_t> &end,
+    uint64_t reclaimedBefore)
+    : tables(tables), reclaimedBefore(reclaimedBefore), position(begin), end(end)
+{
+    for(uint32_t i = 0; i < tables.size(); i++){
+        push(i);
+    }
+    advance();
+}
+
+void MergeIterator::push(uint32_t table)
+{
+    if(position[table] < end[table]){
+        heap.push({tables[table].key(position[table]), tables[table].timeStamp, table});
+    }
+}
+
+void MergeIterator::advance()
+{
+    if(heap.empty()){
+        isValid = false;
+        return;
+    }
+    Cursor top = heap.top();
+    heap.pop();
+    isValid = true;
+    currentTable = top.table;
+    currentPos = position[top.table]++;
+    push(top.table);
+    while(!heap.empty() && heap.top().key == top.key){
+        uint32_t table = heap.top().table;
+        heap.pop();
+        uint32_t vlen = tables[table].vlen(position[table]);
+        shadowed++;
+        if(vlen != 0 && tables[table].offset(position[table]) >= reclaimedBefore){
+            shadowedBytes += VLOG_ENTRY_HEAD + vLog::stored_length(vlen);
+        }
+        position[table]++;
+        push(table);
+    }
+}
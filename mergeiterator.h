@@ -0,0 +1,61 @@
+#pragma once
+
+#include "sstable.h"
+
+/*
+ * 多个有序SSTable的归并迭代器
+ * 以二叉堆维护各表当前的键，每输出一个键只需O(log K)次比较，K为表数
+ * 同一个键出现在多个表中时只输出时间戳最大的一条，时间戳相同时取靠前的表，其余直接跳过
+ */
+class MergeIterator{
+private:
+    // 某个表当前位置的键
+    struct Cursor{
+        uint64_t key;
+        uint64_t timeStamp;
+        uint32_t table;
+    };
+
+    // 堆顶为键最小者，键相同时为时间戳最大者
+    struct Later{
+        bool operator()(const Cursor &a, const Cursor &b) const {
+            if(a.key != b.key) return a.key > b.key;
+            if(a.timeStamp != b.timeStamp) return a.timeStamp < b.timeStamp;
+            return a.table > b.table;
+        }
+    };
+
+    const std::vector<CacheTable> &tables;
+    uint64_t reclaimedBefore; // vLog中此前的字节已被GC回收
+    std::vector<uint64_t> position; // 各表下一个入堆的元组
+    std::vector<uint64_t> end;
+    std::priority_queue<Cursor, std::vector<Cursor>, Later> heap;
+    bool isValid = false;
+    uint32_t currentTable = 0;
+    uint64_t currentPos = 0;
+
+    void push(uint32_t table);
+
+    // 弹出堆顶作为当前元组，并跳过其他表中的同一个键
+    void advance();
+
+public:
+    uint64_t shadowed = 0; // 被跳过的旧版本数
+    uint64_t shadowedBytes = 0; // 其中值尚未被GC回收的旧版本在vLog中的字节数，输出后这些字节不再被引用
+
+    // 归并tables中各表[begin[i], end[i])内的元组
+    MergeIterator(const std::vector<CacheTable> &tables, const std::vector<uint64_t> &begin, const std::vector<uint64_t> &end,
+        uint64_t reclaimedBefore = 0);
+
+    bool valid() const { return isValid; }
+
+    uint64_t key() const { return tables[currentTable].key(currentPos); }
+
+    uint64_t offset() const { return tables[currentTable].offset(currentPos); }
+
+    uint32_t vlen() const { return tables[currentTable].vlen(currentPos); }
+
+    uint64_t timeStamp() const { return tables[currentTable].timeStamp; }
+
+    void next() { advance(); }
+};
@@ -1,7 +1,11 @@
 #include "kvstore.h"
+#include "mergeiterator.h"
+#include <cmath>
 #include <random>
 #include <chrono>
 #include <iostream>
+#include <functional>
+#include <set>
 
 #define SMALL_TEST 256
 #define MID_TEST 1024 * 16
@@ -196,6 +200,765 @@ void bloomTest(KVStore &store){
     getTest(largeTest, store, MID_SIZE);
 }
 
+// 一组对照配置中的一项：名称与reset之后对store的设置
+struct BenchmarkCase {
+    std::string name;
+    std::function<void(KVStore &)> setup;
+};
+
+// 各组对照共用的负载，getKeys为空时不测读，不在putKeys中的键应当读不到
+struct BenchmarkOptions {
+    std::vector<uint64_t> putKeys;
+    std::vector<uint64_t> getKeys;
+    uint64_t vlen = SMALL_SIZE;
+    bool shuffle = true; // 是否打乱写入与读取的顺序
+    std::function<void(KVStore &)> report; // 每组结束后打印
+    std::function<void(KVStore &)> restore; // 全部结束后恢复默认设置
+};
+
+// 通用的对照驱动：每组依次reset、设置、写入、读取，打印平均与最大延迟及读错的值
+void benchmark(KVStore &store, const std::string &title, BenchmarkOptions options, const std::vector<BenchmarkCase> &cases){
+    std::cout << title << ": " << std::endl;
+    if(options.shuffle){
+        std::mt19937 gen(42);
+        std::shuffle(options.putKeys.begin(), options.putKeys.end(), gen);
+        std::shuffle(options.getKeys.begin(), options.getKeys.end(), gen);
+    }
+    std::set<uint64_t> written(options.putKeys.begin(), options.putKeys.end());
+    std::string value(options.vlen, 's');
+    for(auto &benchmarkCase : cases){
+        store.reset();
+        if(benchmarkCase.setup){
+            benchmarkCase.setup(store);
+        }
+        uint64_t maxLatency = 0;
+        auto begin = std::chrono::high_resolution_clock::now();
+        for(uint64_t key : options.putKeys){
+            auto start = std::chrono::high_resolution_clock::now();
+            store.put(key, value);
+            auto end = std::chrono::high_resolution_clock::now();
+            maxLatency = std::max<uint64_t>(maxLatency, std::chrono::duration_cast<std::chrono::microseconds>(end - start).count());
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        std::cout << benchmarkCase.name
+            << ": put average latency " << std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count() / options.putKeys.size() << " ns"
+            << ", max latency " << maxLatency << " us";
+        if(!options.getKeys.empty()){
+            uint64_t wrong = 0;
+            begin = std::chrono::high_resolution_clock::now();
+            for(uint64_t key : options.getKeys){
+                wrong += (store.get(key) != (written.count(key) ? value : ""));
+            }
+            end = std::chrono::high_resolution_clock::now();
+            std::cout << ", get average latency " << std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count() / options.getKeys.size() << " ns"
+                << ", wrong values " << wrong;
+        }
+        std::cout << std::endl;
+        if(options.report){
+            options.report(store);
+        }
+    }
+    if(options.restore){
+        options.restore(store);
+    }
+}
+
+// 0到size-1的连续整数
+std::vector<uint64_t> sequentialKeys(uint64_t size){
+    std::vector<uint64_t> keys;
+    for(uint64_t i = 0; i < size; i++){
+        keys.push_back(i);
+    }
+    return keys;
+}
+
+// 测量布隆过滤器实际的误报率，键的分布与bloomTest相同
+// 即把打乱后的键按MAX_KEY_NUMBER切分为若干SSTable，每个存在的键都会去查询不含它的其他SSTable
+void falsePositiveTest(){
+    std::cout << "False Positive Test: " << std::endl;
+    std::vector<uint64_t> keys;
+    for(uint64_t i = 0; i < LARGE_TEST; i++){
+        keys.push_back(i);
+    }
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    std::shuffle(keys.begin(), keys.end(), gen);
+
+    // 旧实现为2048位、4个哈希函数的过滤器，按公式估算其误报率
+    double oldRate = std::pow(1 - std::exp(-4.0 * MAX_KEY_NUMBER / 2048), 4);
+    std::cout << "Old filter: bytes " << HASH_LENGTH * sizeof(uint32_t) << ", estimated rate " << oldRate << std::endl;
+
+    uint32_t bitsList[] = {4, 6, 8, 10, 12, 16};
+    FilterPolicy policyList[] = {FILTER_POLICY_BLOOM, FILTER_POLICY_XOR};
+    for(FilterPolicy policy : policyList){
+        for(uint32_t bitsPerKey : bitsList){
+            std::vector<std::shared_ptr<Filter>> filters;
+            for(uint64_t begin = 0; begin < keys.size(); begin += MAX_KEY_NUMBER){
+                uint64_t end = std::min<uint64_t>(begin + MAX_KEY_NUMBER, keys.size());
+                std::vector<uint64_t> tableKeys(keys.begin() + begin, keys.begin() + end);
+                filters.push_back(Filter::create(policy, tableKeys, bitsPerKey));
+            }
+            uint64_t probes = 0;
+            uint64_t positives = 0;
+            auto start = std::chrono::high_resolution_clock::now();
+            for(uint64_t i = 0; i < keys.size(); i++){
+                uint64_t owner = i / MAX_KEY_NUMBER;
+                for(uint64_t j = 0; j < filters.size(); j++){
+                    if(j == owner) continue;
+                    probes++;
+                    if(filters[j]->search(keys[i])) positives++;
+                }
+            }
+            auto end = std::chrono::high_resolution_clock::now();
+            auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+            std::cout << (policy == FILTER_POLICY_BLOOM ? "Bloom" : "Xor")
+                << " bits per key: " << bitsPerKey
+                << ", bytes " << filters[0]->byteSize()
+                << ", rate " << static_cast<double>(positives) / probes
+                << ", probe latency " << static_cast<double>(latency) / probes << std::endl;
+        }
+    }
+}
+
+// 比较均匀分配与按层分配（Monkey）过滤器内存时，各层的误报情况
+// 两者的总内存相同，查询的都是不存在的键
+void filterAllocationTest(KVStore &store){
+    BenchmarkOptions options;
+    for(uint64_t i = 0; i < LARGE_TEST; i++){
+        options.putKeys.push_back(2 * i);
+        options.getKeys.push_back(2 * i + 1);
+    }
+    options.report = [](KVStore &store){ store.filterReport(std::cout); };
+    options.restore = [](KVStore &store){ store.setFilterBudget(0, false); };
+    benchmark(store, "Filter Allocation Test", options, {
+        {"Uniform", [](KVStore &store){ store.setFilterBudget(0, false); }},
+        {"Monkey", [](KVStore &store){ store.setFilterBudget(0, true); }},
+    });
+}
+
+// 稀疏键空间上的短区间扫描，比较启用范围过滤器前后的延迟与跳过的文件数
+void rangeFilterTest(KVStore &store){
+    BenchmarkOptions options;
+    for(uint64_t i = 0; i < LARGE_TEST; i++){
+        options.putKeys.push_back(i * 1000);
+    }
+    options.report = [](KVStore &store){
+        std::mt19937 gen(42);
+        uint64_t scans = SMALL_TEST * 4;
+        uint64_t results = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        for(uint64_t i = 0; i < scans; i++){
+            uint64_t k1 = gen() % (LARGE_TEST * 1000);
+            std::list<std::pair<uint64_t, std::string>> list;
+            store.scan(k1, k1 + 100, list);
+            results += list.size();
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        std::cout << "Results: " << results << ", average scan latency: "
+            << std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / scans << std::endl;
+        store.scanReport(std::cout);
+    };
+    options.restore = [](KVStore &store){ store.setRangeFilter(false); };
+    benchmark(store, "Range Filter Test", options, {
+        {"Without range filter", [](KVStore &store){ store.setRangeFilter(false); }},
+        {"With range filter", [](KVStore &store){ store.setRangeFilter(true); }},
+    });
+}
+
+// 原实现中手写的二分查找，作为对照
+uint64_t binarySearch(const std::vector<uint64_t> &keyList, uint64_t key){
+    uint64_t low = 0;
+    uint64_t high = keyList.size();
+    while(low < high){
+        uint64_t mid = (low + high) / 2;
+        if(keyList[mid] < key) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
+
+// 比较不同内存索引在一个SSTable内查找的延迟与内存
+// 键分别为连续整数、偶尔有空隙的整数与随机稀疏的整数
+void searchTest(){
+    std::cout << "Search Test: " << std::endl;
+    std::random_device rd;
+    std::mt19937_64 gen(rd());
+    uint64_t sizeList[] = {MAX_KEY_NUMBER, 1024 * 1024};
+    const char *distributionName[] = {"dense", "gapped", "sparse"};
+    for(uint64_t size : sizeList){
+        for(int distribution = 0; distribution < 3; distribution++){
+            std::vector<uint64_t> keyList;
+            uint64_t key = 0;
+            for(uint64_t i = 0; i < size; i++){
+                keyList.push_back(key);
+                if(distribution == 0) key += 1;
+                else if(distribution == 1) key += (gen() % 64 == 0) ? 1 + gen() % 1000 : 1;
+                else key += 1 + gen() % 100000;
+            }
+            std::vector<uint64_t> queries;
+            for(uint64_t i = 0; i < 1024 * 1024; i++){
+                queries.push_back(keyList[gen() % size]);
+            }
+            std::cout << "Keys: " << size << ", " << distributionName[distribution] << std::endl;
+
+            CacheTable cacheTable;
+            cacheTable.KVNumber = size;
+            cacheTable.keyList = keyList;
+            uint64_t checksum = 0;
+            auto start = std::chrono::high_resolution_clock::now();
+            for(auto query : queries) checksum += binarySearch(keyList, query);
+            auto end = std::chrono::high_resolution_clock::now();
+            std::cout << "Binary search: " << std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / queries.size()
+                << " ns, bytes " << size * sizeof(uint64_t) << std::endl;
+
+            cacheTable.eytzingerIndex = std::make_shared<EytzingerIndex>(keyList);
+            start = std::chrono::high_resolution_clock::now();
+            for(auto query : queries) checksum -= cacheTable.lower_bound(query);
+            end = std::chrono::high_resolution_clock::now();
+            std::cout << "Eytzinger: " << std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / queries.size()
+                << " ns, bytes " << cacheTable.eytzingerIndex->byteSize() + size * sizeof(uint64_t) << std::endl;
+            cacheTable.eytzingerIndex.reset();
+            for(auto query : queries) checksum += binarySearch(keyList, query);
+
+            cacheTable.learnedIndex = std::make_shared<LearnedIndex>(keyList);
+            start = std::chrono::high_resolution_clock::now();
+            for(auto query : queries) checksum -= cacheTable.lower_bound(query);
+            end = std::chrono::high_resolution_clock::now();
+            std::cout << "Learned index: " << std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / queries.size()
+                << " ns, segments " << cacheTable.learnedIndex->segmentNumber()
+                << ", bytes " << cacheTable.learnedIndex->byteSize()
+                << (cacheTable.learnedIndex->exact() ? " (no residuals)" : "") << std::endl;
+            cacheTable.learnedIndex.reset();
+            for(auto query : queries) checksum += binarySearch(keyList, query);
+
+            cacheTable.packedKeys = std::make_shared<PackedArray>(keyList);
+            start = std::chrono::high_resolution_clock::now();
+            for(auto query : queries) checksum -= cacheTable.lower_bound(query);
+            end = std::chrono::high_resolution_clock::now();
+            std::cout << "Packed keys: " << std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / queries.size()
+                << " ns, bytes " << cacheTable.packedKeys->byteSize() << std::endl;
+            if(checksum != 0) std::cout << "Mismatch!" << std::endl;
+        }
+    }
+}
+
+// 比较压缩缓存元数据前后的内存占用与读延迟，键为随机稀疏的整数
+void packedTest(KVStore &store){
+    BenchmarkOptions options;
+    std::mt19937_64 gen(42);
+    uint64_t key = 0;
+    for(uint64_t i = 0; i < LARGE_TEST; i++){
+        key += 1 + gen() % 1000;
+        options.putKeys.push_back(key);
+    }
+    options.getKeys = options.putKeys;
+    options.report = [](KVStore &store){ store.memoryReport(std::cout); };
+    options.restore = [](KVStore &store){ store.setPackedMetadata(false); };
+    benchmark(store, "Packed Metadata Test", options, {
+        {"Plain", [](KVStore &store){ store.setPackedMetadata(false); }},
+        {"Packed", [](KVStore &store){ store.setPackedMetadata(true); }},
+    });
+}
+
+// 比较常驻内存与按需加载时的内存占用与读延迟，块缓存的容量远小于元组的总大小
+void lazyTest(KVStore &store){
+    BenchmarkOptions options;
+    options.putKeys = options.getKeys = sequentialKeys(LARGE_TEST);
+    options.report = [](KVStore &store){ store.memoryReport(std::cout); };
+    options.restore = [](KVStore &store){ store.setLazyLoading(false); };
+    benchmark(store, "Lazy Loading Test", options, {
+        {"Resident", [](KVStore &store){ store.setLazyLoading(false); }},
+        {"Lazy", [](KVStore &store){ store.setLazyLoading(true, 128 * 1024); }},
+    });
+}
+
+// 统计数据目录下SSTable的文件数与总字节数
+void diskUsage(const std::string &dir, uint64_t &files, uint64_t &bytes){
+    files = bytes = 0;
+    for(int level = 0; utils::dirExists(dir + "/level-" + std::to_string(level)); level++){
+        std::string levelPath = dir + "/level-" + std::to_string(level);
+        std::vector<std::string> fileList;
+        utils::scanDir(levelPath, fileList);
+        for(auto &name : fileList){
+            struct stat st;
+            if(stat((levelPath + "/" + name).c_str(), &st) == 0){
+                files++;
+                bytes += st.st_size;
+            }
+        }
+    }
+}
+
+// 比较各SSTable格式的文件数、硬盘占用与读延迟
+void formatTest(KVStore &store){
+    BenchmarkOptions options;
+    options.putKeys = options.getKeys = sequentialKeys(LARGE_TEST);
+    options.report = [](KVStore &store){
+        uint64_t files, bytes;
+        diskUsage("./data", files, bytes);
+        std::cout << "Files " << files << ", bytes " << bytes << std::endl;
+    };
+    options.restore = [](KVStore &store){ store.setTableFormat(TABLE_FORMAT_V2); };
+    std::vector<BenchmarkCase> cases;
+    for(uint32_t format : {TABLE_FORMAT_V1, TABLE_FORMAT_V2, TABLE_FORMAT_V4}){
+        cases.push_back({"Format v" + std::to_string(format), [format](KVStore &store){ store.setTableFormat(format); }});
+    }
+    benchmark(store, "Table Format Test", options, cases);
+}
+
+// 比较打开已有SSTable的耗时与常驻内存，v4格式只映射文件而不解码
+void mmapTest(KVStore &store){
+    std::cout << "Mapped Table Test: " << std::endl;
+    std::vector<uint64_t> largeTest;
+    for(uint64_t i = 0; i < LARGE_TEST; i++){
+        largeTest.push_back(i);
+    }
+    uint32_t formatList[] = {TABLE_FORMAT_V1, TABLE_FORMAT_V2, TABLE_FORMAT_V4};
+    for(uint32_t format : formatList){
+        std::cout << "Format v" << format << ": " << std::endl;
+        store.reset();
+        store.setTableFormat(format);
+        putTest(largeTest, store, SMALL_SIZE);
+
+        // 另用一个SSTable读入同一目录，只统计打开的耗时
+        SSTable reader;
+        reader.dir_path = "./data";
+        auto start = std::chrono::high_resolution_clock::now();
+        reader.diskToCache();
+        auto end = std::chrono::high_resolution_clock::now();
+        std::cout << "Open latency: " << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << " us" << std::endl;
+        reader.memory_report(std::cout);
+        getTest(largeTest, store, SMALL_SIZE);
+    }
+    store.setTableFormat(TABLE_FORMAT_V2);
+}
+
+// 值为结构相似的短JSON，比较各编码器及字典对数据块与值的压缩效果
+void compressionTest(KVStore &store){
+    std::cout << "Compression Test: " << std::endl;
+    uint64_t size = LARGE_TEST;
+    std::vector<uint64_t> largeTest;
+    std::vector<std::string> values;
+    std::mt19937 gen(42);
+    const char *cities[] = {"Shanghai", "Beijing", "Shenzhen", "Hangzhou", "Chengdu"};
+    for(uint64_t i = 0; i < size; i++){
+        largeTest.push_back(i);
+        values.push_back("{\"id\":" + std::to_string(i) + ",\"name\":\"user" + std::to_string(gen() % 100000)
+            + "\",\"city\":\"" + cities[gen() % 5] + "\",\"score\":" + std::to_string(gen() % 1000)
+            + ",\"active\":" + (gen() % 2 ? "true" : "false") + "}");
+    }
+    CompressionOptions optionList[] = {
+        {COMPRESSION_NONE, 0, false}, {COMPRESSION_LZ, 0, false}, {COMPRESSION_LZ, 0, true},
+        {COMPRESSION_ZLIB, 0, false}, {COMPRESSION_ZLIB, 0, true}
+    };
+    for(auto &options : optionList){
+        std::cout << Compressor::name(options.type) << (options.dictionary ? " with dictionary" : "") << ": " << std::endl;
+        store.reset();
+        Compressor::reset_stats();
+        for(uint32_t level = 0; level < 8; level++){
+            store.setBlockCompression(level, {options.type, options.level, false});
+        }
+        store.setValueCompression(0, options);
+
+        auto start = std::chrono::high_resolution_clock::now();
+        for(uint64_t i = 0; i < size; i++){
+            store.put(largeTest[i], values[i]);
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        std::cout << "Put average latency: " << std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / size << std::endl;
+
+        std::shuffle(largeTest.begin(), largeTest.end(), gen);
+        uint64_t wrong = 0;
+        start = std::chrono::high_resolution_clock::now();
+        for(uint64_t i = 0; i < size; i++){
+            if(store.get(largeTest[i]) != values[largeTest[i]]) wrong++;
+        }
+        end = std::chrono::high_resolution_clock::now();
+        std::sort(largeTest.begin(), largeTest.end());
+        std::cout << "Get average latency: " << std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / size << std::endl;
+        std::cout << "Wrong values: " << wrong << std::endl;
+
+        uint64_t files, bytes;
+        diskUsage("./data", files, bytes);
+        std::cout << "Files " << files << ", bytes " << bytes << std::endl;
+        store.compressionReport(std::cout);
+    }
+    store.setValueCompression(0, CompressionOptions());
+    for(uint32_t level = 0; level < 8; level++){
+        store.setBlockCompression(level, CompressionOptions());
+    }
+}
+
+// 直接生成fileNumber个小文件及对应的MANIFEST，各层容量逐层翻倍，最深层放剩余的文件
+void makeOpenDir(const std::string &dir, uint64_t fileNumber, uint64_t keysPerTable){
+    utils::mkdir(dir);
+    VersionEdit snapshot;
+    uint64_t written = 0;
+    uint64_t key = 0;
+    for(uint32_t level = 0; written < fileNumber; level++){
+        std::string levelPath = dir + "/level-" + std::to_string(level);
+        utils::mkdir(levelPath);
+        uint64_t capacity = (level == 0) ? 2 : (2ull << level);
+        for(uint64_t i = 0; i < capacity && written < fileNumber; i++){
+            CacheTable cacheTable;
+            cacheTable.timeStamp = fileNumber - written; // 浅层较新
+            cacheTable.KVNumber = keysPerTable;
+            for(uint64_t j = 0; j < keysPerTable; j++, key++){
+                cacheTable.keyList.push_back(key);
+                cacheTable.offsetList.push_back(key * SMALL_SIZE);
+                cacheTable.vlenList.push_back(SMALL_SIZE);
+            }
+            cacheTable.minKey = cacheTable.keyList.front();
+            cacheTable.maxKey = cacheTable.keyList.back();
+            cacheTable.filter = Filter::create(FILTER_POLICY_BLOOM, cacheTable.keyList, BLOOM_BITS_PER_KEY);
+            written++;
+            std::string path = levelPath + "/" + std::to_string(written) + ".sst";
+            SSTable::write_table(path, cacheTable, TABLE_FORMAT_V2);
+            FileMeta meta;
+            meta.number = written;
+            meta.timeStamp = cacheTable.timeStamp;
+            meta.KVNumber = keysPerTable;
+            meta.minKey = cacheTable.minKey;
+            meta.maxKey = cacheTable.maxKey;
+            meta.fileSize = cacheTable.fileSize;
+            snapshot.added.emplace_back(level, meta);
+        }
+    }
+    Manifest manifest;
+    manifest.sync = false;
+    manifest.mark_file_number(fileNumber);
+    manifest.create(dir + "/" + MANIFEST_NAME, snapshot);
+}
+
+// 打开大量SSTable的延迟：逐个打开、并行打开全部层、并行打开且最深层在后台加载
+// 分别统计打开返回、最深层第一次查找与全部加载完成的耗时；文件在页缓存中，不含冷读的延迟
+void openTest(){
+    std::cout << "Open Test: " << std::endl;
+    const std::string dir = "./data/open-test";
+    const uint64_t keysPerTable = 128;
+    uint64_t fileNumberList[] = {1000, 10000, 100000};
+    for(uint64_t fileNumber : fileNumberList){
+        std::cout << "Files " << fileNumber << ": " << std::endl;
+        makeOpenDir(dir, fileNumber, keysPerTable);
+        OpenOptions serial;
+        serial.threads = 0;
+        OpenOptions parallel;
+        parallel.asyncLevels = 0;
+        OpenOptions background;
+        std::pair<const char *, OpenOptions> optionList[] = {
+            {"serial", serial}, {"parallel", parallel}, {"background deepest level", background}
+        };
+        for(auto &optionPair : optionList){
+            SSTable reader;
+            reader.dir_path = dir;
+            auto start = std::chrono::high_resolution_clock::now();
+            reader.diskToCache(optionPair.second);
+            auto opened = std::chrono::high_resolution_clock::now();
+            // 查找最深层最后一个文件中的键，尚未加载时由调用线程加载
+            const CacheTable &deepest = reader.cacheMap.rbegin()->second.rbegin()->second;
+            uint64_t offset;
+            uint32_t vlen;
+            reader.wait_loaded(deepest);
+            bool found = reader.find_cell(deepest, reader.cacheMap.rbegin()->first, deepest.minKey, offset, vlen);
+            auto firstRead = std::chrono::high_resolution_clock::now();
+            reader.finish_open();
+            auto end = std::chrono::high_resolution_clock::now();
+            std::cout << optionPair.first << " (" << optionPair.second.threads << " threads)"
+                << ": open " << std::chrono::duration_cast<std::chrono::microseconds>(opened - start).count() << " us"
+                << ", first deepest read " << std::chrono::duration_cast<std::chrono::microseconds>(firstRead - opened).count() << " us"
+                << (found ? "" : " (not found)")
+                << ", fully loaded " << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << " us" << std::endl;
+        }
+        for(uint32_t level = 0; utils::dirExists(dir + "/level-" + std::to_string(level)); level++){
+            std::string levelPath = dir + "/level-" + std::to_string(level);
+            std::vector<std::string> fileList;
+            utils::scanDir(levelPath, fileList);
+            for(auto &name : fileList){
+                utils::rmfile(levelPath + "/" + name);
+            }
+            utils::rmdir(levelPath);
+        }
+        utils::rmfile(dir + "/" + MANIFEST_NAME);
+    }
+    utils::rmdir(dir);
+}
+
+// 同步合并与后台合并下PUT的平均与最大延迟，后者只在level-0过多时放慢写入
+void backgroundCompactionTest(KVStore &store){
+    BenchmarkOptions options;
+    options.putKeys = sequentialKeys(LARGE_TEST * 4);
+    options.report = [](KVStore &store){ store.compactionReport(std::cout); };
+    options.restore = [](KVStore &store){ store.setCompaction(COMPACTION_THREADS); };
+    std::vector<BenchmarkCase> cases;
+    for(uint32_t threads : {0, 1, 2, 4}){
+        cases.push_back({"Compaction threads " + std::to_string(threads), [threads](KVStore &store){ store.setCompaction(threads); }});
+    }
+    benchmark(store, "Background Compaction Test", options, cases);
+}
+
+// 同步合并下按子合并数比较写入的耗时，耗时主要来自合并
+void subcompactionTest(KVStore &store){
+    BenchmarkOptions options;
+    options.putKeys = sequentialKeys(LARGE_TEST * 4);
+    options.report = [](KVStore &store){ store.compactionReport(std::cout); };
+    options.restore = [](KVStore &store){
+        store.setSubcompactions(MAX_SUBCOMPACTIONS);
+        store.setCompaction(COMPACTION_THREADS);
+    };
+    std::vector<BenchmarkCase> cases;
+    for(uint32_t subcompactions : {1, 2, 4, 8}){
+        cases.push_back({"Max subcompactions " + std::to_string(subcompactions), [subcompactions](KVStore &store){
+            store.setCompaction(0);
+            store.setSubcompactions(subcompactions);
+        }});
+    }
+    benchmark(store, "Subcompaction Test", options, cases);
+}
+
+// 堆归并K个有重叠的有序表，每输出一个键的耗时应随K对数增长
+void mergeTest(){
+    std::cout << "Merge Test: " << std::endl;
+    uint64_t size = LARGE_TEST * 8; // 所有表的总键数
+    uint32_t tableNumberList[] = {2, 8, 32, 128, 512};
+    std::mt19937_64 gen(42);
+    for(uint32_t tableNumber : tableNumberList){
+        std::vector<CacheTable> tables(tableNumber);
+        std::vector<uint64_t> begin(tableNumber, 0);
+        std::vector<uint64_t> end(tableNumber);
+        for(uint32_t i = 0; i < tableNumber; i++){
+            CacheTable &cacheTable = tables[i];
+            for(uint64_t j = 0; j < size / tableNumber; j++){
+                cacheTable.keyList.push_back(gen() % (size * 2));
+            }
+            std::sort(cacheTable.keyList.begin(), cacheTable.keyList.end());
+            cacheTable.keyList.erase(std::unique(cacheTable.keyList.begin(), cacheTable.keyList.end()), cacheTable.keyList.end());
+            cacheTable.KVNumber = end[i] = cacheTable.keyList.size();
+            cacheTable.offsetList.assign(cacheTable.KVNumber, 0);
+            cacheTable.vlenList.assign(cacheTable.KVNumber, SMALL_SIZE);
+            cacheTable.timeStamp = i + 1;
+        }
+        uint64_t output = 0;
+        uint64_t checksum = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        for(MergeIterator it(tables, begin, end); it.valid(); it.next()){
+            output++;
+            checksum += it.key() ^ it.timeStamp();
+        }
+        auto stop = std::chrono::high_resolution_clock::now();
+        std::cout << "Tables " << tableNumber << ": output keys " << output
+            << ", " << std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count() / size << " ns per input key"
+            << " (checksum " << checksum << ")" << std::endl;
+    }
+}
+
+// 顺序写入时各层文件互不重叠，合并只移动文件，写放大应接近1；随机写入作为对照
+void writeAmplificationTest(KVStore &store){
+    BenchmarkOptions options;
+    options.putKeys = sequentialKeys(LARGE_TEST * 4);
+    options.report = [](KVStore &store){ store.compactionReport(std::cout); };
+    options.shuffle = false;
+    benchmark(store, "Write Amplification Test", options, {{"Sequential", nullptr}});
+    options.shuffle = true;
+    benchmark(store, "Write Amplification Test, shuffled", options, {{"Random", nullptr}});
+}
+
+void tombstoneTest(KVStore &store){
+    std::cout << "Tombstone Test: " << std::endl;
+    uint64_t size = LARGE_TEST * 2;
+    store.reset();
+    for(int round = 0; round < 4; round++){
+        for(uint64_t i = 0; i < size; i++){
+            store.put(i, std::string(SMALL_SIZE, 's'));
+        }
+        for(uint64_t i = 0; i < size; i += 2){
+            store.del(i);
+        }
+    }
+    store.memoryReport(std::cout);
+    store.compactionReport(std::cout);
+    std::cout << "Garbage bytes awaiting gc " << store.garbageBytes() << std::endl;
+}
+
+// 按合并策略比较随机写入与读取的耗时、写放大与有序段数
+void compactionStyleTest(KVStore &store){
+    BenchmarkOptions options;
+    options.putKeys = options.getKeys = sequentialKeys(LARGE_TEST * 4);
+    options.report = [](KVStore &store){ store.compactionReport(std::cout); };
+    options.restore = [](KVStore &store){ store.setCompactionStyle(COMPACTION_LEVELED); };
+    auto style = [](CompactionStyle style, uint32_t fanout, bool dynamic){
+        return [=](KVStore &store){ store.setCompactionStyle(style, fanout, dynamic); };
+    };
+    benchmark(store, "Compaction Style Test", options, {
+        {"Leveled", style(COMPACTION_LEVELED, 2, false)},
+        {"Leveled fanout 4", style(COMPACTION_LEVELED, 4, false)},
+        {"Leveled dynamic", style(COMPACTION_LEVELED, 4, true)},
+        {"Tiered", style(COMPACTION_TIERED, 4, false)},
+        {"Lazy leveling", style(COMPACTION_LAZY_LEVELING, 4, false)},
+        {"Guarded", style(COMPACTION_GUARDED, 4, false)},
+    });
+}
+
+// 按选择输入的顺序比较写放大与每下移一个字节重写的下一层字节数，写入的键有热点
+void compactionPriorityTest(KVStore &store){
+    BenchmarkOptions options;
+    uint64_t size = LARGE_TEST * 4;
+    std::mt19937 gen(42);
+    for(uint64_t i = 0; i < size; i++){
+        options.putKeys.push_back((gen() % 4 == 0) ? gen() % size : gen() % (size / 16)); // 四分之三的写入集中在十六分之一的键上
+    }
+    options.shuffle = false;
+    options.report = [](KVStore &store){ store.compactionReport(std::cout); };
+    options.restore = [](KVStore &store){
+        store.setCompactionPriority(COMPACTION_PRI_OLDEST);
+        store.setTableFormat(TABLE_FORMAT_V2);
+    };
+    auto priority = [](CompactionPriority priority){
+        return [=](KVStore &store){
+            store.setTableFormat(TABLE_FORMAT_V2, MAX_KEY_NUMBER); // 文件较小，每层的文件较多，选择才有差别
+            store.setCompactionPriority(priority);
+        };
+    };
+    benchmark(store, "Compaction Priority Test", options, {
+        {"Oldest", priority(COMPACTION_PRI_OLDEST)},
+        {"Min overlap", priority(COMPACTION_PRI_MIN_OVERLAP)},
+        {"Round robin", priority(COMPACTION_PRI_ROUND_ROBIN)},
+    });
+}
+
+// 写入与读交替进行，比较不限速、固定限速与按读延迟自动调节时读的平均与99分位延迟，以及各优先级等待令牌的时间
+void rateLimitTest(KVStore &store){
+    std::cout << "Rate Limit Test: " << std::endl;
+    uint64_t size = LARGE_TEST * 2;
+    const uint64_t MB = 1024 * 1024;
+    std::mt19937 gen(42);
+    struct { const char *name; uint64_t rate; uint64_t targetMicros; } limitList[] = {
+        {"Unlimited", 0, 0},
+        {"Limited 16 MB/s", 16 * MB, 0},
+        {"Auto tuned", 0, 20},
+    };
+    for(auto &option : limitList){
+        store.reset();
+        store.setRateLimit(option.rate);
+        if(option.targetMicros > 0){
+            store.setRateLimitAutoTune(option.targetMicros, 4 * MB, 64 * MB);
+        }
+        std::vector<uint64_t> latencies;
+        auto start = std::chrono::high_resolution_clock::now();
+        for(uint64_t i = 0; i < size; i++){
+            store.put(gen() % size, std::string(SMALL_SIZE, 's'));
+            auto getStart = std::chrono::high_resolution_clock::now();
+            store.get(gen() % (i + 1));
+            auto getEnd = std::chrono::high_resolution_clock::now();
+            latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(getEnd - getStart).count());
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        std::sort(latencies.begin(), latencies.end());
+        uint64_t total = 0;
+        for(uint64_t latency : latencies){
+            total += latency;
+        }
+        std::cout << option.name
+            << ": total " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << " ms"
+            << ", get average latency " << total / size << " ns"
+            << ", p99 " << latencies[size * 99 / 100] << " ns" << std::endl;
+        store.rateLimitReport(std::cout);
+        store.setRateLimitAutoTune(0, 0, 0);
+    }
+    store.setRateLimit(0);
+}
+
+void seekCompactionTest(KVStore &store){
+    std::cout << "Seek Compaction Test: " << std::endl;
+    uint64_t size = LARGE_TEST * 4;
+    for(bool enabled : {false, true}){
+        store.reset();
+        store.setSeekCompaction(enabled);
+        std::mt19937 gen(42);
+        for(uint64_t i = 0; i < size; i++){
+            store.put(gen() % size, std::string(SMALL_SIZE, 's'));
+        }
+        // 再写入一个分散在整个键空间的level-0文件，level-0未溢出，读操作都要先检查它
+        for(uint64_t i = 0; i < MAX_KEY_NUMBER * 3 / 2; i++){
+            store.put(gen() % size, std::string(SMALL_SIZE, 'u'));
+        }
+        std::cout << (enabled ? "Enabled" : "Disabled") << ":";
+        for(int round = 0; round < 5; round++){
+            auto start = std::chrono::high_resolution_clock::now();
+            for(uint64_t i = 0; i < size; i++){
+                store.get(gen() % size);
+            }
+            auto end = std::chrono::high_resolution_clock::now();
+            std::cout << " " << std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / size << " ns";
+        }
+        std::cout << std::endl;
+        store.seekReport(std::cout);
+        store.compactionReport(std::cout);
+    }
+    store.setSeekCompaction(false);
+}
+
+// 按level-0的分区数与刷写线程数比较写入的耗时，最后检查读到的值
+void l0PartitionTest(KVStore &store){
+    BenchmarkOptions options;
+    options.putKeys = options.getKeys = sequentialKeys(LARGE_TEST * 4);
+    options.report = [](KVStore &store){ store.compactionReport(std::cout); };
+    options.restore = [](KVStore &store){ store.setL0Partitions(L0_PARTITIONS, FLUSH_THREADS); };
+    std::vector<BenchmarkCase> cases;
+    for(auto config : std::vector<std::pair<uint32_t, uint32_t>>{{1, 0}, {1, 1}, {4, 0}, {4, 2}, {4, 4}, {8, 4}}){
+        cases.push_back({"Partitions " + std::to_string(config.first) + ", flush threads " + std::to_string(config.second),
+            [config](KVStore &store){ store.setL0Partitions(config.first, config.second); }});
+    }
+    benchmark(store, "L0 Partition Test", options, cases);
+}
+
+// 比较扫描整个区间与用迭代器逐个读取的耗时，以及迭代器得到前几个结果的延迟
+void iteratorTest(KVStore &store){
+    std::cout << "Iterator Test: " << std::endl;
+    uint64_t size = LARGE_TEST * 4;
+    store.reset();
+    std::mt19937 gen(42);
+    for(uint64_t i = 0; i < size; i++){
+        store.put(gen() % size, std::string(SMALL_SIZE, 's'));
+    }
+    auto start = std::chrono::high_resolution_clock::now();
+    std::list<std::pair<uint64_t, std::string>> list;
+    store.scan(0, size, list);
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "Scan " << list.size() << " keys: " << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << " us" << std::endl;
+
+    start = std::chrono::high_resolution_clock::now();
+    auto it = store.newIterator(0, size);
+    uint64_t count = 0;
+    for(it->seek_to_first(); it->valid() && count < 10; it->next()){
+        it->value();
+        count++;
+    }
+    end = std::chrono::high_resolution_clock::now();
+    std::cout << "Iterator first " << count << " keys: " << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << " us" << std::endl;
+
+    for(bool values : {false, true}){
+        start = std::chrono::high_resolution_clock::now();
+        count = 0;
+        for(it->seek_to_first(); it->valid(); it->next()){
+            if(values){
+                it->value();
+            }
+            count++;
+        }
+        end = std::chrono::high_resolution_clock::now();
+        std::cout << "Iterator " << count << " keys" << (values ? " with values: " : ": ")
+            << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << " us" << std::endl;
+    }
+
+    start = std::chrono::high_resolution_clock::now();
+    count = 0;
+    for(it->seek_to_last(); it->valid(); it->prev()){
+        count++;
+    }
+    end = std::chrono::high_resolution_clock::now();
+    std::cout << "Iterator " << count << " keys backward: " << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << " us" << std::endl;
+}
+
 // 测试程序
 int main() {
     KVStore store("./data", "./data/vlog");
@@ -203,4 +966,25 @@ int main() {
     cacheTest(store);
     // compactTest(store);
     // bloomTest(store);
+    // falsePositiveTest();
+    // filterAllocationTest(store);
+    // rangeFilterTest(store);
+    // searchTest();
+    // packedTest(store);
+    // lazyTest(store);
+    // formatTest(store);
+    // compressionTest(store);
+    // mmapTest(store);
+    // openTest();
+    // backgroundCompactionTest(store);
+    // subcompactionTest(store);
+    // mergeTest();
+    // writeAmplificationTest(store);
+    // tombstoneTest(store);
+    // compactionStyleTest(store);
+    // compactionPriorityTest(store);
+    // rateLimitTest(store);
+    // seekCompactionTest(store);
+    // l0PartitionTest(store);
+    // iteratorTest(store);
 }
\ No newline at end of file
@@ -0,0 +1,76 @@
+#include "packedarray.h"
+
+// 从位流的bitPos处读取width位
+uint64_t PackedArray::read(uint64_t bitPos, uint8_t width) const
+{
+    if(width == 0){
+        return 0;
+    }
+    uint64_t word = bitPos >> 6;
+    uint64_t shift = bitPos & 63;
+    uint64_t value = words[word] >> shift;
+    if(shift + width > 64){
+        value |= words[word + 1] << (64 - shift);
+    }
+    return (width == 64) ? value : (value & (((uint64_t)1 << width) - 1));
+}
+
+PackedArray::PackedArray(const std::vector<uint64_t> &values) : size(values.size())
+{
+    uint64_t bitPos = 0;
+    for(uint64_t begin = 0; begin < size; begin += PACKED_BLOCK_SIZE){
+        uint64_t end = std::min<uint64_t>(begin + PACKED_BLOCK_SIZE, size);
+        PackedBlock block;
+        block.base = *std::min_element(values.begin() + begin, values.begin() + end);
+        uint64_t range = *std::max_element(values.begin() + begin, values.begin() + end) - block.base;
+        block.width = (range == 0) ? 0 : 64 - __builtin_clzll(range);
+        block.start = bitPos;
+        blocks.push_back(block);
+
+        words.resize((bitPos + (end - begin) * block.width) / 64 + 2, 0);
+        for(uint64_t i = begin; i < end; i++){
+            uint64_t delta = values[i] - block.base;
+            if(block.width > 0){
+                uint64_t word = bitPos >> 6;
+                uint64_t shift = bitPos & 63;
+                words[word] |= delta << shift;
+                if(shift + block.width > 64){
+                    words[word + 1] |= delta >> (64 - shift);
+                }
+            }
+            bitPos += block.width;
+        }
+    }
+    words.shrink_to_fit();
+}
+
+PackedArray::PackedArray(const std::vector<uint32_t> &values) : PackedArray(std::vector<uint64_t>(values.begin(), values.end()))
+{
+}
+
+uint64_t PackedArray::lower_bound(uint64_t key) const
+{
+    // 找到最后一个最小值小于key的块，答案在该块内或紧随其后
+    uint64_t low = 0;
+    uint64_t high = blocks.size();
+    while(low < high){
+        uint64_t mid = (low + high) / 2;
+        if(blocks[mid].base < key) low = mid + 1;
+        else high = mid;
+    }
+    if(low == 0){
+        return 0;
+    }
+    uint64_t blockIndex = low - 1;
+    const PackedBlock &block = blocks[blockIndex];
+    uint64_t begin = blockIndex * PACKED_BLOCK_SIZE;
+    uint64_t end = std::min<uint64_t>(begin + PACKED_BLOCK_SIZE, size);
+    low = begin;
+    high = end;
+    while(low < high){
+        uint64_t mid = (low + high) / 2;
+        if(block.base + read(block.start + (mid - begin) * block.width, block.width) < key) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
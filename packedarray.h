@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include "global.h"
+
+// 位压缩数组中的一块
+struct PackedBlock{
+    uint64_t base; // 块内最小值
+    uint64_t start; // 块在位流中的起始位置
+    uint8_t width; // 块内每个值减去base后的位宽
+};
+
+/*
+ * 帧参考（frame-of-reference）位压缩数组
+ * 每PACKED_BLOCK_SIZE个值为一块，块内的值减去块内最小值后按最小位宽紧密存放
+ * 每个值的位置可以直接算出，因此仍然支持随机访问，查找时只需解码所需的那一块
+ * 用于压缩缓存中的键、偏移量与值长度
+ */
+class PackedArray{
+private:
+    std::vector<PackedBlock> blocks;
+    std::vector<uint64_t> words; // 位流，末尾多留一个字便于跨字读取
+    uint64_t size;
+
+    uint64_t read(uint64_t bitPos, uint8_t width) const;
+
+public:
+    explicit PackedArray(const std::vector<uint64_t> &values);
+
+    explicit PackedArray(const std::vector<uint32_t> &values);
+
+    uint64_t get(uint64_t i) const {
+        const PackedBlock &block = blocks[i / PACKED_BLOCK_SIZE];
+        return block.base + read(block.start + (i % PACKED_BLOCK_SIZE) * block.width, block.width);
+    }
+
+    // 值有序时，第一个不小于key的位置，不存在时为size
+    // 先在各块的最小值（即首个值）上二分，再只在一个块内二分
+    uint64_t lower_bound(uint64_t key) const;
+
+    uint64_t byteSize() const { return blocks.size() * sizeof(PackedBlock) + words.size() * sizeof(uint64_t); }
+};
@@ -0,0 +1,61 @@
+#include "rangefilter.h"
+
+RangeFilter::RangeFilter() : prefixBits(0)
+{
+}
+
+// 键有序，相邻的相同前缀只插入一次
+RangeFilter::RangeFilter(const std::vector<uint64_t> &keyList, uint32_t prefixBits, uint32_t bitsPerKey) : prefixBits(prefixBits)
+{
+    uint64_t prefixNumber = 0;
+    for(uint64_t i = 0; i < keyList.size(); i++){
+        if(i == 0 || (keyList[i] >> prefixBits) != (keyList[i - 1] >> prefixBits)){
+            prefixNumber++;
+        }
+    }
+    bloomFilter = BloomFilter(prefixNumber, bitsPerKey);
+    for(uint64_t i = 0; i < keyList.size(); i++){
+        if(i == 0 || (keyList[i] >> prefixBits) != (keyList[i - 1] >> prefixBits)){
+            bloomFilter.insert(keyList[i] >> prefixBits);
+        }
+    }
+}
+
+// 区间覆盖的前缀过多时无法判断，保守地返回true
+bool RangeFilter::mayContain(uint64_t k1, uint64_t k2) const
+{
+    uint64_t low = k1 >> prefixBits;
+    uint64_t high = k2 >> prefixBits;
+    if(high - low >= RANGE_FILTER_MAX_PROBES){
+        return true;
+    }
+    for(uint64_t prefix = low; ; prefix++){
+        if(bloomFilter.search(prefix)){
+            return true;
+        }
+        if(prefix == high) break;
+    }
+    return false;
+}
+
+// 类型标记、前缀粒度与布隆过滤器
+uint64_t RangeFilter::byteSize() const
+{
+    return 2 * sizeof(uint32_t) + bloomFilter.byteSize();
+}
+
+void RangeFilter::filter_to_byte(char **dst)
+{
+    uint32_to_byte(FILTER_MAGIC | FILTER_TYPE_PREFIX, dst);
+    uint32_to_byte(prefixBits, dst);
+    bloomFilter.filter_to_byte(dst);
+}
+
+// 前缀粒度不小于64时右移没有定义，说明数据损坏；仍读完整个段，使之后的内容位置不变
+bool RangeFilter::byte_to_filter(char **src)
+{
+    prefixBits = byte_to_uint32(src);
+    byte_to_uint32(src); // 布隆过滤器的类型标记
+    bloomFilter.byte_to_bloom(src);
+    return prefixBits < 64;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include "global.h"
+#include "bloomfilter.h"
+
+/*
+ * 前缀布隆过滤器，作为范围过滤器
+ * 将每个键右移prefixBits位得到前缀，插入布隆过滤器
+ * 扫描[k1, k2]时逐个查询区间覆盖的前缀，全部不存在即可跳过整个SSTable
+ * prefixBits越大前缀越少、内存越小，但短区间的判断越粗
+ */
+class RangeFilter{
+private:
+    uint32_t prefixBits; // 前缀的粒度
+    BloomFilter bloomFilter; // 存放前缀
+
+public:
+    RangeFilter();
+
+    // 为有序的键构建过滤器，每个前缀分配bitsPerKey位
+    RangeFilter(const std::vector<uint64_t> &keyList, uint32_t prefixBits, uint32_t bitsPerKey);
+
+    // 区间内可能存在键返回true，一定不存在返回false
+    bool mayContain(uint64_t k1, uint64_t k2) const;
+
+    uint64_t byteSize() const;
+
+    void filter_to_byte(char **dst);
+
+    // 调用前类型标记应已被读出；前缀粒度越界时返回false，调用者丢弃该过滤器
+    bool byte_to_filter(char **src);
+};
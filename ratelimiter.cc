@@ -0,0 +1,146 @@
+#include "ratelimiter.h"
+
+uint64_t RateLimiter::refill_bytes() const
+{
+    return std::max<uint64_t>(bytesPerSecond * RATE_LIMIT_REFILL_MICROS / 1000000, 1);
+}
+
+// 队首的请求超过桶的容量时，等到桶满后取走全部令牌
+void RateLimiter::refill(std::chrono::steady_clock::time_point now)
+{
+    if(now < nextRefill){
+        return;
+    }
+    tune(now);
+    uint64_t capacity = refill_bytes();
+    available = std::min(available + capacity, capacity);
+    nextRefill = now + std::chrono::microseconds(RATE_LIMIT_REFILL_MICROS);
+    bool granted = false;
+    for(auto &queue : queues){
+        while(!queue.empty() && (queue.front()->bytes <= available || available == capacity)){
+            Request *request = queue.front();
+            available -= std::min(available, request->bytes);
+            request->granted = true;
+            queue.pop_front();
+            granted = true;
+        }
+        if(!queue.empty()){
+            break;
+        }
+    }
+    if(granted){
+        refilled.notify_all();
+    }
+}
+
+void RateLimiter::tune(std::chrono::steady_clock::time_point now)
+{
+    if(targetMicros == 0 || now < nextTune){
+        return;
+    }
+    nextTune = now + std::chrono::microseconds(RATE_LIMIT_TUNE_MICROS);
+    uint64_t count = latencyCount.exchange(0);
+    uint64_t sum = latencySum.exchange(0);
+    if(count > 0 && sum / count > targetMicros){
+        bytesPerSecond = std::max(minRate, bytesPerSecond - bytesPerSecond / 4);
+    } else if(drained){
+        bytesPerSecond = std::min(maxRate, bytesPerSecond + std::max<uint64_t>(bytesPerSecond / 4, 1));
+    }
+    drained = false;
+    tunes++;
+}
+
+void RateLimiter::request(uint64_t bytes, IOPriority priority)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    requestedBytes[priority] += bytes;
+    while(bytes > 0 && bytesPerSecond > 0){
+        Request request{std::min(bytes, refill_bytes())};
+        bytes -= request.bytes;
+        auto start = std::chrono::steady_clock::now();
+        refill(start);
+        // 没有排队的请求且令牌足够时直接取走
+        if(queues[IO_PRIORITY_HIGH].empty() && queues[IO_PRIORITY_LOW].empty() && available >= request.bytes){
+            available -= request.bytes;
+            continue;
+        }
+        queues[priority].push_back(&request);
+        drained = true;
+        waits[priority]++;
+        while(!request.granted){
+            refilled.wait_until(lock, nextRefill);
+            refill(std::chrono::steady_clock::now());
+        }
+        auto end = std::chrono::steady_clock::now();
+        waitMicros[priority] += std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    }
+}
+
+void RateLimiter::set_rate(uint64_t rate)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    bytesPerSecond = rate;
+    if(rate == 0){
+        for(auto &queue : queues){
+            for(Request *request : queue){
+                request->granted = true;
+            }
+            queue.clear();
+        }
+    }
+    refilled.notify_all();
+}
+
+uint64_t RateLimiter::rate()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return bytesPerSecond;
+}
+
+void RateLimiter::set_auto_tune(uint64_t targetLatencyMicros, uint64_t minBytesPerSecond, uint64_t maxBytesPerSecond)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        targetMicros = targetLatencyMicros;
+        minRate = std::max<uint64_t>(minBytesPerSecond, 1);
+        maxRate = std::max(minRate, maxBytesPerSecond);
+        nextTune = std::chrono::steady_clock::now() + std::chrono::microseconds(RATE_LIMIT_TUNE_MICROS);
+        drained = false;
+        latencySum = 0;
+        latencyCount = 0;
+    }
+    if(targetLatencyMicros > 0){
+        set_rate(maxRate);
+    }
+}
+
+void RateLimiter::record_latency(uint64_t micros)
+{
+    latencySum.fetch_add(micros, std::memory_order_relaxed);
+    latencyCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void RateLimiter::report(std::ostream &os)
+{
+    static const char *priorityNames[] = {"high", "low"};
+    std::lock_guard<std::mutex> lock(mutex);
+    os << "Rate limit " << bytesPerSecond << " bytes/s";
+    if(targetMicros > 0){
+        os << " (auto tuned, target " << targetMicros << " us, range " << minRate << "-" << maxRate << ", tunes " << tunes << ")";
+    }
+    os << std::endl;
+    for(int priority = IO_PRIORITY_HIGH; priority <= IO_PRIORITY_LOW; priority++){
+        os << "  " << priorityNames[priority] << " priority: requested " << requestedBytes[priority] << " bytes"
+            << ", waits " << waits[priority]
+            << ", waited " << waitMicros[priority] << " us" << std::endl;
+    }
+}
+
+void RateLimiter::clear_stats()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for(int priority = IO_PRIORITY_HIGH; priority <= IO_PRIORITY_LOW; priority++){
+        requestedBytes[priority] = waits[priority] = waitMicros[priority] = 0;
+    }
+    tunes = 0;
+}
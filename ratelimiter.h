@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
+#include <deque>
+#include <ostream>
+#include "global.h"
+
+/*
+ * 令牌桶限速器，刷写、合并与GC写入硬盘时共用
+ * 每RATE_LIMIT_REFILL_MICROS补充一个周期的令牌，桶中最多存一个周期的令牌；超过一个周期令牌数的请求分块申请
+ * 令牌不足时请求按优先级排队，补充的令牌先满足高优先级的队首，同一优先级先来先得；高优先级的队首等待时低优先级不能插队
+ * 速率为0时不限速，不排队也不计时
+ * 自动调节以前台读的平均延迟为反馈：每RATE_LIMIT_TUNE_MICROS检查一次，超过目标时速率降低四分之一，
+ * 低于目标且期间有写入等待过令牌时提高四分之一，始终保持在[minRate, maxRate]内
+ */
+class RateLimiter{
+private:
+    struct Request{
+        uint64_t bytes;
+        bool granted = false;
+    };
+
+    std::mutex mutex;
+    std::condition_variable refilled;
+    uint64_t bytesPerSecond = 0;
+    uint64_t available = 0; // 桶中的令牌，即可以写入的字节数
+    std::chrono::steady_clock::time_point nextRefill;
+    std::deque<Request *> queues[2]; // 按IOPriority排队的请求
+
+    // 自动调节
+    uint64_t targetMicros = 0; // 前台读的目标平均延迟，为0时不调节
+    uint64_t minRate = 0;
+    uint64_t maxRate = 0;
+    std::chrono::steady_clock::time_point nextTune;
+    bool drained = false; // 上次调节以来有请求等待过令牌
+    std::atomic<uint64_t> latencySum{0};
+    std::atomic<uint64_t> latencyCount{0};
+
+    // 统计
+    uint64_t requestedBytes[2] = {0, 0};
+    uint64_t waits[2] = {0, 0};
+    uint64_t waitMicros[2] = {0, 0};
+    uint64_t tunes = 0;
+
+    // 每个周期补充的令牌数
+    uint64_t refill_bytes() const;
+
+    // 到期时补充令牌并按优先级分配给队首的请求，调用者持有mutex
+    void refill(std::chrono::steady_clock::time_point now);
+
+    // 按前台读的延迟调整速率，调用者持有mutex
+    void tune(std::chrono::steady_clock::time_point now);
+
+public:
+    // 申请写入bytes字节，令牌不足时阻塞
+    void request(uint64_t bytes, IOPriority priority);
+
+    // 修改速率，等待中的请求按新的速率继续；关闭限速时唤醒所有等待者
+    void set_rate(uint64_t rate);
+
+    uint64_t rate();
+
+    // 开启或关闭自动调节，开启时从maxRate开始
+    void set_auto_tune(uint64_t targetLatencyMicros, uint64_t minBytesPerSecond, uint64_t maxBytesPerSecond);
+
+    bool auto_tuning() const { return targetMicros > 0; }
+
+    // 记录一次前台读的延迟，不加锁
+    void record_latency(uint64_t micros);
+
+    void report(std::ostream &os);
+
+    void clear_stats();
+};
@@ -135,50 +135,48 @@ bool Skiplist::del(uint64_t key)
     return false;  
 }
 
-// SCAN操作
-// 要重构成std::map形式，并维护时间戳
-void Skiplist::scan(uint64_t k1,uint64_t k2,
-        std::map<uint64_t, std::string> &map, std::map<uint64_t, uint64_t> &timeStamp)
+// 迭代器的定位操作
+Skiplist_Node *Skiplist::seek(uint64_t key) const
 {
-
-    // 查找不小于K1的最小键
     Skiplist_Node * p = head;
     for(int i = level; i >= 0; i--){
         // 查找直到最底层
-        while(p->forward[i]->isData == true && p->forward[i]->key < k1){
+        while(p->forward[i]->isData == true && p->forward[i]->key < key){
             p = p->forward[i];
         }
     }
+    return p->forward[0]->isData ? p->forward[0] : NULL;
+}
 
-    // 落在最底层，查找不小于k1的最小键
-    do{
-        p = p->forward[0];
-        if(p->isData == false){
-            //已经到达tail，返回空链表
-            return;
+Skiplist_Node *Skiplist::seek_for_prev(uint64_t key) const
+{
+    Skiplist_Node * p = head;
+    for(int i = level; i >= 0; i--){
+        while(p->forward[i]->isData == true && p->forward[i]->key <= key){
+            p = p->forward[i];
         }
-    }while(p->key < k1);
+    }
+    return p->isData ? p : NULL;
+}
 
-    while(p->isData == true && p->key <= k2){
-        if(p->value != "~DELETED"){
-            // 未被标记为删除，放入list中
-            map[p->key] = p->value;
-            timeStamp[p->key] = currentTimeStamp; // 使用当前的时间戳，保证跳表的才是最新纪录
-        }
-        p = p->forward[0];
+std::vector<uint64_t> Skiplist::keys() const
+{
+    std::vector<uint64_t> result;
+    result.reserve(keyNum);
+    for(Skiplist_Node *p = head->forward[0]; p->isData; p = p->forward[0]){
+        result.push_back(p->key);
     }
+    return result;
 }
 
 /*
- * 当Memtable大小即将溢出时，将memtable写入硬盘
+ * 当Memtable大小即将溢出时，先把值写入vLog
+ * vLog的字典与写入位置只在前台线程修改，因此这一步总在前台进行，生成SSTable可以交给后台线程
  */
-void Skiplist::to_disk(const std::string &file_path, vLog &vlog, 
-    std::map<std::uint32_t, std::map<std::string, CacheTable>> &cacheMap)
+bool Skiplist::to_vlog(vLog &vlog, SSTable &sstable, CacheTable &cacheTable, IOPriority priority)
 {
     // 先检查是否为空
-    if(keyNum == 0) return;
-    // 在进行SSTable硬盘写入的同时写入缓存，提高效率
-    CacheTable cacheTable;
+    if(keyNum == 0) return false;
     // TODO:减少计算
 
     // 首先遍历memtable，将所有结果压入到一个entry数组中
@@ -192,12 +190,11 @@ void Skiplist::to_disk(const std::string &file_path, vLog &vlog,
         cacheTable.keyList.push_back(p->key);
         // 检查是否已被删除，如果是，需要设置vlen为0
         if(p->value != "~DELETED~"){
-            cacheTable.vlenList.push_back(p->value.length());
-
+            // 按值长度所属的类压缩，vLog中存放编码后的值
             entry.key = p->key;
-            entry.vlen = p->value.length();
-            entry.value = p->value;
+            entry.vlen = vlog.encode_value(p->value, entry.value);
             entry.magic = 0xff;
+            cacheTable.vlenList.push_back(entry.vlen);
             // 计算校验和
             std::vector<unsigned char> data;
             const unsigned char* keyBytes = reinterpret_cast<const unsigned char*>(&entry.key);
@@ -210,47 +207,41 @@ void Skiplist::to_disk(const std::string &file_path, vLog &vlog,
             data.insert(data.end(), valueBytes, valueBytes + entry.value.size());
             entry.checkNum = utils::crc16(data);
 
-            length += (VLOG_ENTRY_HEAD + entry.vlen);
+            length += (VLOG_ENTRY_HEAD + entry.value.length());
         } else {
             cacheTable.vlenList.push_back(0);
             entry.vlen = 0;
         }
         entries.push_back(entry);
     }
-    // 将结果放入vLog中，并得到offsetList
-    cacheTable.offsetList = vlog.addNewEntrys(entries,length);
+    // 将结果放入vLog中，并得到offsetList；写入失败时不生成SSTable
+    if(!vlog.addNewEntrys(entries, length, cacheTable.offsetList, &sstable.rateLimiter, priority)){
+        return false;
+    }
 
-    // 计算SSTable的头部
-    cacheTable.timeStamp = currentTimeStamp;
+    // 计算SSTable的头部，时间戳在写入level-0时确定
     cacheTable.KVNumber = cacheTable.keyList.size();
     cacheTable.minKey = cacheTable.keyList.front();
     cacheTable.maxKey = cacheTable.keyList.back();
+    return true;
+}
 
-    // 生成布隆过滤器
-    for(auto &it : cacheTable.keyList){ // 遍历keyList并放入布隆过滤器
-        cacheTable.bloomFilter.insert(it);
+/*
+ * 当Memtable大小即将溢出时，将memtable写入硬盘
+ */
+bool Skiplist::to_disk(const std::string &file_path, vLog &vlog, SSTable &sstable, IOPriority priority)
+{
+    if(keyNum == 0){
+        return true;
     }
-
-    // 计算char数组
-    char * bytes = new char[SSTABLE_MAX_BYTES];
-    char *init = bytes;
-    uint64_to_byte(cacheTable.timeStamp, &bytes);
-    uint64_to_byte(cacheTable.KVNumber, &bytes);
-    uint64_to_byte(cacheTable.minKey, &bytes);
-    uint64_to_byte(cacheTable.maxKey, &bytes);
-    cacheTable.bloomFilter.bloom_to_byte(&bytes);
-    for(int i = 0; i < keyNum; i++){
-        uint64_to_byte(cacheTable.keyList[i], &bytes);
-        uint64_to_byte(cacheTable.offsetList[i], &bytes);
-        uint32_to_byte(cacheTable.vlenList[i], &bytes);
+    // 在进行SSTable硬盘写入的同时写入缓存，提高效率
+    CacheTable cacheTable;
+    if(!to_vlog(vlog, sstable, cacheTable, priority)){
+        return false;
+    }
+    if(!sstable.flush_table(file_path, cacheTable, currentTimeStamp, vlog.path, priority)){
+        return false;
     }
-    // 插入到缓存的level 0
-    cacheMap[0][file_path] = cacheTable;
-
-    std::fstream file;
-    file.open(file_path, std::fstream::out | std::fstream::binary);
-    file.write(init,HEAD_LENGTH + BLOOM_LENGTH + CELL_LENGTH * keyNum);
-    file.close();
-    delete [] init;
     currentTimeStamp++; // 最后再加，即这个全局变量表征跳表的时间戳
-}
\ No newline at end of file
+    return true;
+}
@@ -63,9 +63,24 @@ public:
 
     bool del(uint64_t key);
 
-    void scan(uint64_t k1,uint64_t k2,
-        std::map<uint64_t, std::string> &map, std::map<uint64_t, uint64_t> &timeStamp);
+    // 第一个不小于key的节点，不存在时为NULL；已删除的键也是节点，值为"~DELETED~"
+    Skiplist_Node *seek(uint64_t key) const;
 
-    void to_disk(const std::string &file_path, vLog &vlog,
-        std::map<std::uint32_t, std::map<std::string, CacheTable>> &cacheMap);
+    // 最后一个不大于key的节点，不存在时为NULL
+    Skiplist_Node *seek_for_prev(uint64_t key) const;
+
+    // node的下一个节点，不存在时为NULL
+    static Skiplist_Node *next(Skiplist_Node *node) { return node->forward[0]->isData ? node->forward[0] : NULL; }
+
+    // 按升序返回所有键，包括已删除的键
+    std::vector<uint64_t> keys() const;
+
+    // 把值写入vLog，在cacheTable中填好键、偏移量、值长度与键区间；跳表为空或写入vLog失败时返回false
+    // vLog不落盘，由写入level-0的一方在写SSTable前同步
+    bool to_vlog(vLog &vlog, SSTable &sstable, CacheTable &cacheTable, IOPriority priority);
+
+    bool empty() const { return keyNum == 0; }
+
+    // 写入vLog与level-0，GC触发的刷写以低优先级申请令牌；失败时返回false，跳表保持不变
+    bool to_disk(const std::string &file_path, vLog &vlog, SSTable &sstable, IOPriority priority = IO_PRIORITY_HIGH);
 };
\ No newline at end of file
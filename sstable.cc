@@ -1,40 +1,210 @@
 #include "sstable.h"
+#include "mergeiterator.h"
+#include "tablebuilder.h"
+#include "compactionpicker.h"
+#include "MurmurHash3.h"
+#include <bit>
+#include <cmath>
+#include <ostream>
+#include <chrono>
+
+static_assert(std::endian::native == std::endian::little, "v4格式的数组按小端原地使用");
 
 // 初始化level
 SSTable::SSTable()
 {
-    levelFileNum[0] = 2;
+    levelFileNum[0] = 2 * l0Partitions;
+    picker = CompactionPicker::create(compactionStyle);
+    rebalance_filters();
+    if(compactionThreads > 0){
+        compactionPool = std::make_unique<ThreadPool>(compactionThreads);
+    }
+    if(maxSubcompactions > 1){
+        subcompactionPool = std::make_unique<ThreadPool>(maxSubcompactions - 1);
+    }
+}
+
+// 不再开始新的合并，等待正在进行的合并结束后回收线程
+SSTable::~SSTable()
+{
+    {
+        std::unique_lock<std::mutex> lock(compactionMutex);
+        compactionDone.wait(lock, [this]{ return runningFlushes == 0; });
+        compactionStopping = true;
+        compactionDone.wait(lock, [this]{ return runningJobs == 0; });
+    }
+    flushPool.reset();
+    compactionPool.reset();
+}
+
+
+// 在缓存的SSTable中查找第一个不小于key的元组
+uint64_t CacheTable::lower_bound(uint64_t key) const
+{
+    if(mappedKeys){
+        return std::lower_bound(mappedKeys, mappedKeys + KVNumber, key) - mappedKeys;
+    }
+    if(packedKeys){
+        return packedKeys->lower_bound(key);
+    }
+    if(eytzingerIndex){
+        return eytzingerIndex->lower_bound(key);
+    }
+    if(learnedIndex){
+        return learnedIndex->lower_bound(key);
+    }
+    return std::lower_bound(keyList.begin(), keyList.end(), key) - keyList.begin();
+}
+
+uint64_t CacheTable::metadataBytes() const
+{
+    uint64_t bytes = keyList.size() * sizeof(uint64_t) + offsetList.size() * sizeof(uint64_t) + vlenList.size() * sizeof(uint32_t);
+    if(packedKeys) bytes += packedKeys->byteSize() + packedOffsets->byteSize() + packedVlens->byteSize();
+    if(learnedIndex) bytes += learnedIndex->byteSize();
+    if(eytzingerIndex) bytes += eytzingerIndex->byteSize();
+    bytes += (fenceKeys.size() + blockOffsets.size()) * sizeof(uint64_t);
+    return bytes;
 }
 
+void CacheTable::move_body(CacheTable &other)
+{
+    KVNumber = other.KVNumber;
+    filter = std::move(other.filter);
+    rangeFilter = std::move(other.rangeFilter);
+    keyList = std::move(other.keyList);
+    offsetList = std::move(other.offsetList);
+    vlenList = std::move(other.vlenList);
+    packedKeys = std::move(other.packedKeys);
+    packedOffsets = std::move(other.packedOffsets);
+    packedVlens = std::move(other.packedVlens);
+    format = other.format;
+    fileSize = other.fileSize;
+    path = std::move(other.path);
+    tableId = other.tableId;
+    lazyLoaded = other.lazyLoaded;
+    fenceKeys = std::move(other.fenceKeys);
+    blockOffsets = std::move(other.blockOffsets);
+    mapping = std::move(other.mapping);
+    mappedKeys = other.mappedKeys;
+    mappedOffsets = other.mappedOffsets;
+    mappedVlens = other.mappedVlens;
+    learnedIndex = std::move(other.learnedIndex);
+    eytzingerIndex = std::move(other.eytzingerIndex);
+}
 
 // 在SSTable中查找，注意是在缓存中查找
 bool SSTable::get(uint64_t key, std::string &value, vLog &vlog, uint64_t &offset)
 {
     // 需要检查最新的记录，即需要检查时间戳
     uint64_t newTimeStamp = 0; // 记录最新的时间戳
+    uint32_t newLevel = 0; // 最新记录所在的层与文件编号
+    uint64_t newNumber = 0;
     bool isFound = false;
+    const CacheTable *answer = nullptr; // 得到结果的文件
+    thread_local std::vector<std::pair<uint32_t, const CacheTable *>> probed; // 键区间覆盖键、检查过的文件
+    probed.clear();
+    std::shared_lock<std::shared_mutex> lock(versionMutex);
     for(auto &levelDir : cacheMap){ // 遍历每一层
-        for(auto &cachePair : levelDir.second){ // 遍历每一层的每一个CacheTable
-            if(cachePair.second.timeStamp > newTimeStamp){ // 只检查最新的记录
-                if(getByOne(cachePair.second, key, value, vlog, offset)){ // 找到了
-                    newTimeStamp = cachePair.second.timeStamp;
+        auto probe = [&](const CacheTable &cacheTable){
+            // 只检查最新的记录；分段布局中同一层可能有时间戳相同且重叠的片段，编号大的是之后写入的
+            if(cacheTable.timeStamp > newTimeStamp
+            || (cacheTable.timeStamp == newTimeStamp && levelDir.first == newLevel && cacheTable.fileNumber > newNumber)){
+                if(seekCompaction && key >= cacheTable.minKey && key <= cacheTable.maxKey){
+                    probed.emplace_back(levelDir.first, &cacheTable);
+                }
+                if(getByOne(cacheTable, levelDir.first, key, value, vlog, offset)){ // 找到了
+                    newTimeStamp = cacheTable.timeStamp;
+                    newLevel = levelDir.first;
+                    newNumber = cacheTable.fileNumber;
+                    answer = &cacheTable;
                     isFound = true;
                 } else {
                     // 没找到，检查是否将value设置为DELETED
                     if(value == "~DELETED~"){
                         value = "";
-                        newTimeStamp = cachePair.second.timeStamp;
+                        newTimeStamp = cacheTable.timeStamp;
+                        newLevel = levelDir.first;
+                        newNumber = cacheTable.fileNumber;
+                        answer = &cacheTable;
                         isFound = false;
                     }
                 }
             }
+        };
+        auto indexIt = guardIndex.find(levelDir.first);
+        if(indexIt != guardIndex.end()){ // 分段布局只访问键所在守卫区间的片段
+            const GuardIndex &index = indexIt->second;
+            uint64_t i = std::upper_bound(index.minKeys.begin(), index.minKeys.end(), key) - index.minKeys.begin();
+            for(; i > 0 && index.maxPrefix[i - 1] >= key; i--){
+                probe(*index.tables[i - 1]);
+            }
+            continue;
+        }
+        for(auto &cachePair : levelDir.second){ // 遍历每一层的每一个CacheTable
+            probe(cachePair.second);
         }
     }
+    if(seekCompaction){
+        charge_probes(probed, answer);
+    }
     return isFound;
 }
 
+uint64_t SSTable::seek_budget(const CacheTable &cacheTable) const
+{
+    return std::max(seekMinProbes, cacheTable.fileSize / std::max<uint64_t>(seekBytesPerProbe, 1));
+}
+
+bool SSTable::has_deeper_files(uint32_t level) const
+{
+    for(auto levelIt = cacheMap.upper_bound(level); levelIt != cacheMap.end(); levelIt++){
+        if(!levelIt->second.empty()){
+            return true;
+        }
+    }
+    return false;
+}
+
+// 文件的计数是原子变量，读操作在共享锁下并发累加；各层统计与候选由seekMutex保护，每次查询最多加一次锁
+void SSTable::charge_probes(const std::vector<std::pair<uint32_t, const CacheTable *>> &probed, const CacheTable *answer)
+{
+    const CacheTable *candidate = nullptr;
+    uint32_t candidateLevel = 0;
+    bool wasted = false;
+    for(auto &probePair : probed){
+        const CacheTable &cacheTable = *probePair.second;
+        if(&cacheTable == answer){
+            continue;
+        }
+        wasted = true;
+        uint64_t probes = cacheTable.wastedProbes.fetch_add(1, std::memory_order_relaxed) + 1;
+        if(candidate || seekPending.load(std::memory_order_relaxed) || probes < seek_budget(cacheTable)
+        || !has_deeper_files(probePair.first)){
+            continue;
+        }
+        candidate = &cacheTable;
+        candidateLevel = probePair.first;
+    }
+    if(!wasted){
+        return;
+    }
+    std::lock_guard<std::mutex> lock(seekMutex);
+    for(auto &probePair : probed){
+        if(probePair.second != answer){
+            seekStats[probePair.first].wastedProbes++;
+        }
+    }
+    if(candidate && !seekPending){
+        seekLevel = candidateLevel;
+        seekFile = candidate->fileNumber;
+        seekPending = true;
+        seekTriggered = true;
+        seekStats[candidateLevel].triggers++;
+    }
+}
+
 // 查找缓存中的单个SSTable
-bool SSTable::getByOne(CacheTable cacheTable, uint64_t key, std::string &value, vLog &vlog, uint64_t &offset)
+bool SSTable::getByOne(const CacheTable &cacheTable, uint32_t level, uint64_t key, std::string &value, vLog &vlog, uint64_t &offset)
 {
     
     // 遍历元组之前，应当先检查键的最值和布隆过滤器，提高效率
@@ -42,200 +212,685 @@ bool SSTable::getByOne(CacheTable cacheTable, uint64_t key, std::string &value,
     if(key < cacheTable.minKey || key > cacheTable.maxKey){
         return false;
     }
-    // 再检查布隆过滤器
-    if(!cacheTable.bloomFilter.search(key)){
+    wait_loaded(cacheTable);
+    // 再检查过滤器
+    // 读操作在共享锁下并发进行，只能查找已有的统计项
+    auto statsIt = filterStats.find(level);
+    FilterStats *stats = (statsIt != filterStats.end()) ? &statsIt->second : nullptr;
+    if(stats){
+        stats->queries.fetch_add(1, std::memory_order_relaxed);
+    }
+    if(!cacheTable.filter->search(key)){
         return false;
     }
-    // 最后再考虑遍历，需要使用二分查找法
-    std::vector<uint64_t> keyList = cacheTable.keyList;
-    std::vector<uint32_t> vlenList = cacheTable.vlenList;
-    uint64_t low = 0;
-    uint64_t high = cacheTable.KVNumber - 1;
-    uint64_t mid;
-    while(low <= high){
-        mid = (low + high) / 2;
-        if(keyList[mid] == key){ // 找到键
-            if(vlenList[mid] != 0){ // 且未被删除
-                offset = cacheTable.offsetList[mid];
-                value = vlog.get(cacheTable.offsetList[mid], vlenList[mid]);
-                return true;
-            }
-            offset = cacheTable.offsetList[mid];
-            value = "~DELETED~";
-            return false;     
-        }
-        else if(keyList[mid] < key){ // 在右半部分
-            low = mid + 1;
-            continue;
+    // 最后再通过内存索引或块缓存查找
+    uint32_t vlen;
+    if(find_cell(cacheTable, level, key, offset, vlen)){ // 找到键
+        if(stats){
+            stats->hits.fetch_add(1, std::memory_order_relaxed);
         }
-        else{
-            high = mid - 1;
-            continue;
+        if(vlen != 0){ // 且未被删除
+            // 值损坏时返回空串并计入解码失败的统计，不能退回更深层的旧版本
+            if(!vlog.get(offset, vlen, value)){
+                value = "";
+            }
+            return true;
+        }
+        value = "~DELETED~";
+        return false;
+    }
+    if(stats){
+        stats->falsePositives.fetch_add(1, std::memory_order_relaxed);
+    }
+    return false;
+}
+
+// 按需加载的SSTable先由首键确定块，再在块内二分查找
+bool SSTable::find_cell(const CacheTable &cacheTable, uint32_t level, uint64_t key, uint64_t &offset, uint32_t &vlen)
+{
+    if(cacheTable.lazy()){
+        const std::vector<uint64_t> &fenceKeys = cacheTable.fenceKeys;
+        uint64_t blockIndex = std::upper_bound(fenceKeys.begin(), fenceKeys.end(), key) - fenceKeys.begin();
+        if(blockIndex == 0){
+            return false;
+        }
+        BlockIterator it(load_block(cacheTable, blockIndex - 1, level));
+        it.seek(key);
+        if(it.valid() && it.key() == key){
+            offset = it.offset();
+            vlen = it.vlen();
+            return true;
         }
+        return false;
+    }
+    uint64_t pos = cacheTable.lower_bound(key);
+    if(pos < cacheTable.KVNumber && cacheTable.key(pos) == key){
+        offset = cacheTable.offset(pos);
+        vlen = cacheTable.vlen(pos);
+        return true;
     }
     return false;
 }
 
-// 扫描介于k1与k2之间的键值对，为保证顺序，临时使用std::map
-// 这里提供简单的方法，即直接查找所有缓存的SSTable
-void SSTable::scan(uint64_t k1,uint64_t k2, 
-        std::map<uint64_t, std::string> &map, std::map<uint64_t, uint64_t> &timeStamp, vLog &vlog)
+void SSTable::scan_tables(uint64_t k1, uint64_t k2, std::vector<std::pair<uint32_t, const CacheTable *>> &tables)
 {
+    scanStats.scans++;
+    scanStats.lastOverlapped = 0;
+    scanStats.lastSkipped = 0;
     for(auto &levelDir : cacheMap){ // 遍历每一层
         for(auto &cachePair : levelDir.second){ // 遍历每一层的每一个CacheTable
-            scanByOne(cachePair.second, k1, k2, map, timeStamp, vlog);
+            const CacheTable &cacheTable = cachePair.second;
+            if(k2 < cacheTable.minKey || k1 > cacheTable.maxKey){ // 不存在重叠区间
+                continue;
+            }
+            wait_loaded(cacheTable);
+            scanStats.overlapped++;
+            scanStats.lastOverlapped++;
+            // 在访问键之前先查询范围过滤器
+            if(cacheTable.rangeFilter && !cacheTable.rangeFilter->mayContain(k1, k2)){
+                scanStats.skipped++;
+                scanStats.lastSkipped++;
+                continue;
+            }
+            tables.emplace_back(levelDir.first, &cacheTable);
         }
     }
+    std::sort(tables.begin(), tables.end(), [](const std::pair<uint32_t, const CacheTable *> &a, const std::pair<uint32_t, const CacheTable *> &b){
+        if(a.second->timeStamp != b.second->timeStamp){
+            return a.second->timeStamp > b.second->timeStamp;
+        }
+        if(a.first != b.first){
+            return a.first < b.first;
+        }
+        return a.second->fileNumber > b.second->fileNumber;
+    });
+}
+
+// MANIFEST中记录的文件信息
+static FileMeta file_meta(const CacheTable &cacheTable)
+{
+    FileMeta meta;
+    meta.number = cacheTable.fileNumber;
+    meta.timeStamp = cacheTable.timeStamp;
+    meta.KVNumber = cacheTable.KVNumber;
+    meta.minKey = cacheTable.minKey;
+    meta.maxKey = cacheTable.maxKey;
+    meta.fileSize = cacheTable.fileSize;
+    return meta;
 }
 
-// 对单个SSTable进行扫描
-// 注意时间戳的问题
-void SSTable::scanByOne(CacheTable cacheTable, uint64_t k1, uint64_t k2, 
-    std::map<uint64_t, std::string> &map, std::map<uint64_t, uint64_t> &timeStamp, vLog &vlog)
+/*
+ * 合并操作（最难的）
+ * 同步合并时从level-0开始逐层检查到最深层，溢出的层各合并一次；后台合并时只提交任务，由线程池逐层继续
+ * 按字节计算目标时最深层移到新一层后较浅的层的目标会变小，因此不在第一个未溢出的层停止
+ */
+void SSTable::compaction()
 {
-    if(k2 < cacheTable.minKey || k1 > cacheTable.maxKey){ // 不存在重叠区间
+    if(!compactionPool){
+        finish_open(); // 合并会复制与删除缓存项，后台加载必须先结束
+        for(uint32_t level = 0; ; level++){
+            {
+                std::shared_lock<std::shared_mutex> lock(versionMutex);
+                if(levelFileNum.find(level) == levelFileNum.end()){
+                    break;
+                }
+            }
+            compact_level(level); // 未溢出时直接返回
+        }
         return;
     }
+    std::lock_guard<std::mutex> lock(compactionMutex);
+    schedule_compactions();
+}
 
-    uint64_t less; // 下限索引
-    uint64_t max; // 上限索引
-    std::vector<uint64_t> keyList = cacheTable.keyList;
-    std::vector<uint64_t> offsetList = cacheTable.offsetList;
-    std::vector<uint32_t> vlenList = cacheTable.vlenList;
-
-    // 使用二分查找确定索引区间
-    if(k1 > cacheTable.minKey){
-        uint64_t low = 0;
-        uint64_t high = cacheTable.KVNumber - 1;
-        uint64_t mid;
-        while(low <= high){
-            mid = (low + high) / 2;
-            if(keyList[mid] == k1){ // 找到键
-               less = mid;
-               break;
-            }
-            else if(keyList[mid] < k1){ // 在右半部分
-                low = mid + 1;
-                continue;
+/*
+ * 单层的合并
+ * 只在选择输入与替换文件时持有独占锁，归并与写入期间读操作照常访问合并前的版本
+ */
+void SSTable::compact_level(uint32_t level)
+{
+    // 对于每一个level的操作，分解为四个函数处理
+    std::vector<std::pair<std::string, CacheTable>> selected; // 所有需要合并的文件
+    std::uint64_t minKey; // 便于找下一层的交集文件
+    std::uint64_t maxKey;
+    std::uint64_t timeStamp; // 合并后这些文件的新时间戳
+    uint64_t overflowNumber; // selected中前这么多个文件来自当前层
+    bool clamped = false; // 输入比本层剩下的文件新，输出的时间戳被压低
+    bool movable = true; // 合并策略允许原样移动输入文件
+    std::vector<uint64_t> cuts; // 输出文件的切分点
+    uint32_t nextLevel = level + 1;
+    std::vector<std::pair<uint64_t, uint64_t>> deeperRanges; // 输出层以下各文件的键区间
+    {
+        std::unique_lock<std::shared_mutex> lock(versionMutex);
+        auto levelIt = cacheMap.find(level);
+        if(levelIt == cacheMap.end()){
+            return;
+        }
+        // 未溢出时只合并查找触发的候选
+        bool seek = (picker->score(*this, level) <= 1);
+        if(seek && !select_seek_file(level, selected)){
+            return;
+        }
+        // 1. 统计当前level需要合并的文件，数目由合并策略决定，只取部分文件时按compactionPriority选择
+        if(seek || picker->pick_files(*this, level, selected) || select_partition(level, selected)){
+            minKey = UINT64_MAX;
+            maxKey = 0;
+            timeStamp = 0;
+            for(auto &cachePair : selected){
+                minKey = std::min(minKey, cachePair.second.minKey);
+                maxKey = std::max(maxKey, cachePair.second.maxKey);
+                timeStamp = std::max(timeStamp, cachePair.second.timeStamp);
             }
-            else{
-                less = mid; // 随时更新
-                high = mid - 1;
-                continue;
+        } else {
+            uint64_t overflowFiles = picker->overflow_files(*this, level);
+            if(overflowFiles >= levelIt->second.size() || compactionPriority == COMPACTION_PRI_OLDEST
+            || !select_window(level, overflowFiles, selected, minKey, maxKey, timeStamp)){
+                select_overflow(levelIt->second, selected, overflowFiles, minKey, maxKey, timeStamp);
             }
         }
-    } else {
-        less = 0;
-    }
-
-    if(k2 < cacheTable.maxKey){
-        uint64_t low = 0;
-        uint64_t high = cacheTable.KVNumber - 1;
-        uint64_t mid;
-        while(low <= high){
-            mid = (low + high) / 2;
-            if(keyList[mid] == k2){ // 找到键
-               max = mid;
-               break;
-            }
-            else if(keyList[mid] < k2){ // 在右半部分
-                max = mid; // 随时更新
-                low = mid + 1;
-                continue;
+        overflowNumber = selected.size();
+        if(overflowNumber == 0){
+            return;
+        }
+        // 归并时时间戳相同的版本取靠前的输入；按时间戳或最小键选出的文件也要把同一时间戳中编号大的排在前面，与读操作一致
+        std::sort(selected.begin(), selected.end(), [](const auto &item1, const auto &item2){
+            return (item1.second.timeStamp > item2.second.timeStamp)
+                || ((item1.second.timeStamp == item2.second.timeStamp)
+                && (item1.second.fileNumber > item2.second.fileNumber));
+        });
+
+        // 2. 找到下一层中键区间有交集的文件；分级合并时输出作为下一层的新段，不重写下一层
+        if(levelFileNum.find(nextLevel) == levelFileNum.end()){ // 先看看下一层是否存在，不存在就创建
+            levelFileNum[nextLevel] = compactionFanout * levelFileNum[level];
+            rebalance_filters(); // 层数增加，重新分配过滤器内存
+        }
+        if(seek || picker->merge_next_level(*this, level)){ // 查找触发的合并总是重写下一层，才能减少重叠的文件
+            select_next_level(cacheMap[nextLevel], selected, nextLevel, minKey, maxKey, timeStamp);
+        }
+        // 输出的时间戳不超过本层剩下的文件，保持每层的文件都不比下一层旧，读操作与之后按时间戳选择的合并才能得到最新的版本
+        for(auto &cachePair : levelIt->second){
+            bool input = false;
+            for(uint64_t i = 0; i < overflowNumber && !input; i++){
+                input = (selected[i].first == cachePair.first);
             }
-            else{
-                high = mid - 1;
-                continue;
+            if(!input && cachePair.second.timeStamp < timeStamp){
+                timeStamp = cachePair.second.timeStamp;
+                clamped = true;
             }
         }
-    } else {
-        max = cacheTable.KVNumber - 1;
-    }
-
-    uint64_t key;
-    uint64_t thisTimeStamp = cacheTable.timeStamp;
-    // 扫描索引区间，注意更新时间戳
-    for(uint64_t i = less; i <= max; i++){
-        key = keyList[i];
-        if(timeStamp.find(key) != timeStamp.end()){
-            // 已有记录
-            if(timeStamp[key] < thisTimeStamp){
-                // 可以替换时间戳
-                timeStamp[key] = thisTimeStamp;
-                if(vlenList[i] != 0){
-                    map[key] = vlog.get(offsetList[i],vlenList[i]);
-                } else {
-                    // 已被删除
-                    map.erase(key);
+        // 正在刷写的Memtable稍后才放入level-0，也算作本层剩下的文件
+        if(level == 0 && !flushingStamps.empty() && *flushingStamps.begin() < timeStamp){
+            timeStamp = *flushingStamps.begin();
+            clamped = true;
+        }
+        for(uint64_t i = 0; i < overflowNumber && movable; i++){
+            movable = picker->can_move(*this, level, selected[i].second);
+        }
+        // 移动的文件保留编号，同一层中时间戳相同的重叠文件按编号大者为准，下一层有这样的文件时照常重写，使输出的编号最大
+        for(auto &cachePair : cacheMap[nextLevel]){
+            for(uint64_t i = 0; i < overflowNumber && movable; i++){
+                const CacheTable &input = selected[i].second;
+                movable = !(cachePair.second.timeStamp == input.timeStamp
+                    && cachePair.second.minKey <= input.maxKey && cachePair.second.maxKey >= input.minKey);
+            }
+        }
+        cuts = picker->output_cuts(*this, level);
+        PickStats &stats = pickStats[level];
+        stats.picks++;
+        for(uint64_t i = 0; i < selected.size(); i++){
+            ((i < overflowNumber) ? stats.inputBytes : stats.overlapBytes) += selected[i].second.fileSize;
+        }
+        // 下一层中未被选中的段也可能含有同一个键的旧版本
+        std::set<std::string> inputs;
+        for(uint64_t i = overflowNumber; i < selected.size(); i++){
+            inputs.insert(selected[i].first);
+        }
+        for(auto levelIt = cacheMap.lower_bound(nextLevel); levelIt != cacheMap.end(); levelIt++){
+            for(auto &cachePair : levelIt->second){
+                if(!inputs.count(cachePair.first)){
+                    deeperRanges.emplace_back(cachePair.second.minKey, cachePair.second.maxKey);
                 }
             }
+        }
+    }
+    if(!utils::dirExists(dir_path + "/level-" + std::to_string(nextLevel))){
+        utils::mkdir(dir_path + "/level-" + std::to_string(nextLevel));
+    }
+
+    // 2.2 下一层没有重叠的文件时，输入之间也互不重叠就只需移动文件；移动的文件保留原来的时间戳，因此时间戳被压低时照常重写
+    if(selected.size() == overflowNumber && !clamped && movable){
+        std::vector<std::pair<uint64_t, uint64_t>> ranges;
+        for(auto &cachePair : selected){
+            ranges.emplace_back(cachePair.second.minKey, cachePair.second.maxKey);
+        }
+        std::sort(ranges.begin(), ranges.end());
+        bool disjoint = true;
+        for(uint64_t i = 1; i < ranges.size() && disjoint; i++){
+            disjoint = ranges[i - 1].second < ranges[i].first;
+        }
+        if(disjoint && move_tables(level, selected)){
+            return;
+        }
+    }
+
+    // 2.5 按需加载的文件需要先读回全部元组，原来的文件在新版本落盘后才删除
+    std::vector<CacheTable> selectedSST;
+    VersionEdit edit;
+    for(uint64_t i = 0; i < selected.size(); i++){
+        materialize(selected[i].second);
+        selectedSST.emplace_back(selected[i].second);
+        edit.removed.emplace_back((i < overflowNumber) ? level : nextLevel, selected[i].second.fileNumber);
+    }
+
+    // 3. 按键区间切分为子合并，各自通过堆归并输入文件
+    // 4. 归并的结果流式写入新的文件，新文件落盘后一次性提交新增与删除的文件，再替换缓存中的输入文件
+    // 合并重叠的区间，之后按键的顺序查找
+    std::sort(deeperRanges.begin(), deeperRanges.end());
+    std::vector<std::pair<uint64_t, uint64_t>> coverage;
+    for(auto &range : deeperRanges){
+        if(!coverage.empty() && range.first <= coverage.back().second){
+            coverage.back().second = std::max(coverage.back().second, range.second);
         } else {
-            // 没有记录，放心放入
-            timeStamp[key] = thisTimeStamp;
-            if(vlenList[i] != 0){
-                map[key] = vlog.get(offsetList[i],vlenList[i]);
+            coverage.push_back(range);
+        }
+    }
+    std::vector<uint64_t> boundaries = subcompaction_boundaries(selectedSST);
+    uint64_t ranges = boundaries.size() + 1;
+    std::vector<VersionEdit> rangeEdits(ranges);
+    std::vector<std::vector<std::pair<std::string, CacheTable>>> rangeOutputs(ranges);
+    std::vector<char> rangeWritten(ranges, true);
+    auto subcompact = [&](uint64_t r){
+        std::vector<uint64_t> begin(selectedSST.size());
+        std::vector<uint64_t> end(selectedSST.size());
+        for(uint64_t i = 0; i < selectedSST.size(); i++){
+            begin[i] = (r == 0) ? 0 : selectedSST[i].lower_bound(boundaries[r - 1]);
+            end[i] = (r == ranges - 1) ? selectedSST[i].KVNumber : selectedSST[i].lower_bound(boundaries[r]);
+        }
+        TableBuilder builder(*this, nextLevel, timeStamp, rangeEdits[r], rangeOutputs[r], &cuts);
+        MergeIterator it(selectedSST, begin, end, vlogTail);
+        uint64_t coverIndex = 0; // coverage中第一个右端不小于当前键的区间
+        uint64_t tombstones = 0;
+        for(; it.valid(); it.next()){
+            uint64_t key = it.key();
+            if(it.vlen() == 0){
+                while(coverIndex < coverage.size() && coverage[coverIndex].second < key){
+                    coverIndex++;
+                }
+                if(coverIndex == coverage.size() || coverage[coverIndex].first > key){
+                    tombstones++; // 更深的层没有这个键，删除标记不再需要
+                    continue;
+                }
+            }
+            builder.add(key, it.offset(), it.vlen());
+        }
+        rangeWritten[r] = builder.finish();
+        garbageStats.droppedVersions += it.shadowed;
+        garbageStats.droppedTombstones += tombstones;
+        garbageStats.garbageBytes += it.shadowedBytes;
+    };
+    // 其余各段交给子合并线程，全部完成前不能离开本函数
+    std::mutex rangeMutex;
+    std::condition_variable rangeDone;
+    uint64_t pendingRanges = ranges - 1;
+    for(uint64_t r = 1; r < ranges; r++){
+        subcompactionPool->submit([&, r]{
+            subcompact(r);
+            // 持锁通知，等待者返回时任务已不再访问这些局部变量
+            std::lock_guard<std::mutex> lock(rangeMutex);
+            pendingRanges--;
+            rangeDone.notify_all();
+        });
+    }
+    subcompact(0);
+    {
+        std::unique_lock<std::mutex> lock(rangeMutex);
+        rangeDone.wait(lock, [&pendingRanges]{ return pendingRanges == 0; });
+    }
+    subcompactions += ranges;
+    std::vector<std::pair<std::string, CacheTable>> outputs;
+    for(uint64_t r = 0; r < ranges; r++){
+        edit.added.insert(edit.added.end(), rangeEdits[r].added.begin(), rangeEdits[r].added.end());
+        outputs.insert(outputs.end(), rangeOutputs[r].begin(), rangeOutputs[r].end());
+    }
+    bool written = std::find(rangeWritten.begin(), rangeWritten.end(), false) == rangeWritten.end();
+    if(!written || !log_edit(edit)){
+        for(auto &output : outputs){
+            utils::rmfile(output.first);
+        }
+        return;
+    }
+    for(auto &output : outputs){
+        writeAmpStats.compactionBytes += output.second.fileSize;
+    }
+    {
+        std::unique_lock<std::shared_mutex> lock(versionMutex);
+        for(uint64_t i = 0; i < selected.size(); i++){
+            cacheMap[(i < overflowNumber) ? level : nextLevel].erase(selected[i].first);
+        }
+        tableVersion++;
+        for(auto &output : outputs){
+            cacheMap[nextLevel][output.first] = output.second;
+        }
+        build_guard_index(level);
+        build_guard_index(nextLevel);
+    }
+    for(auto &cachePair : selected){
+        utils::rmfile(cachePair.first);
+    }
+}
+
+bool SSTable::move_tables(uint32_t level, const std::vector<std::pair<std::string, CacheTable>> &selected)
+{
+    uint32_t nextLevel = level + 1;
+    VersionEdit edit;
+    std::vector<std::pair<std::string, CacheTable>> outputs;
+    for(auto &cachePair : selected){
+        CacheTable cacheTable = cachePair.second;
+        cacheTable.wastedProbes = 0; // 在新的一层重新计数
+        std::string path = table_path(nextLevel, cacheTable.fileNumber);
+        utils::rmfile(path); // 编号唯一，同名文件只可能是上次移动中途崩溃留下的
+        if(link(cachePair.first.c_str(), path.c_str()) != 0){
+            for(auto &output : outputs){
+                utils::rmfile(output.first);
+            }
+            return false;
+        }
+        if(!cacheTable.path.empty()){
+            cacheTable.path = path; // 按需加载与映射的文件之后从新路径读取
+        }
+        edit.removed.emplace_back(level, cacheTable.fileNumber);
+        edit.added.emplace_back(nextLevel, file_meta(cacheTable));
+        outputs.emplace_back(path, cacheTable);
+    }
+    if(syncWrites){
+        sync_path(dir_path + "/level-" + std::to_string(nextLevel));
+    }
+    if(!log_edit(edit)){
+        for(auto &output : outputs){
+            utils::rmfile(output.first);
+        }
+        return true; // 版本没有变化，不再重写这些文件，留给下一轮合并
+    }
+    {
+        std::unique_lock<std::shared_mutex> lock(versionMutex);
+        for(auto &cachePair : selected){
+            cacheMap[level].erase(cachePair.first);
+        }
+        tableVersion++;
+        for(auto &output : outputs){
+            cacheMap[nextLevel][output.first] = output.second;
+        }
+        build_guard_index(level);
+        build_guard_index(nextLevel);
+    }
+    for(auto &cachePair : selected){
+        utils::rmfile(cachePair.first);
+        writeAmpStats.movedFiles++;
+        writeAmpStats.movedBytes += cachePair.second.fileSize;
+    }
+    return true;
+}
+
+// 每次从最溢出的层开始，跳过与正在合并的层有重叠的任务
+void SSTable::schedule_compactions()
+{
+    std::priority_queue<CompactionJob> jobs;
+    {
+        std::shared_lock<std::shared_mutex> lock(versionMutex);
+        for(auto &levelPair : levelFileNum){
+            double score = picker->score(*this, levelPair.first);
+            if(score > 1){
+                jobs.push({score, levelPair.first});
             }
         }
+        std::lock_guard<std::mutex> seekLock(seekMutex);
+        if(seekPending && picker->score(*this, seekLevel) <= 1){
+            jobs.push({0, seekLevel});
+        }
+    }
+    while(!jobs.empty() && runningJobs < compactionThreads && !compactionStopping){
+        CompactionJob job = jobs.top();
+        jobs.pop();
+        if(busyLevels.count(job.level) || busyLevels.count(job.level + 1)){
+            continue;
+        }
+        busyLevels.insert(job.level);
+        busyLevels.insert(job.level + 1);
+        runningJobs++;
+        compactionPool->submit([this, level = job.level]{ run_compaction(level); });
+    }
+}
+
+void SSTable::schedule_seek_compaction()
+{
+    if(seekTriggered.exchange(false)){
+        compaction();
     }
 }
 
 /*
- * 合并操作（最难的）
- * 操作是硬盘写入和缓存写入同时进行，但只读缓存
+ * 候选与本层重叠的文件也一起取出，直到不再增加；本层剩下的文件都不与输入重叠，输出的时间戳被压低时也不会覆盖它们的版本
+ * 取出后候选即被清除，之后的读操作可以产生新的候选
  */
-void SSTable::compaction()
+bool SSTable::select_seek_file(uint32_t level, std::vector<std::pair<std::string, CacheTable>> &selected)
 {
-    // 在PUT操作后都要调用合并操作，为此需要先检验要不要合并
-    if(cacheMap[0].size() <= levelFileNum[0]){
-        return; // 没有超出，返回
+    std::lock_guard<std::mutex> lock(seekMutex);
+    if(!seekPending || seekLevel != level){
+        return false;
+    }
+    seekPending = false;
+    const std::map<std::string, CacheTable> &tables = cacheMap[level];
+    auto seekIt = std::find_if(tables.begin(), tables.end(), [this](const auto &cachePair){
+        return cachePair.second.fileNumber == seekFile;
+    });
+    if(seekIt == tables.end() || !has_deeper_files(level)){
+        return false;
     }
+    std::set<std::string> chosen{seekIt->first};
+    uint64_t minKey = seekIt->second.minKey;
+    uint64_t maxKey = seekIt->second.maxKey;
+    for(bool grown = true; grown; ){
+        grown = false;
+        for(auto &cachePair : tables){
+            if(!chosen.count(cachePair.first) && cachePair.second.minKey <= maxKey && cachePair.second.maxKey >= minKey){
+                chosen.insert(cachePair.first);
+                minKey = std::min(minKey, cachePair.second.minKey);
+                maxKey = std::max(maxKey, cachePair.second.maxKey);
+                grown = true;
+            }
+        }
+    }
+    for(auto &path : chosen){
+        selected.emplace_back(path, tables.at(path));
+    }
+    // 归并时时间戳相同的版本取靠前的输入
+    std::sort(selected.begin(), selected.end(), [](const auto &item1, const auto &item2){
+        return (item1.second.timeStamp > item2.second.timeStamp)
+            || ((item1.second.timeStamp == item2.second.timeStamp)
+            && (item1.second.fileNumber > item2.second.fileNumber));
+    });
+    seekStats[level].compactions++;
+    return true;
+}
 
-    // 遍历level，进行合并
-    for(uint32_t level = 0; cacheMap[level].size() > levelFileNum[level]; level++){ // 检验是否超出当前层的容量
-        // 对于每一个level的操作，分解为四个函数处理
-        // 1. 统计当前level需要合并的文件
-        std::vector<std::pair<std::string, CacheTable>> selected; // 所有需要合并的文件
-        std::uint64_t minKey; // 便于找下一层的交集文件
-        std::uint64_t maxKey;
-        std::uint64_t timeStamp; // 合并后这些文件的新时间戳
-        select_overflow(cacheMap[level], selected, level, minKey, maxKey, timeStamp);
+void SSTable::run_compaction(uint32_t level)
+{
+    finish_open();
+    compact_level(level);
+    {
+        std::lock_guard<std::mutex> lock(compactionMutex);
+        busyLevels.erase(level);
+        busyLevels.erase(level + 1);
+        runningJobs--;
+        schedule_compactions(); // 下一层可能因此溢出
+    }
+    compactionDone.notify_all();
+}
 
-        // 2. 找到下一层中键区间有交集的文件
-        uint32_t nextLevel = level + 1;
-        if(levelFileNum.find(nextLevel) == levelFileNum.end()){ // 先看看下一层是否存在，不存在就创建
-            levelFileNum[nextLevel] = 2 * levelFileNum[level];
-        } 
-        if(!utils::dirExists(dir_path + "/level-" + std::to_string(nextLevel))){
-            utils::mkdir(dir_path + "/level-" + std::to_string(nextLevel));
-        }
-        select_next_level(cacheMap[nextLevel], selected, nextLevel,minKey, maxKey, timeStamp);
+void SSTable::throttle_writes()
+{
+    if(!compactionPool){
+        return;
+    }
+    // 分区时level-0的容量按分区数放大，阈值也一样
+    uint64_t slowdownFiles = l0SlowdownFiles * l0Partitions;
+    uint64_t stopFiles = l0StopFiles * l0Partitions;
+    uint64_t files = level_files(0);
+    if(files < slowdownFiles){
+        return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    if(files >= stopFiles){
+        std::unique_lock<std::mutex> lock(compactionMutex);
+        compactionDone.wait(lock, [this, stopFiles]{ return level_files(0) < stopFiles || runningJobs == 0; });
+        stallStats.stops++;
+    } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(WRITE_SLOWDOWN_MICROS));
+        stallStats.slowdowns++;
+    }
+    auto end = std::chrono::steady_clock::now();
+    stallStats.stallMicros += std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+}
 
-        // 2.5 删除原来的文件，并更新selected(毕竟路径无效了)
-        std::vector<CacheTable> selectedSST;
-        for(auto &cachePair : selected){
-            utils::rmfile(cachePair.first);
-            selectedSST.emplace_back(cachePair.second);
+void SSTable::release_garbage(uint64_t bytes)
+{
+    uint64_t garbage = garbageStats.garbageBytes;
+    while(!garbageStats.garbageBytes.compare_exchange_weak(garbage, garbage - std::min(garbage, bytes))){
+    }
+}
+
+void SSTable::wait_compactions()
+{
+    std::unique_lock<std::mutex> lock(compactionMutex);
+    compactionDone.wait(lock, [this]{ return runningJobs == 0 && runningFlushes == 0; });
+}
+
+void SSTable::set_compaction_threads(uint32_t threads)
+{
+    wait_compactions();
+    compactionPool.reset();
+    compactionThreads = threads;
+    if(threads > 0){
+        compactionPool = std::make_unique<ThreadPool>(threads);
+    }
+}
+
+void SSTable::set_subcompactions(uint32_t limit)
+{
+    quiesce();
+    subcompactionPool.reset();
+    maxSubcompactions = std::max<uint32_t>(limit, 1);
+    if(maxSubcompactions > 1){
+        subcompactionPool = std::make_unique<ThreadPool>(maxSubcompactions - 1);
+    }
+}
+
+void SSTable::quiesce()
+{
+    wait_compactions();
+    finish_open();
+}
+
+// level-0的容量不变，其余各层按新的扇出推算
+void SSTable::set_compaction_style(CompactionStyle style, uint32_t fanout, bool dynamic)
+{
+    quiesce();
+    std::unique_lock<std::shared_mutex> lock(versionMutex);
+    compactionStyle = style;
+    compactionFanout = std::max<uint32_t>(fanout, 2);
+    dynamicLevelBytes = dynamic;
+    picker = CompactionPicker::create(style);
+    for(auto &levelPair : levelFileNum){
+        if(levelPair.first > 0){
+            levelPair.second = compactionFanout * levelFileNum[levelPair.first - 1];
         }
+    }
+    guards.clear();
+    guardIndex.clear();
+    if(style == COMPACTION_GUARDED){
+        for(auto &levelPair : cacheMap){
+            for(auto &cachePair : levelPair.second){
+                sample_guards(cachePair.second);
+            }
+            build_guard_index(levelPair.first);
+        }
+    }
+    rebalance_filters();
+}
 
-        // 3. 使用归并排序
-        uint64_t assignment = selectedSST.size() * MAX_KEY_NUMBER;
-        std::vector<uint64_t> keyList; // 存放结果
-        std::vector<uint64_t> offsetList;
-        std::vector<uint32_t> vlenList;
+// level-0的文件只有两个左右，照常逐个检查
+void SSTable::build_guard_index(uint32_t level)
+{
+    auto levelIt = cacheMap.find(level);
+    if(level == 0 || compactionStyle != COMPACTION_GUARDED || levelIt == cacheMap.end()){
+        guardIndex.erase(level);
+        return;
+    }
+    std::vector<const CacheTable *> tables;
+    for(auto &cachePair : levelIt->second){
+        tables.push_back(&cachePair.second);
+    }
+    std::sort(tables.begin(), tables.end(), [](const CacheTable *table1, const CacheTable *table2){
+        return table1->minKey < table2->minKey;
+    });
+    GuardIndex &index = guardIndex[level];
+    index.minKeys.clear();
+    index.maxPrefix.clear();
+    for(const CacheTable *cacheTable : tables){
+        index.minKeys.push_back(cacheTable->minKey);
+        index.maxPrefix.push_back(std::max(index.maxPrefix.empty() ? 0 : index.maxPrefix.back(), cacheTable->maxKey));
+    }
+    index.tables.swap(tables);
+}
 
+// level-0与level-1的守卫相同
+uint32_t SSTable::guard_bits(uint32_t level) const
+{
+    uint32_t step = std::bit_width(compactionFanout) - 1; // log2(扇出)，向下取整
+    uint64_t fewer = (uint64_t)(std::max<uint32_t>(level, 1) - 1) * step;
+    return (fewer + GUARD_MIN_BITS >= GUARD_TOP_BITS) ? GUARD_MIN_BITS : GUARD_TOP_BITS - fewer;
+}
 
-        merge(keyList, offsetList, vlenList, selectedSST);
+const std::set<uint64_t> &SSTable::level_guards(uint32_t level) const
+{
+    static const std::set<uint64_t> empty;
+    auto guardIt = guards.find(guard_bits(level));
+    return (guardIt == guards.end()) ? empty : guardIt->second;
+}
 
-        // 4. 将结果切分后放入新的文件
-        set_sstable(timeStamp, keyList, offsetList, vlenList, nextLevel);
+void SSTable::sample_guards(const CacheTable &cacheTable)
+{
+    auto sample = [this](uint64_t key){
+        uint64_t hash[2] = {0};
+        MurmurHash3_x64_128(&key, sizeof(key), 1, hash);
+        uint32_t zeros = std::min<uint32_t>(std::countr_zero(hash[0]), GUARD_TOP_BITS);
+        for(uint32_t bits = GUARD_MIN_BITS; bits <= zeros; bits++){
+            guards[bits].insert(key);
+        }
+    };
+    if(cacheTable.lazy()){
+        for(uint64_t key : cacheTable.fenceKeys){
+            sample(key);
+        }
+        return;
     }
+    for(uint64_t i = 0; i < cacheTable.KVNumber; i++){
+        sample(cacheTable.key(i));
+    }
+}
+
+uint64_t SSTable::level_files(uint32_t level)
+{
+    std::shared_lock<std::shared_mutex> lock(versionMutex);
+    auto levelIt = cacheMap.find(level);
+    return (levelIt == cacheMap.end()) ? 0 : levelIt->second.size();
 }
 
 /**
- * 找到当前层的多余文件
+ * 找到当前层的多余文件，即最旧的selectedNum个
  * 第一优先为时间戳小，第二优先为最小键小
 */
-void SSTable::select_overflow(std::map<std::string, CacheTable> cacheList, std::vector<std::pair<std::string, CacheTable>> &selected, uint32_t level,
+void SSTable::select_overflow(const std::map<std::string, CacheTable> &cacheList, std::vector<std::pair<std::string, CacheTable>> &selected, uint64_t selectedNum,
     uint64_t &minKey, uint64_t &maxKey, uint64_t &timeStamp)
 {
     std::vector<std::pair<std::string, CacheTable>> temp(cacheList.begin(), cacheList.end());
@@ -245,172 +900,166 @@ void SSTable::select_overflow(std::map<std::string, CacheTable> cacheList, std::
             || ((item1.second.timeStamp == item2.second.timeStamp)
             && (item1.second.minKey < item2.second.minKey));
     });
-    // 计算选中的数量
-    int selectedNum = (level == 0) ? cacheList.size() : (cacheList.size() - levelFileNum[level]);
     minKey = UINT64_MAX;
     maxKey = 0;
     timeStamp = 0;
     // 压入到vector中
     // 计算selected的minKey和maxKey
-    for(int i = 0; i < selectedNum; i++){
+    for(uint64_t i = 0; i < selectedNum && i < temp.size(); i++){
         selected.emplace_back(temp[i]);
-        cacheMap[level].erase(temp[i].first);
         if(temp[i].second.minKey < minKey) minKey = temp[i].second.minKey;
         if(temp[i].second.maxKey > maxKey) maxKey = temp[i].second.maxKey;
         if(temp[i].second.timeStamp > timeStamp) timeStamp = temp[i].second.timeStamp;
     }
 }
 
-/**
- * 找到下一层中有键交集的文件
- * 注意这里的level要提前加一
-*/
-void SSTable::select_next_level(std::map<std::string, CacheTable> cacheList, std::vector<std::pair<std::string, CacheTable>> &selected, uint32_t level,
-    uint64_t minKey, uint64_t maxKey, uint64_t &timeStamp)
+/*
+ * 候选为按最小键排序后的每一段连续的selectedNum个文件，按游标之后的顺序依次考察
+ * 只考察与本层其余文件都不重叠的候选，分层合并的各层互不重叠，因此只在刚从分级合并切换过来时有所限制
+ */
+bool SSTable::select_window(uint32_t level, uint64_t selectedNum, std::vector<std::pair<std::string, CacheTable>> &selected,
+    uint64_t &minKey, uint64_t &maxKey, uint64_t &timeStamp)
 {
-    /* 应当提前检查
-    if(levelFileNum.find(level) == levelFileNum.end()){ // 没有创建
-        levelFileNum[level] = 2 * (level + 1);
-        utils::mkdir(dir_path + "/level-" + std::to_string(level));
+    std::vector<std::pair<std::string, CacheTable>> files(cacheMap[level].begin(), cacheMap[level].end());
+    uint64_t fileNumber = files.size();
+    if(selectedNum == 0 || selectedNum >= fileNumber){
+        return false;
     }
-    */
-    for(auto & cachePair : cacheList){
-        if(cachePair.second.minKey > maxKey || cachePair.second.maxKey < minKey){ // 没有交集
-            continue;
+    std::sort(files.begin(), files.end(), [](const auto &item1, const auto &item2){
+        return item1.second.minKey < item2.second.minKey;
+    });
+    std::vector<const CacheTable *> nextFiles;
+    auto nextIt = cacheMap.find(level + 1);
+    if(nextIt != cacheMap.end()){
+        for(auto &cachePair : nextIt->second){
+            nextFiles.push_back(&cachePair.second);
         }
-        // 有交集，压入vector
-        selected.emplace_back(cachePair);
-        cacheMap[level].erase(cachePair.first); // 在缓存中删了
-        if(cachePair.second.timeStamp > timeStamp) timeStamp = cachePair.second.timeStamp;
     }
-}
-
-/**
- * 归并排序
- * 给一个有序序列的数组，依次进行归并排序
- * 返回一组vector
-*/
-void SSTable::merge(std::vector<uint64_t> &keyList, std::vector<uint64_t> &offsetList, std::vector<uint32_t> &vlenList,
-    std::vector<CacheTable> &selected)
-{
-    uint64_t selectedSize = selected.size();
-    // 保存每个cacheTable已经保存了多少key
-    std::vector<uint64_t> finishKeys(selectedSize, 0);
-    // 保存上一次的键和时间戳，便于覆写
-    uint64_t oldMinKey = UINT64_MAX;
-    uint64_t oldTimeStamp = 0;
-    while(1){
-        uint64_t minKey = UINT64_MAX;
-        uint64_t offset;
-        uint32_t vlen;
-        uint64_t timeStamp;
-        uint64_t minIt; // 持有最小值的索引
-        // 遍历selected，找到最小值
-        for(uint64_t i = 0; i < selectedSize; i++){
-            if(finishKeys[i] < selected[i].KVNumber && selected[i].keyList[finishKeys[i]] < minKey){
-                minKey = selected[i].keyList[finishKeys[i]];
-                offset = selected[i].offsetList[finishKeys[i]];
-                vlen = selected[i].vlenList[finishKeys[i]];
-                minIt = i;
-                timeStamp = selected[i].timeStamp;
-            }
-        }
-        // 发现都没找到，说明遍历完成
-        if(minKey == UINT64_MAX){
-            break;
+    uint64_t cursor = compactCursor[level];
+    uint64_t start = 0;
+    while(start < fileNumber && files[start].second.minKey < cursor){
+        start++;
+    }
+    int64_t best = -1;
+    double bestRatio = 0;
+    for(uint64_t step = 0; step < fileNumber; step++){
+        uint64_t first = (start + step) % fileNumber;
+        if(first + selectedNum > fileNumber){
+            continue;
         }
-
-        // 保存key++
-        finishKeys[minIt] += 1;
-
-        // 检查keylist尾部的元素，其小于等于minKey
-        // 小于则直接push_back
-        // 等于需要比较时间戳，大的才能保留
-        if(keyList.size() > 0){
-            if(oldMinKey == minKey){
-                if(oldTimeStamp < timeStamp){
-                    // 需要覆写
-                    keyList.back() = minKey;
-                    offsetList.back() = offset;
-                    vlenList.back() = vlen;
-                    // 更新时间戳
-                    oldMinKey = minKey;
-                    oldTimeStamp = timeStamp;
-                }
-                // 否则舍弃
-            } else {
-                // 也只会是小于，进行插入
-                keyList.push_back(minKey);
-                offsetList.push_back(offset);
-                vlenList.push_back(vlen);
-                oldMinKey = minKey;
-                oldTimeStamp = timeStamp;
+        uint64_t low = UINT64_MAX, high = 0, bytes = 0;
+        for(uint64_t i = first; i < first + selectedNum; i++){
+            low = std::min(low, files[i].second.minKey);
+            high = std::max(high, files[i].second.maxKey);
+            bytes += files[i].second.fileSize;
+        }
+        // 本层其余的文件与候选有同一个键时，输出的时间戳可能被压低到它们之下，较新的版本反而被遮盖
+        bool overlapped = false;
+        for(uint64_t i = 0; i < fileNumber && !overlapped; i++){
+            overlapped = (i < first || i >= first + selectedNum) && files[i].second.minKey <= high && files[i].second.maxKey >= low;
+        }
+        if(overlapped){
+            continue;
+        }
+        uint64_t overlapBytes = 0;
+        for(auto nextFile : nextFiles){
+            if(nextFile->minKey <= high && nextFile->maxKey >= low){
+                overlapBytes += nextFile->fileSize;
             }
-        } else{
-            // 第一次
-            keyList.push_back(minKey);
-            offsetList.push_back(offset);
-            vlenList.push_back(vlen);
-            oldMinKey = minKey;
-            oldTimeStamp = timeStamp;
+        }
+        double ratio = (double)overlapBytes / std::max<uint64_t>(bytes, 1);
+        if(best < 0 || (compactionPriority == COMPACTION_PRI_MIN_OVERLAP && ratio < bestRatio)){
+            best = first;
+            bestRatio = ratio;
+        }
+        if(compactionPriority == COMPACTION_PRI_ROUND_ROBIN){
+            break;
         }
     }
-
+    if(best < 0){
+        pickStats[level].fallbacks++;
+        return false;
+    }
+    minKey = UINT64_MAX;
+    maxKey = 0;
+    timeStamp = 0;
+    for(uint64_t i = best; i < best + selectedNum; i++){
+        selected.emplace_back(files[i]);
+        minKey = std::min(minKey, files[i].second.minKey);
+        maxKey = std::max(maxKey, files[i].second.maxKey);
+        timeStamp = std::max(timeStamp, files[i].second.timeStamp);
+    }
+    compactCursor[level] = (maxKey == UINT64_MAX) ? 0 : maxKey + 1;
+    return true;
 }
 
-void SSTable::set_sstable(uint64_t timeStamp, std::vector<uint64_t> keyList, std::vector<uint64_t> offsetList, std::vector<uint32_t> vlenList,
-    uint32_t level){
-    uint64_t allKVNumber = keyList.size(); // 总的键值对数量
-    uint64_t currentKVNumber; // 当前文件键值对数量
-    while(allKVNumber > 0){
-        if(allKVNumber <= MAX_KEY_NUMBER){ // 最后一个
-            currentKVNumber = allKVNumber;
-            allKVNumber = 0;
-        } else {
-            allKVNumber -= MAX_KEY_NUMBER;
-            currentKVNumber = MAX_KEY_NUMBER;
+/**
+ * 找到下一层中有键交集的文件
+ * 注意这里的level要提前加一
+*/
+void SSTable::select_next_level(const std::map<std::string, CacheTable> &cacheList, std::vector<std::pair<std::string, CacheTable>> &selected, uint32_t level,
+    uint64_t minKey, uint64_t maxKey, uint64_t &timeStamp)
+{
+    /* 应当提前检查
+    if(levelFileNum.find(level) == levelFileNum.end()){ // 没有创建
+        levelFileNum[level] = 2 * (level + 1);
+        utils::mkdir(dir_path + "/level-" + std::to_string(level));
+    }
+    */
+    // 下一层的段可能互相重叠，与选中的文件重叠的也一起取出，直到不再增加；否则输出的时间戳可能盖过剩下的段中更新的版本
+    std::set<std::string> chosen;
+    uint64_t first = selected.size();
+    for(bool grown = true; grown; ){
+        grown = false;
+        for(auto & cachePair : cacheList){
+            if(chosen.count(cachePair.first) || cachePair.second.minKey > maxKey || cachePair.second.maxKey < minKey){ // 没有交集
+                continue;
+            }
+            // 有交集，压入vector
+            chosen.insert(cachePair.first);
+            selected.emplace_back(cachePair);
+            minKey = std::min(minKey, cachePair.second.minKey);
+            maxKey = std::max(maxKey, cachePair.second.maxKey);
+            if(cachePair.second.timeStamp > timeStamp) timeStamp = cachePair.second.timeStamp;
+            grown = true;
         }
-        // 乱写的，后续应当校验
-        // 初始化缓存
-        CacheTable cacheTable;
-        cacheTable.timeStamp = timeStamp;
-        cacheTable.KVNumber = currentKVNumber;
-        cacheTable.minKey = keyList[0];
-        cacheTable.maxKey = keyList[currentKVNumber - 1];
-        cacheTable.keyList.assign(keyList.begin(), keyList.begin() + currentKVNumber);
-        keyList.erase(keyList.begin(), keyList.begin() + currentKVNumber);
-        cacheTable.offsetList.assign(offsetList.begin(), offsetList.begin() + currentKVNumber);
-        offsetList.erase(offsetList.begin(), offsetList.begin() + currentKVNumber);
-        cacheTable.vlenList.assign(vlenList.begin(), vlenList.begin() + currentKVNumber);
-        vlenList.erase(vlenList.begin(), vlenList.begin() + currentKVNumber);
-        // 计算布隆过滤器
-        for(auto &it : cacheTable.keyList){
-            cacheTable.bloomFilter.insert(it);
-        }
-        // 计算char数组
-        char * bytes = new char[SSTABLE_MAX_BYTES];
-        char * init = bytes;
-        uint64_to_byte(cacheTable.timeStamp, &bytes);
-        uint64_to_byte(cacheTable.KVNumber, &bytes);
-        uint64_to_byte(cacheTable.minKey, &bytes);
-        uint64_to_byte(cacheTable.maxKey, &bytes);
-        cacheTable.bloomFilter.bloom_to_byte(&bytes);
-        for(uint64_t i = 0; i < currentKVNumber; i++){
-            uint64_to_byte(cacheTable.keyList[i], &bytes);
-            uint64_to_byte(cacheTable.offsetList[i], &bytes);
-            uint32_to_byte(cacheTable.vlenList[i], &bytes);
-        }
-        std::string path = dir_path + "/level-" + std::to_string(level) + "/" + std::to_string(cacheMap[level].size()) 
-        + "-" + std::to_string(timeStamp) + "-" + std::to_string(currentTimeStamp) + ".sst";
-        cacheMap[level][path] = cacheTable;
+    }
+    // 归并时时间戳相同的版本取靠前的输入，同一层中时间戳相同的重叠段以编号大的为准
+    std::sort(selected.begin() + first, selected.end(), [](const auto &item1, const auto &item2){
+        return (item1.second.timeStamp > item2.second.timeStamp)
+            || ((item1.second.timeStamp == item2.second.timeStamp)
+            && (item1.second.fileNumber > item2.second.fileNumber));
+    });
+}
 
-        // 写入硬盘
-        std::fstream file;
-        file.open(path, std::fstream::out | std::fstream::binary);
-        file.write(init, HEAD_LENGTH + BLOOM_LENGTH + CELL_LENGTH * currentKVNumber);
-        file.close();
-        delete [] init;
+/*
+ * 按最小键排序输入文件，累计键数每达到总数的1/n处以下一个文件的最小键为分界
+ * 下一层的文件互不重叠，分界大致落在文件之间；段数不超过maxSubcompactions，且每段至少有SUBCOMPACTION_MIN_TABLES个文件的键数
+ */
+std::vector<uint64_t> SSTable::subcompaction_boundaries(const std::vector<CacheTable> &selected)
+{
+    std::vector<uint64_t> boundaries;
+    uint64_t totalKeys = 0;
+    std::vector<std::pair<uint64_t, uint64_t>> starts; // <最小键，键数>
+    for(auto &cacheTable : selected){
+        totalKeys += cacheTable.KVNumber;
+        starts.emplace_back(cacheTable.minKey, cacheTable.KVNumber);
+    }
+    uint64_t ranges = std::min<uint64_t>(maxSubcompactions, totalKeys / (table_keys() * SUBCOMPACTION_MIN_TABLES));
+    if(ranges <= 1){
+        return boundaries;
     }
+    std::sort(starts.begin(), starts.end());
+    uint64_t accumulated = 0;
+    for(uint64_t i = 0; i + 1 < starts.size() && boundaries.size() + 1 < ranges; i++){
+        accumulated += starts[i].second;
+        uint64_t boundary = starts[i + 1].first;
+        if(accumulated * ranges >= totalKeys * (boundaries.size() + 1)
+        && (boundaries.empty() || boundary > boundaries.back()) && boundary > starts[0].first){
+            boundaries.push_back(boundary);
+        }
+    }
+    return boundaries;
 }
 
 // 在Memtable溢出时生成新的文件
@@ -418,62 +1067,1157 @@ void SSTable::set_sstable(uint64_t timeStamp, std::vector<uint64_t> keyList, std
 std::string SSTable::putNewFile()
 {
     std::string levelPath = dir_path + "/level-0";
-    if(cacheMap[0].empty()){ // level-0为空，需要创建
+    if(!utils::dirExists(levelPath)){ // level-0不存在，需要创建
         utils::mkdir(levelPath);
     }
-    std::string filePath = levelPath + "/" + std::to_string(cacheMap[0].size()) + "-" + std::to_string(currentTimeStamp) + "-" + std::to_string(currentTimeStamp) +".sst";
-    return filePath;
+    return table_path(0, new_file_number());
+}
+
+uint32_t SSTable::partition_of(uint64_t key) const
+{
+    return std::upper_bound(l0Bounds.begin(), l0Bounds.end(), key) - l0Bounds.begin();
+}
+
+// 分界取去重后的键的等分位置，键数少于分区数时分区也相应减少
+void SSTable::set_partition_bounds(std::vector<uint64_t> keys)
+{
+    std::unique_lock<std::shared_mutex> lock(versionMutex);
+    for(auto &levelPair : cacheMap){
+        for(auto &cachePair : levelPair.second){
+            keys.push_back(cachePair.second.minKey);
+            keys.push_back(cachePair.second.maxKey);
+        }
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    l0Bounds.clear();
+    if(keys.empty()){
+        return;
+    }
+    for(uint64_t i = 1; i < l0Partitions; i++){
+        uint64_t bound = keys[i * keys.size() / l0Partitions];
+        if(bound > 0 && (l0Bounds.empty() || bound > l0Bounds.back())){
+            l0Bounds.push_back(bound);
+        }
+    }
+}
+
+// 文件按最小键归入分区；与选中的文件重叠的其他文件也一起取出，直到不再增加，本层剩下的文件与输出互不重叠
+bool SSTable::select_partition(uint32_t level, std::vector<std::pair<std::string, CacheTable>> &selected)
+{
+    if(level != 0 || l0Bounds.empty()){
+        return false;
+    }
+    const std::map<std::string, CacheTable> &cacheList = cacheMap[level];
+    std::vector<uint64_t> files(l0Bounds.size() + 1, 0);
+    for(auto &cachePair : cacheList){
+        files[partition_of(cachePair.second.minKey)]++;
+    }
+    uint32_t partition = std::max_element(files.begin(), files.end()) - files.begin();
+    std::set<std::string> chosen;
+    for(auto &cachePair : cacheList){
+        if(partition_of(cachePair.second.minKey) == partition){
+            chosen.insert(cachePair.first);
+        }
+    }
+    for(bool grown = true; grown; ){
+        grown = false;
+        for(auto &cachePair : cacheList){
+            if(chosen.count(cachePair.first)){
+                continue;
+            }
+            for(auto &path : chosen){
+                const CacheTable &input = cacheList.at(path);
+                if(cachePair.second.minKey <= input.maxKey && cachePair.second.maxKey >= input.minKey){
+                    chosen.insert(cachePair.first);
+                    grown = true;
+                    break;
+                }
+            }
+        }
+    }
+    for(auto &path : chosen){
+        selected.emplace_back(path, cacheList.at(path));
+    }
+    std::sort(selected.begin(), selected.end(), [](const std::pair<std::string, CacheTable> &a, const std::pair<std::string, CacheTable> &b){
+        if(a.second.timeStamp != b.second.timeStamp){
+            return a.second.timeStamp > b.second.timeStamp;
+        }
+        return a.second.fileNumber > b.second.fileNumber;
+    });
+    return true;
+}
+
+bool SSTable::flush_table(const std::string &path, CacheTable &cacheTable, uint64_t timeStamp, const std::string &vlogPath, IOPriority priority)
+{
+    // SSTable引用这些值，vLog需要先于SSTable落盘
+    if(syncWrites){
+        sync_path(vlogPath);
+    }
+    cacheTable.timeStamp = timeStamp;
+
+    // 生成过滤器
+    build_filter(cacheTable, 0);
+
+    // 写入硬盘并在MANIFEST中记录，记录落盘后才放入缓存，失败时文件从未对读操作与合并可见
+    VersionEdit edit;
+    bool written = write_table(path, cacheTable, tableFormat, compression_of(0), &rateLimiter, priority);
+    if(written){
+        prepare_table(0, path, cacheTable, edit);
+    }
+    if(!written || !log_edit(edit)){
+        utils::rmfile(path);
+        return false;
+    }
+    writeAmpStats.flushBytes += cacheTable.fileSize;
+    std::unique_lock<std::shared_mutex> lock(versionMutex);
+    if(compactionStyle == COMPACTION_GUARDED){
+        sample_guards(cacheTable);
+    }
+    cacheMap[0][path] = cacheTable;
+    auto it = flushingStamps.find(timeStamp);
+    if(it != flushingStamps.end()){
+        flushingStamps.erase(it);
+    }
+    return true;
+}
+
+void SSTable::flush_async(std::shared_ptr<CacheTable> cacheTable, uint64_t timeStamp, const std::string &vlogPath, IOPriority priority, std::function<void(bool)> done)
+{
+    {
+        std::unique_lock<std::shared_mutex> lock(versionMutex);
+        flushingStamps.insert(timeStamp);
+    }
+    {
+        std::lock_guard<std::mutex> lock(compactionMutex);
+        runningFlushes++;
+    }
+    flushPool->submit([this, cacheTable, timeStamp, vlogPath, priority, done]{
+        // 值已在vLog中，失败时保留时间戳并重试；持续失败时交还调用者，不占住刷写线程
+        bool flushed = flush_table(putNewFile(), *cacheTable, timeStamp, vlogPath, priority);
+        for(uint32_t retries = 1; !flushed && retries < FLUSH_MAX_RETRIES; retries++){
+            std::this_thread::sleep_for(std::chrono::microseconds(FLUSH_RETRY_MICROS));
+            flushed = flush_table(putNewFile(), *cacheTable, timeStamp, vlogPath, priority);
+        }
+        done(flushed);
+        {
+            std::lock_guard<std::mutex> lock(compactionMutex);
+            runningFlushes--;
+            if(compactionPool){
+                schedule_compactions(); // level-0可能因此溢出
+            }
+        }
+        compactionDone.notify_all();
+    });
+}
+
+void SSTable::set_flush_threads(uint32_t threads)
+{
+    quiesce();
+    flushPool.reset();
+    if(threads > 0){
+        flushPool = std::make_unique<ThreadPool>(threads);
+    }
+}
+
+void SSTable::set_l0_partitions(uint32_t partitions)
+{
+    quiesce();
+    std::unique_lock<std::shared_mutex> lock(versionMutex);
+    l0Partitions = std::max<uint32_t>(partitions, 1);
+    l0Bounds.clear();
+    levelFileNum[0] = 2 * l0Partitions;
+    for(auto &levelPair : levelFileNum){
+        if(levelPair.first > 0){
+            levelPair.second = compactionFanout * levelFileNum[levelPair.first - 1];
+        }
+    }
+    rebalance_filters();
+}
+
+std::string SSTable::table_path(uint32_t level, uint64_t number)
+{
+    return dir_path + "/level-" + std::to_string(level) + "/" + std::to_string(number) + ".sst";
+}
+
+// 文件编号即文件名去掉扩展名
+void SSTable::prepare_table(uint32_t level, const std::string &path, CacheTable &cacheTable, VersionEdit &edit)
+{
+    std::string::size_type slash = path.find_last_of('/');
+    cacheTable.fileNumber = std::stoull(path.substr(slash + 1));
+    if(syncWrites){
+        sync_path(path);
+        sync_path(path.substr(0, slash));
+    }
+    build_index(cacheTable, path, level);
+    edit.added.emplace_back(level, file_meta(cacheTable));
+}
+
+uint64_t SSTable::new_file_number()
+{
+    std::lock_guard<std::mutex> lock(manifestMutex);
+    return manifest.new_file_number();
+}
+
+bool SSTable::log_edit(VersionEdit &edit)
+{
+    std::lock_guard<std::mutex> lock(manifestMutex);
+    return manifest.log_and_apply(edit);
+}
+
+uint64_t SSTable::table_keys() const
+{
+    return (tableFormat == TABLE_FORMAT_V1) ? MAX_KEY_NUMBER : tableKeyNumber;
 }
 
 // 将硬盘中的内容放入到缓存中
 // 即对缓存的初始化
-void SSTable::diskToCache()
+// 存在MANIFEST时按回放得到的版本打开文件，不扫描目录；日志中有而硬盘上没有的文件从版本中删除
+// 没有MANIFEST时为旧的数据目录：扫描各层目录，将文件按新分配的编号重命名后写入新的日志，只在迁移时发生一次，逐个打开
+void SSTable::diskToCache(const OpenOptions &options)
 {
     // 这个函数并不会被reset调用，因此还承担找到最新时间戳的职责
     uint64_t getTimeStamp = 0;
-    for(int i = 0; ; i++){
-        // 查找各层目录
-        std::string levelPath = dir_path + "/level-" + std::to_string(i);
-        if(utils::dirExists(levelPath)){
+    uint32_t levelNumber = 0; // 存在文件的最深层加一
+    if(!utils::dirExists(dir_path)){
+        utils::mkdir(dir_path);
+    }
+    std::string manifestPath = dir_path + "/" + MANIFEST_NAME;
+    if(options.lazyLoading){
+        lazyLoading = true;
+        blockCache.set_capacity(options.blockCacheBytes);
+    }
+    auto open_table = [&](uint32_t level, const std::string &path, uint64_t number){
+        CacheTable cacheTable;
+        if(!read_table(path, cacheTable, !lazyLoading)){
+            return false;
+        }
+        cacheTable.fileNumber = number;
+        build_index(cacheTable, path, level);
+        if(cacheTable.timeStamp > getTimeStamp){
+            getTimeStamp = cacheTable.timeStamp;
+        }
+        // 放入到缓存中
+        cacheMap[level][path] = cacheTable;
+        levelNumber = std::max(levelNumber, level + 1);
+        return true;
+    };
+
+    if(manifest.recover(manifestPath)){
+        for(auto &levelPair : manifest.version()){
+            levelNumber = std::max(levelNumber, levelPair.first + 1);
+        }
+        // 时间戳与键的最值来自MANIFEST，占位项放入后即可按层次与时间戳查找
+        uint32_t waitLevels = (options.threads == 0 || levelNumber <= options.asyncLevels) ? levelNumber : levelNumber - options.asyncLevels;
+        waitLevels = std::max<uint32_t>(waitLevels, 1);
+        std::vector<std::shared_ptr<PendingTable>> loads; // 由浅到深
+        uint64_t waiting = 0; // loads中需要等待的前若干项
+        for(auto &levelPair : manifest.version()){
+            for(auto &filePair : levelPair.second){
+                const FileMeta &meta = filePair.second;
+                std::string path = table_path(levelPair.first, meta.number);
+                CacheTable &cacheTable = cacheMap[levelPair.first][path];
+                cacheTable.timeStamp = meta.timeStamp;
+                cacheTable.KVNumber = meta.KVNumber;
+                cacheTable.minKey = meta.minKey;
+                cacheTable.maxKey = meta.maxKey;
+                cacheTable.fileNumber = meta.number;
+                cacheTable.fileSize = meta.fileSize;
+                cacheTable.pending = std::make_shared<PendingTable>();
+                cacheTable.pending->target = &cacheTable;
+                cacheTable.pending->path = path;
+                cacheTable.pending->level = levelPair.first;
+                loads.push_back(cacheTable.pending);
+                if(levelPair.first < waitLevels) waiting++;
+                getTimeStamp = std::max(getTimeStamp, meta.timeStamp);
+            }
+        }
+        remove_obsolete_files();
+        opening = !loads.empty();
+        if(options.threads > 0 && loads.size() > 1){
+            openPool = std::make_unique<ThreadPool>(std::min<uint64_t>(options.threads, loads.size()));
+            for(auto &pending : loads){
+                openPool->submit([this, pending]{ open_pending(*pending); });
+            }
+        }
+        if(!openPool){
+            waiting = loads.size();
+        }
+        // 调用线程也参与加载：需要等待的文件中尚未开始的直接在这里打开
+        for(uint64_t i = 0; i < waiting; i++){
+            open_pending(*loads[i]);
+        }
+        if(waiting == loads.size()){
+            finish_open();
+        }
+    } else {
+        // 先找出所有文件，新编号大于已有的数字文件名，重命名时不会覆盖尚未处理的文件
+        std::vector<std::vector<std::string>> levelFiles;
+        for(uint32_t i = 0; ; i++){
+            // 查找各层目录
+            std::string levelPath = dir_path + "/level-" + std::to_string(i);
+            if(!utils::dirExists(levelPath)){
+                // 不存在该目录，停止缓存
+                break;
+            }
             // 存在，遍历当前层下的文件
-            std::vector<std::string> filePath;
-            int fileNum = utils::scanDir(levelPath,filePath);
-            for(;fileNum > 0; fileNum--){
-                // 一次性读取完文件
-                std::fstream file;
-                file.open(levelPath + "/" + filePath[fileNum - 1], std::fstream::in | std::fstream::binary);
-                file.seekg(0,std::ios::end);
-                uint64_t fileSize = file.tellg();
-                file.seekg(0, std::ios::beg);
-                char *bytes = new char[fileSize];
-                char *init = bytes;
-                file.read(bytes, fileSize);
-                file.close();
-                // 进行初始化
-                CacheTable cacheTable;
-                cacheTable.timeStamp = byte_to_uint64(&bytes);
-                if(cacheTable.timeStamp > getTimeStamp){
-                    getTimeStamp = cacheTable.timeStamp;
+            levelFiles.emplace_back();
+            utils::scanDir(levelPath, levelFiles.back());
+            for(auto &name : levelFiles.back()){
+                std::string::size_type digits = name.find_first_not_of("0123456789");
+                if(digits > 0 && digits != std::string::npos && name.substr(digits) == ".sst"){
+                    manifest.mark_file_number(std::stoull(name.substr(0, digits)));
                 }
-                cacheTable.KVNumber = byte_to_uint64(&bytes);
-                cacheTable.minKey = byte_to_uint64(&bytes);
-                cacheTable.maxKey = byte_to_uint64(&bytes);
-                cacheTable.bloomFilter.byte_to_bloom(&bytes);
-                for(uint64_t j = 0; j < cacheTable.KVNumber; j++){
-                    cacheTable.keyList.push_back(byte_to_uint64(&bytes));
-                    cacheTable.offsetList.push_back(byte_to_uint64(&bytes));
-                    cacheTable.vlenList.push_back(byte_to_uint32(&bytes));
+            }
+        }
+        VersionEdit snapshot;
+        for(uint32_t i = 0; i < levelFiles.size(); i++){
+            std::string levelPath = dir_path + "/level-" + std::to_string(i);
+            for(auto &name : levelFiles[i]){
+                uint64_t number = manifest.new_file_number();
+                std::string path = table_path(i, number);
+                std::rename((levelPath + "/" + name).c_str(), path.c_str());
+                if(open_table(i, path, number)){
+                    snapshot.added.emplace_back(i, file_meta(cacheMap[i][path]));
                 }
-                // 放入到缓存中
-                cacheMap[i][filePath[fileNum - 1]] = cacheTable;
-                delete [] init;
             }
-            if(i > 0) levelFileNum[i] = 2 * levelFileNum[i - 1]; 
+            levelNumber = std::max(levelNumber, i + 1);
         }
-        else{
-            // 不存在该目录，停止缓存
+        manifest.create(manifestPath, snapshot);
+    }
+    for(uint32_t i = 1; i < levelNumber; i++){
+        levelFileNum[i] = compactionFanout * levelFileNum[i - 1];
+    }
+    currentTimeStamp = getTimeStamp + 1;
+    rebalance_filters();
+}
+
+void SSTable::remove_obsolete_files()
+{
+    const auto &version = manifest.version();
+    for(uint32_t i = 0; ; i++){
+        std::string levelPath = dir_path + "/level-" + std::to_string(i);
+        if(!utils::dirExists(levelPath)){
             break;
         }
+        auto levelIt = version.find(i);
+        std::vector<std::string> fileList;
+        utils::scanDir(levelPath, fileList);
+        for(auto &name : fileList){
+            std::string::size_type digits = name.find_first_not_of("0123456789");
+            if(digits == 0 || digits == std::string::npos || name.substr(digits) != ".sst"){
+                continue;
+            }
+            uint64_t number = std::stoull(name.substr(0, digits));
+            if(levelIt == version.end() || levelIt->second.find(number) == levelIt->second.end()){
+                utils::rmfile(levelPath + "/" + name);
+            }
+        }
     }
-    currentTimeStamp = getTimeStamp + 1;
-}
\ No newline at end of file
+}
+
+void SSTable::open_pending(PendingTable &pending)
+{
+    std::call_once(pending.once, [this, &pending]{ load_pending(pending); });
+}
+
+// 加载完成前其他线程不会访问占位项中除元信息以外的成员，call_once保证加载的结果对之后的访问可见
+void SSTable::load_pending(PendingTable &pending)
+{
+    CacheTable cacheTable;
+    if(read_table(pending.path, cacheTable, !lazyLoading)){
+        build_index(cacheTable, pending.path, pending.level);
+    } else {
+        // 文件丢失时视为空表，在打开结束前不会查到任何键
+        pending.missing = true;
+        cacheTable.KVNumber = 0;
+        cacheTable.filter = std::make_shared<NoFilter>();
+    }
+    pending.target->move_body(cacheTable);
+}
+
+void SSTable::wait_loaded(const CacheTable &cacheTable)
+{
+    if(cacheTable.pending){
+        open_pending(*cacheTable.pending);
+    }
+}
+
+void SSTable::finish_open()
+{
+    std::lock_guard<std::mutex> openLock(openMutex);
+    if(!opening){
+        return;
+    }
+    for(auto &levelDir : cacheMap){
+        for(auto &cachePair : levelDir.second){
+            wait_loaded(cachePair.second);
+        }
+    }
+    openPool.reset();
+    VersionEdit missing;
+    std::unique_lock<std::shared_mutex> lock(versionMutex);
+    for(auto &levelDir : cacheMap){
+        for(auto it = levelDir.second.begin(); it != levelDir.second.end();){
+            if(it->second.pending && it->second.pending->missing){
+                missing.removed.emplace_back(levelDir.first, it->second.fileNumber);
+                it = levelDir.second.erase(it);
+                tableVersion++;
+                continue;
+            }
+            it->second.pending.reset();
+            it++;
+        }
+    }
+    lock.unlock();
+    if(!missing.empty()){
+        log_edit(missing); // 失败时下次打开重新检查
+    }
+    opening = false;
+}
+
+// 为缓存生成过滤器，类型由所在层的策略决定，大小由键数与每键位数决定
+void SSTable::build_filter(CacheTable &cacheTable, uint32_t level)
+{
+    uint32_t bits = bitsPerKey;
+    {
+        // 后台合并新建一层时会重新分配各层的位数
+        std::shared_lock<std::shared_mutex> lock(versionMutex);
+        auto bitsIt = levelBitsPerKey.find(level);
+        if(monkeyAllocation){
+            bits = (bitsIt != levelBitsPerKey.end()) ? (uint32_t)std::lround(bitsIt->second) : 0; // 不分配过滤器的层
+        }
+    }
+    cacheTable.filter = Filter::create(policy_of(level), cacheTable.keyList, bits);
+    if(rangeFilterEnabled){
+        cacheTable.rangeFilter = std::make_shared<RangeFilter>(cacheTable.keyList, rangeFilterBits, bitsPerKey);
+    }
+}
+
+// 构建内存索引
+// Eytzinger布局另存一份键，有序键数组保留给扫描与合并使用
+// 学习索引代替键数组：键为连续整数时由线段还原，否则只保存位压缩的残差
+// 启用压缩时三个数组都换成位压缩数组，查找只解码所需的块
+// 按需加载时只保留每块的首键与位置，level-0的块读入后以高优先级缓存
+// v4格式的文件刚写入时也重新映射，此后与读入的文件一样直接在映射上二分查找
+void SSTable::build_index(CacheTable &cacheTable, const std::string &path, uint32_t level)
+{
+    if(cacheTable.format == TABLE_FORMAT_V4){
+        if(!cacheTable.mapping){
+            std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>(path);
+            if(file->valid()){
+                map_table_v4(file, cacheTable);
+            }
+        }
+        if(cacheTable.mapping){
+            cacheTable.path = path;
+            return;
+        }
+    }
+    if(lazyLoading){
+        cacheTable.path = path;
+        cacheTable.tableId = nextTableId++;
+        cacheTable.lazyLoaded = true;
+        std::vector<uint64_t>().swap(cacheTable.keyList);
+        std::vector<uint64_t>().swap(cacheTable.offsetList);
+        std::vector<uint32_t>().swap(cacheTable.vlenList);
+        return;
+    }
+    std::vector<uint64_t>().swap(cacheTable.fenceKeys);
+    std::vector<uint64_t>().swap(cacheTable.blockOffsets);
+    if(packedMetadata){
+        cacheTable.packedKeys = std::make_shared<PackedArray>(cacheTable.keyList);
+        cacheTable.packedOffsets = std::make_shared<PackedArray>(cacheTable.offsetList);
+        cacheTable.packedVlens = std::make_shared<PackedArray>(cacheTable.vlenList);
+        std::vector<uint64_t>().swap(cacheTable.keyList);
+        std::vector<uint64_t>().swap(cacheTable.offsetList);
+        std::vector<uint32_t>().swap(cacheTable.vlenList);
+        return;
+    }
+    if(indexType == INDEX_EYTZINGER){
+        cacheTable.eytzingerIndex = std::make_shared<EytzingerIndex>(cacheTable.keyList);
+    }
+    if(indexType == INDEX_LEARNED){
+        cacheTable.learnedIndex = std::make_shared<LearnedIndex>(cacheTable.keyList);
+        std::vector<uint64_t>().swap(cacheTable.keyList); // 键由线段或残差给出
+    }
+}
+
+std::shared_ptr<const CellBlock> SSTable::load_block(const CacheTable &cacheTable, uint64_t blockIndex, uint32_t level)
+{
+    std::shared_ptr<const CellBlock> block = blockCache.lookup(cacheTable.tableId, blockIndex);
+    if(!block){
+        block = read_block(cacheTable, blockIndex);
+        blockCache.insert(cacheTable.tableId, blockIndex, block, level == 0);
+    }
+    return block;
+}
+
+// 合并时顺序读取整个文件，不经过块缓存，原有的块也随之失效
+void SSTable::materialize(CacheTable &cacheTable)
+{
+    if(!cacheTable.lazy()){
+        return;
+    }
+    for(uint64_t blockIndex = 0; blockIndex < cacheTable.fenceKeys.size(); blockIndex++){
+        for(BlockIterator it(read_block(cacheTable, blockIndex)); it.valid(); it.next()){
+            cacheTable.keyList.push_back(it.key());
+            cacheTable.offsetList.push_back(it.offset());
+            cacheTable.vlenList.push_back(it.vlen());
+        }
+    }
+    blockCache.erase(cacheTable.tableId, cacheTable.fenceKeys.size());
+    std::vector<uint64_t>().swap(cacheTable.fenceKeys);
+    std::vector<uint64_t>().swap(cacheTable.blockOffsets);
+    cacheTable.lazyLoaded = false;
+}
+
+CompressionOptions SSTable::compression_of(uint32_t level)
+{
+    if(blockCompression.find(level) != blockCompression.end()){
+        return blockCompression[level];
+    }
+    return CompressionOptions();
+}
+
+FilterPolicy SSTable::policy_of(uint32_t level)
+{
+    if(filterPolicy.find(level) != filterPolicy.end()){
+        return filterPolicy[level];
+    }
+    return defaultFilterPolicy;
+}
+
+/*
+ * 按层分配过滤器内存
+ * 一次不存在的键的查询，在每层的每个有序段上各有p_i的概率误报，level-0每个文件都是一个有序段
+ * 在总位数M = sum(N_i * -ln(p_i) / ln2^2)的约束下最小化sum(r_i * p_i)，得p_i与N_i / r_i成正比
+ * p_i不小于1的层不分配过滤器，剩余的层重新求解比例系数
+ * N_i取各层的容量而非当前键数，保证分配结果随层的增长稳定变化
+ */
+void SSTable::rebalance_filters()
+{
+    const double ln2Square = std::log(2) * std::log(2);
+    std::map<uint32_t, double> keys; // N_i
+    std::map<uint32_t, double> runs; // r_i
+    double totalKeys = 0;
+    for(auto &levelPair : levelFileNum){
+        keys[levelPair.first] = (double)levelPair.second * ((levelPair.first == 0) ? MAX_KEY_NUMBER : table_keys());
+        runs[levelPair.first] = (levelPair.first == 0) ? (double)(levelPair.second + 1) : 1;
+        totalKeys += keys[levelPair.first];
+        filterStats[levelPair.first]; // 读操作只查找已有的统计项，新的层在这里创建
+    }
+    double budgetBits = (filterMemoryBudget > 0) ? (double)filterMemoryBudget * 8 : totalKeys * bitsPerKey;
+
+    levelBitsPerKey.clear();
+    levelProjectedRate.clear();
+    std::map<uint32_t, double> active = keys; // 仍然分配过滤器的层
+    while(!active.empty()){
+        // ln(lambda) = (sum(N_i * ln(r_i / N_i)) - M * ln2^2) / sum(N_i)
+        double sumKeys = 0;
+        double sumLog = 0;
+        for(auto &levelPair : active){
+            sumKeys += levelPair.second;
+            sumLog += levelPair.second * std::log(runs[levelPair.first] / levelPair.second);
+        }
+        double logLambda = (sumLog - budgetBits * ln2Square) / sumKeys;
+        bool removed = false;
+        for(auto it = active.begin(); it != active.end();){
+            double logRate = logLambda + std::log(it->second / runs[it->first]);
+            if(logRate >= 0){
+                it = active.erase(it);
+                removed = true;
+            } else {
+                it++;
+            }
+        }
+        if(removed) continue;
+        for(auto &levelPair : active){
+            double logRate = logLambda + std::log(levelPair.second / runs[levelPair.first]);
+            levelBitsPerKey[levelPair.first] = std::min<double>(-logRate / ln2Square, MAX_FILTER_BITS_PER_KEY);
+        }
+        break;
+    }
+    for(auto &levelPair : keys){
+        uint32_t level = levelPair.first;
+        double bits = monkeyAllocation ? levelBitsPerKey[level] : bitsPerKey;
+        levelProjectedRate[level] = Filter::projected_rate(policy_of(level), (uint32_t)std::lround(bits));
+    }
+}
+
+// 输出各层过滤器的分配与统计
+void SSTable::filter_report(std::ostream &os)
+{
+    std::unique_lock<std::shared_mutex> lock(versionMutex);
+    for(auto &levelPair : levelFileNum){
+        uint32_t level = levelPair.first;
+        FilterStats &stats = filterStats[level];
+        uint64_t negatives = stats.queries - stats.hits;
+        os << "Level " << level
+            << ": bits per key " << (monkeyAllocation ? levelBitsPerKey[level] : bitsPerKey)
+            << ", projected rate " << levelProjectedRate[level]
+            << ", queries " << stats.queries
+            << ", false positives " << stats.falsePositives
+            << ", observed rate " << (negatives > 0 ? (double)stats.falsePositives / negatives : 0)
+            << std::endl;
+    }
+}
+
+/*
+ * 将缓存的SSTable写入硬盘
+ * v1格式为：32字节头部、过滤器段、可选的范围过滤器段、每个20字节的元组
+ * 过滤器段以类型标记开头，因此不同策略的文件可以共存
+ */
+bool SSTable::write_table(const std::string &path, CacheTable &cacheTable, uint32_t format,
+    const CompressionOptions &compression, RateLimiter *limiter, IOPriority priority)
+{
+    if(format == TABLE_FORMAT_V4){
+        return write_table_v4(path, cacheTable, limiter, priority);
+    }
+    if(format != TABLE_FORMAT_V1){
+        return write_table_v2(path, cacheTable, compression, limiter, priority);
+    }
+    uint64_t length = HEAD_LENGTH + cacheTable.filter->byteSize() + CELL_LENGTH * cacheTable.KVNumber;
+    if(cacheTable.rangeFilter){
+        length += cacheTable.rangeFilter->byteSize();
+    }
+    char * bytes = new char[length];
+    char * init = bytes;
+    uint64_to_byte(cacheTable.timeStamp, &bytes);
+    uint64_to_byte(cacheTable.KVNumber, &bytes);
+    uint64_to_byte(cacheTable.minKey, &bytes);
+    uint64_to_byte(cacheTable.maxKey, &bytes);
+    cacheTable.filter->filter_to_byte(&bytes);
+    if(cacheTable.rangeFilter){
+        cacheTable.rangeFilter->filter_to_byte(&bytes);
+    }
+    uint64_t cellStart = bytes - init;
+    for(uint64_t i = 0; i < cacheTable.KVNumber; i++){
+        uint64_to_byte(cacheTable.key(i), &bytes);
+        uint64_to_byte(cacheTable.offset(i), &bytes);
+        uint32_to_byte(cacheTable.vlen(i), &bytes);
+    }
+    v1_block_index(cacheTable, init, cellStart);
+
+    bool written = write_file(path, init, length, false, limiter, priority);
+    cacheTable.fileSize = length;
+    delete [] init;
+    return written;
+}
+
+/*
+ * 从硬盘读取SSTable
+ * 文件先整体映射到内存，末尾为TABLE_MAGIC时按尾部的格式版本区分v2至v4，否则为v1格式
+ * v4格式保留映射并原地使用，其余格式解码到缓存后即解除映射
+ * 旧格式的过滤器段为2048个值为0或1的uint32，读到后丢弃并根据键重新生成
+ * 过滤器段之后剩余的字节多于元组时，说明存在范围过滤器段
+ */
+bool SSTable::read_table(const std::string &path, CacheTable &cacheTable, bool cells)
+{
+    std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>(path);
+    if(!file->valid()){
+        return false;
+    }
+    uint64_t fileSize = file->size();
+    cacheTable.fileSize = fileSize;
+    char *init = const_cast<char *>(file->data()); // 只读取，不写入映射
+    char *bytes = init;
+
+    if(fileSize >= TABLE_FOOTER_LENGTH){
+        char *magic = init + fileSize - sizeof(uint32_t);
+        if(byte_to_uint32(&magic) == TABLE_MAGIC){
+            char *format = init + fileSize - 2 * sizeof(uint32_t);
+            if(byte_to_uint32(&format) == TABLE_FORMAT_V4){
+                map_table_v4(file, cacheTable);
+            } else {
+                read_table_v2(init, fileSize, cacheTable, cells);
+            }
+            return true;
+        }
+    }
+
+    cacheTable.format = TABLE_FORMAT_V1;
+    cacheTable.timeStamp = byte_to_uint64(&bytes);
+    cacheTable.KVNumber = byte_to_uint64(&bytes);
+    cacheTable.minKey = byte_to_uint64(&bytes);
+    cacheTable.maxKey = byte_to_uint64(&bytes);
+    uint32_t filterType = byte_to_uint32(&bytes);
+    bool legacy = (filterType & FILTER_MAGIC_MASK) != FILTER_MAGIC;
+    if(legacy){
+        bytes += (HASH_LENGTH - 1) * sizeof(uint32_t);
+    } else {
+        cacheTable.filter = Filter::load(filterType, &bytes);
+        if((uint64_t)(init + fileSize - bytes) > CELL_LENGTH * cacheTable.KVNumber){
+            byte_to_uint32(&bytes); // 范围过滤器的类型标记
+            cacheTable.rangeFilter = std::make_shared<RangeFilter>();
+            if(!cacheTable.rangeFilter->byte_to_filter(&bytes)){
+                cacheTable.rangeFilter.reset(); // 损坏的范围过滤器不能用来跳过文件
+            }
+        }
+    }
+    uint64_t cellStart = bytes - init;
+    v1_block_index(cacheTable, init, cellStart);
+    if(!cells && !legacy){
+        return true;
+    }
+    for(uint64_t j = 0; j < cacheTable.KVNumber; j++){
+        cacheTable.keyList.push_back(byte_to_uint64(&bytes));
+        cacheTable.offsetList.push_back(byte_to_uint64(&bytes));
+        cacheTable.vlenList.push_back(byte_to_uint32(&bytes));
+    }
+
+    if(legacy){
+        cacheTable.filter = Filter::create(FILTER_POLICY_BLOOM, cacheTable.keyList, BLOOM_BITS_PER_KEY);
+    }
+    return true;
+}
+
+// 输出缓存占用的内存，元数据与过滤器分开统计
+void SSTable::memory_report(std::ostream &os)
+{
+    finish_open();
+    std::shared_lock<std::shared_mutex> lock(versionMutex);
+    uint64_t keys = 0;
+    uint64_t metadata = 0;
+    uint64_t filters = 0;
+    uint64_t mapped = 0;
+    for(auto &levelDir : cacheMap){
+        for(auto &cachePair : levelDir.second){
+            keys += cachePair.second.KVNumber;
+            metadata += cachePair.second.metadataBytes();
+            if(cachePair.second.mapping){
+                mapped += cachePair.second.mapping->size();
+            } else {
+                filters += cachePair.second.filter->byteSize();
+            }
+            if(cachePair.second.rangeFilter) filters += cachePair.second.rangeFilter->byteSize();
+        }
+    }
+    os << "Keys " << keys
+        << ", metadata bytes " << metadata
+        << " (" << (keys > 0 ? (double)metadata / keys : 0) << " per key)"
+        << ", filter bytes " << filters
+        << " (" << (keys > 0 ? (double)filters / keys : 0) << " per key)"
+        << std::endl;
+    if(mapped > 0){
+        os << "Mapped bytes " << mapped << ", resident pages are managed by the page cache" << std::endl;
+    }
+    if(lazyLoading){
+        BlockCacheStats stats = blockCache.stats();
+        os << "Block cache bytes " << blockCache.usage() << "/" << blockCache.getCapacity()
+            << ", hits " << stats.hits
+            << ", misses " << stats.misses
+            << ", evictions " << stats.evictions
+            << std::endl;
+    }
+}
+
+// 一层中键区间重叠的文件数的最大值，即点查询在该层最多查找的文件数；区间是闭区间，同一位置先计开始再计结束
+static uint64_t overlap_depth(const std::map<std::string, CacheTable> &cacheList)
+{
+    std::vector<std::pair<uint64_t, int>> events;
+    for(auto &cachePair : cacheList){
+        events.emplace_back(cachePair.second.minKey, -1);
+        events.emplace_back(cachePair.second.maxKey, 1);
+    }
+    std::sort(events.begin(), events.end());
+    uint64_t depth = 0;
+    uint64_t maxDepth = 0;
+    for(auto &event : events){
+        if(event.second < 0){
+            maxDepth = std::max(maxDepth, ++depth);
+        } else {
+            depth--;
+        }
+    }
+    return maxDepth;
+}
+
+// 一个守卫区间中最多的文件数，文件按最小键归入区间
+static uint64_t guard_fragments(const std::set<uint64_t> &guards, const std::map<std::string, CacheTable> &cacheList)
+{
+    std::map<uint64_t, uint64_t> fragments;
+    uint64_t most = 0;
+    for(auto &cachePair : cacheList){
+        auto guardIt = guards.upper_bound(cachePair.second.minKey);
+        uint64_t guard = (guardIt == guards.begin()) ? 0 : *std::prev(guardIt);
+        most = std::max(most, ++fragments[guard]);
+    }
+    return most;
+}
+
+/*
+ * 读放大以有序段数衡量，即各层重叠深度之和，不计过滤器
+ * 空间放大为SSTable的总字节数与最深层字节数之比，最深层之外的字节都可能是被覆盖的旧版本
+ */
+void SSTable::compaction_report(std::ostream &os)
+{
+    static const char *styleNames[] = {"leveled", "tiered", "lazy leveling", "guarded"};
+    static const char *priorityNames[] = {"oldest", "min overlap", "round robin"};
+    {
+        std::shared_lock<std::shared_mutex> lock(versionMutex);
+        uint64_t sortedRuns = 0;
+        uint64_t totalBytes = 0;
+        uint64_t deepestBytes = 0;
+        for(auto &levelPair : levelFileNum){
+            auto levelIt = cacheMap.find(levelPair.first);
+            uint64_t files = 0;
+            uint64_t bytes = 0;
+            uint64_t runs = 0;
+            if(levelIt != cacheMap.end()){
+                files = levelIt->second.size();
+                for(auto &cachePair : levelIt->second){
+                    bytes += cachePair.second.fileSize;
+                }
+                runs = overlap_depth(levelIt->second);
+            }
+            sortedRuns += runs;
+            totalBytes += bytes;
+            if(bytes > 0){
+                deepestBytes = bytes;
+            }
+            os << "Level " << levelPair.first
+                << ": files " << files << "/" << levelPair.second
+                << ", bytes " << bytes
+                << ", sorted runs " << runs
+                << ", score " << picker->score(*this, levelPair.first);
+            auto statsIt = pickStats.find(levelPair.first);
+            if(statsIt != pickStats.end() && levelPair.first > 0){
+                const PickStats &stats = statsIt->second;
+                os << ", picks " << stats.picks
+                    << ", overlap ratio " << (stats.inputBytes > 0 ? (double)stats.overlapBytes / stats.inputBytes : 0)
+                    << ", fallbacks " << stats.fallbacks
+                    << ", cursor " << (compactCursor.count(levelPair.first) ? compactCursor.at(levelPair.first) : 0);
+            }
+            if(compactionStyle == COMPACTION_GUARDED && levelPair.first > 0){
+                os << ", guards " << level_guards(levelPair.first).size()
+                    << ", max fragments per guard " << ((levelIt != cacheMap.end()) ? guard_fragments(level_guards(levelPair.first), levelIt->second) : 0);
+            }
+            os << std::endl;
+        }
+        os << "Compaction style " << styleNames[compactionStyle]
+            << ", fanout " << compactionFanout
+            << (dynamicLevelBytes ? ", dynamic level bytes" : "")
+            << ", priority " << priorityNames[compactionPriority]
+            << ", sorted runs " << sortedRuns
+            << ", space amplification " << (deepestBytes > 0 ? (double)totalBytes / deepestBytes : 0)
+            << std::endl;
+        if(l0Partitions > 1){
+            std::vector<uint64_t> files(l0Bounds.size() + 1, 0);
+            auto levelIt = cacheMap.find(0);
+            if(levelIt != cacheMap.end()){
+                for(auto &cachePair : levelIt->second){
+                    files[partition_of(cachePair.second.minKey)]++;
+                }
+            }
+            os << "Level-0 partitions " << l0Partitions << ", files per partition";
+            for(uint64_t count : files){
+                os << " " << count;
+            }
+            os << ", flushing " << flushingStamps.size() << std::endl;
+        }
+    }
+    os << "Write slowdowns " << stallStats.slowdowns
+        << ", stops " << stallStats.stops
+        << ", stalled " << stallStats.stallMicros << " us"
+        << ", flush waits " << stallStats.flushWaits << " (" << stallStats.flushWaitMicros << " us)"
+        << ", dropped writes " << stallStats.droppedWrites
+        << ", subcompactions " << subcompactions
+        << std::endl;
+    uint64_t flushBytes = writeAmpStats.flushBytes;
+    uint64_t compactionBytes = writeAmpStats.compactionBytes;
+    os << "Flush bytes " << flushBytes
+        << ", compaction bytes " << compactionBytes
+        << ", moved files " << writeAmpStats.movedFiles << " (" << writeAmpStats.movedBytes << " bytes)"
+        << ", write amplification " << (flushBytes > 0 ? (double)(flushBytes + compactionBytes) / flushBytes : 0)
+        << std::endl;
+    os << "Dropped versions " << garbageStats.droppedVersions
+        << ", dropped tombstones " << garbageStats.droppedTombstones
+        << ", estimated vLog garbage bytes " << garbageStats.garbageBytes
+        << std::endl;
+}
+
+// 读出第blockIndex块，只读取该块对应的字节
+// v3格式的块先读入复用的缓冲区，再解压
+std::shared_ptr<const CellBlock> SSTable::read_block(const CacheTable &cacheTable, uint64_t blockIndex)
+{
+    uint64_t begin = cacheTable.blockOffsets[blockIndex];
+    thread_local std::string buffer;
+    buffer.resize(cacheTable.blockOffsets[blockIndex + 1] - begin);
+    std::fstream file;
+    file.open(cacheTable.path, std::fstream::in | std::fstream::binary);
+    file.seekg(begin, std::ios::beg);
+    file.read(&buffer[0], buffer.size());
+    file.close();
+    std::string data;
+    if(cacheTable.format == TABLE_FORMAT_V3){
+        Compressor::decode(buffer.data(), buffer.size(), data);
+        return std::make_shared<const CellBlock>(std::move(data), TABLE_FORMAT_V2);
+    }
+    data = buffer;
+    return std::make_shared<const CellBlock>(std::move(data), cacheTable.format);
+}
+
+void SSTable::v1_block_index(CacheTable &cacheTable, const char *init, uint64_t cellStart)
+{
+    cacheTable.format = TABLE_FORMAT_V1;
+    cacheTable.fenceKeys.clear();
+    cacheTable.blockOffsets.clear();
+    for(uint64_t begin = 0; begin < cacheTable.KVNumber; begin += LAZY_BLOCK_CELLS){
+        char *cell = const_cast<char *>(init) + cellStart + begin * CELL_LENGTH; // 元组以键开头
+        cacheTable.fenceKeys.push_back(byte_to_uint64(&cell));
+        cacheTable.blockOffsets.push_back(cellStart + begin * CELL_LENGTH);
+    }
+    cacheTable.blockOffsets.push_back(cellStart + cacheTable.KVNumber * CELL_LENGTH);
+}
+
+/*
+ * v2格式为：数据块、过滤器段、可选的范围过滤器段、块索引、64字节的尾部
+ * 数据块约TABLE_BLOCK_BYTES字节，键与偏移量增量编码，块索引为每块的首键与起始位置
+ * 尾部依次为时间戳、键值对数、最小键、最大键、过滤器段位置、块索引位置、块数、格式版本与魔数
+ * 指定压缩时每个数据块经过压缩层编码，格式版本为v3
+ */
+bool SSTable::write_table_v2(const std::string &path, CacheTable &cacheTable, const CompressionOptions &compression,
+    RateLimiter *limiter, IOPriority priority)
+{
+    bool compressed = (compression.type != COMPRESSION_NONE);
+    cacheTable.format = compressed ? TABLE_FORMAT_V3 : TABLE_FORMAT_V2;
+    cacheTable.fenceKeys.clear();
+    cacheTable.blockOffsets.clear();
+    std::string content;
+    BlockBuilder builder;
+    for(uint64_t i = 0; i < cacheTable.KVNumber; i++){
+        if(builder.empty()){
+            cacheTable.fenceKeys.push_back(cacheTable.key(i));
+            cacheTable.blockOffsets.push_back(content.size());
+        }
+        builder.add(cacheTable.key(i), cacheTable.offset(i), cacheTable.vlen(i));
+        if(builder.sizeEstimate() >= TABLE_BLOCK_BYTES || i + 1 == cacheTable.KVNumber){
+            std::string block = builder.finish();
+            if(compressed){
+                Compressor::encode(compression, block.data(), block.size(), content);
+            } else {
+                content += block;
+            }
+        }
+    }
+    uint64_t filterOffset = content.size();
+    cacheTable.blockOffsets.push_back(filterOffset);
+    uint64_t blockNumber = cacheTable.fenceKeys.size();
+
+    uint64_t tailLength = cacheTable.filter->byteSize() + blockNumber * 2 * sizeof(uint64_t) + TABLE_FOOTER_LENGTH;
+    if(cacheTable.rangeFilter){
+        tailLength += cacheTable.rangeFilter->byteSize();
+    }
+    content.resize(filterOffset + tailLength);
+    char *bytes = &content[filterOffset];
+    cacheTable.filter->filter_to_byte(&bytes);
+    if(cacheTable.rangeFilter){
+        cacheTable.rangeFilter->filter_to_byte(&bytes);
+    }
+    uint64_t indexOffset = bytes - content.data();
+    for(uint64_t i = 0; i < blockNumber; i++){
+        uint64_to_byte(cacheTable.fenceKeys[i], &bytes);
+        uint64_to_byte(cacheTable.blockOffsets[i], &bytes);
+    }
+    uint64_to_byte(cacheTable.timeStamp, &bytes);
+    uint64_to_byte(cacheTable.KVNumber, &bytes);
+    uint64_to_byte(cacheTable.minKey, &bytes);
+    uint64_to_byte(cacheTable.maxKey, &bytes);
+    uint64_to_byte(filterOffset, &bytes);
+    uint64_to_byte(indexOffset, &bytes);
+    uint64_to_byte(blockNumber, &bytes);
+    uint32_to_byte(cacheTable.format, &bytes);
+    uint32_to_byte(TABLE_MAGIC, &bytes);
+
+    cacheTable.fileSize = content.size();
+    return write_file(path, content.data(), content.size(), false, limiter, priority);
+}
+
+void SSTable::read_table_v2(char *init, uint64_t fileSize, CacheTable &cacheTable, bool cells)
+{
+    char *bytes = init + fileSize - TABLE_FOOTER_LENGTH;
+    cacheTable.timeStamp = byte_to_uint64(&bytes);
+    cacheTable.KVNumber = byte_to_uint64(&bytes);
+    cacheTable.minKey = byte_to_uint64(&bytes);
+    cacheTable.maxKey = byte_to_uint64(&bytes);
+    uint64_t filterOffset = byte_to_uint64(&bytes);
+    uint64_t indexOffset = byte_to_uint64(&bytes);
+    uint64_t blockNumber = byte_to_uint64(&bytes);
+    cacheTable.format = byte_to_uint32(&bytes);
+
+    // 过滤器段之后、块索引之前还有字节时，说明存在范围过滤器段
+    bytes = init + filterOffset;
+    cacheTable.filter = Filter::load(byte_to_uint32(&bytes), &bytes);
+    if(bytes < init + indexOffset){
+        byte_to_uint32(&bytes); // 范围过滤器的类型标记
+        cacheTable.rangeFilter = std::make_shared<RangeFilter>();
+        if(!cacheTable.rangeFilter->byte_to_filter(&bytes)){
+            cacheTable.rangeFilter.reset(); // 损坏的范围过滤器不能用来跳过文件
+        }
+    }
+
+    bytes = init + indexOffset;
+    cacheTable.fenceKeys.clear();
+    cacheTable.blockOffsets.clear();
+    for(uint64_t i = 0; i < blockNumber; i++){
+        cacheTable.fenceKeys.push_back(byte_to_uint64(&bytes));
+        cacheTable.blockOffsets.push_back(byte_to_uint64(&bytes));
+    }
+    cacheTable.blockOffsets.push_back(filterOffset);
+    if(!cells){
+        return;
+    }
+
+    cacheTable.keyList.reserve(cacheTable.KVNumber);
+    cacheTable.offsetList.reserve(cacheTable.KVNumber);
+    cacheTable.vlenList.reserve(cacheTable.KVNumber);
+    for(uint64_t i = 0; i < blockNumber; i++){
+        char *block = init + cacheTable.blockOffsets[i];
+        uint64_t blockSize = cacheTable.blockOffsets[i + 1] - cacheTable.blockOffsets[i];
+        std::string data;
+        if(cacheTable.format == TABLE_FORMAT_V3){
+            Compressor::decode(block, blockSize, data);
+        } else {
+            data.assign(block, blockSize);
+        }
+        for(BlockIterator it(std::make_shared<const CellBlock>(std::move(data), TABLE_FORMAT_V2)); it.valid(); it.next()){
+            cacheTable.keyList.push_back(it.key());
+            cacheTable.offsetList.push_back(it.offset());
+            cacheTable.vlenList.push_back(it.vlen());
+        }
+    }
+}
+
+// 不小于offset且加上skew后按TABLE_SECTION_ALIGN对齐的最小位置
+static uint64_t align_section(uint64_t offset, uint64_t skew = 0)
+{
+    return (offset + skew + TABLE_SECTION_ALIGN - 1) / TABLE_SECTION_ALIGN * TABLE_SECTION_ALIGN - skew;
+}
+
+/*
+ * v4格式按列存放：键数组、偏移量数组、值长度数组、过滤器段、可选的范围过滤器段与64字节的尾部
+ * 三个数组都从TABLE_SECTION_ALIGN的倍数开始；过滤器段向前错开类型标记与块数，使布隆过滤器的块按缓存行对齐
+ * 尾部依次为时间戳、键值对数、最小键、最大键、偏移量数组、值长度数组与过滤器段的位置、格式版本与魔数
+ * 键数组总在文件开头，不需要记录位置；不支持数据块压缩
+ */
+bool SSTable::write_table_v4(const std::string &path, CacheTable &cacheTable, RateLimiter *limiter, IOPriority priority)
+{
+    cacheTable.format = TABLE_FORMAT_V4;
+    cacheTable.fenceKeys.clear();
+    cacheTable.blockOffsets.clear();
+    uint64_t number = cacheTable.KVNumber;
+    uint64_t offsetsAt = align_section(number * sizeof(uint64_t));
+    uint64_t vlensAt = align_section(offsetsAt + number * sizeof(uint64_t));
+    uint64_t filterAt = align_section(vlensAt + number * sizeof(uint32_t), 2 * sizeof(uint32_t));
+    uint64_t length = filterAt + cacheTable.filter->byteSize() + TABLE_FOOTER_LENGTH;
+    if(cacheTable.rangeFilter){
+        length += cacheTable.rangeFilter->byteSize();
+    }
+
+    std::string content(length, '\0');
+    char *keys = &content[0];
+    char *offsets = &content[offsetsAt];
+    char *vlens = &content[vlensAt];
+    for(uint64_t i = 0; i < number; i++){
+        uint64_to_byte(cacheTable.key(i), &keys);
+        uint64_to_byte(cacheTable.offset(i), &offsets);
+        uint32_to_byte(cacheTable.vlen(i), &vlens);
+    }
+    char *bytes = &content[filterAt];
+    cacheTable.filter->filter_to_byte(&bytes);
+    if(cacheTable.rangeFilter){
+        cacheTable.rangeFilter->filter_to_byte(&bytes);
+    }
+    uint64_to_byte(cacheTable.timeStamp, &bytes);
+    uint64_to_byte(number, &bytes);
+    uint64_to_byte(cacheTable.minKey, &bytes);
+    uint64_to_byte(cacheTable.maxKey, &bytes);
+    uint64_to_byte(offsetsAt, &bytes);
+    uint64_to_byte(vlensAt, &bytes);
+    uint64_to_byte(filterAt, &bytes);
+    uint32_to_byte(TABLE_FORMAT_V4, &bytes);
+    uint32_to_byte(TABLE_MAGIC, &bytes);
+
+    cacheTable.fileSize = content.size();
+    return write_file(path, content.data(), content.size(), false, limiter, priority);
+}
+
+// 缓存中原有的数组与过滤器随之释放，范围过滤器较小且不要求对齐，仍然复制
+void SSTable::map_table_v4(std::shared_ptr<MappedFile> file, CacheTable &cacheTable)
+{
+    char *init = const_cast<char *>(file->data()); // 只读取，不写入映射
+    char *bytes = init + file->size() - TABLE_FOOTER_LENGTH;
+    char *footer = bytes;
+    cacheTable.timeStamp = byte_to_uint64(&bytes);
+    cacheTable.KVNumber = byte_to_uint64(&bytes);
+    cacheTable.minKey = byte_to_uint64(&bytes);
+    cacheTable.maxKey = byte_to_uint64(&bytes);
+    uint64_t offsetsAt = byte_to_uint64(&bytes);
+    uint64_t vlensAt = byte_to_uint64(&bytes);
+    uint64_t filterAt = byte_to_uint64(&bytes);
+    cacheTable.format = byte_to_uint32(&bytes);
+
+    cacheTable.mapping = file;
+    cacheTable.mappedKeys = (const uint64_t *)init;
+    cacheTable.mappedOffsets = (const uint64_t *)(init + offsetsAt);
+    cacheTable.mappedVlens = (const uint32_t *)(init + vlensAt);
+
+    bytes = init + filterAt;
+    uint32_t filterType = byte_to_uint32(&bytes);
+    cacheTable.filter = Filter::map(filterType, bytes, file);
+    bytes = init + filterAt + cacheTable.filter->byteSize();
+    if(bytes < footer){
+        byte_to_uint32(&bytes); // 范围过滤器的类型标记
+        cacheTable.rangeFilter = std::make_shared<RangeFilter>();
+        if(!cacheTable.rangeFilter->byte_to_filter(&bytes)){
+            cacheTable.rangeFilter.reset(); // 损坏的范围过滤器不能用来跳过文件
+        }
+    }
+
+    std::vector<uint64_t>().swap(cacheTable.keyList);
+    std::vector<uint64_t>().swap(cacheTable.offsetList);
+    std::vector<uint32_t>().swap(cacheTable.vlenList);
+    std::vector<uint64_t>().swap(cacheTable.fenceKeys);
+    std::vector<uint64_t>().swap(cacheTable.blockOffsets);
+}
+
+// 输出扫描统计
+void SSTable::scan_report(std::ostream &os)
+{
+    os << "Scans " << scanStats.scans
+        << ", overlapped files " << scanStats.overlapped
+        << ", skipped by range filter " << scanStats.skipped
+        << ", last scan skipped " << scanStats.lastSkipped << "/" << scanStats.lastOverlapped
+        << std::endl;
+}
+
+void SSTable::seek_report(std::ostream &os)
+{
+    std::shared_lock<std::shared_mutex> lock(versionMutex);
+    os << "Seek compaction " << (seekCompaction ? "on" : "off")
+        << ", budget max(" << seekMinProbes << ", bytes / " << seekBytesPerProbe << ") probes"
+        << std::endl;
+    std::lock_guard<std::mutex> seekLock(seekMutex);
+    for(auto &levelPair : cacheMap){
+        const CacheTable *hottest = nullptr;
+        for(auto &cachePair : levelPair.second){
+            if(!hottest || cachePair.second.wastedProbes.load() > hottest->wastedProbes.load()){
+                hottest = &cachePair.second;
+            }
+        }
+        const SeekStats &stats = seekStats[levelPair.first];
+        os << "Level " << levelPair.first
+            << ": wasted probes " << stats.wastedProbes
+            << ", triggers " << stats.triggers
+            << ", seek compactions " << stats.compactions;
+        if(hottest){
+            os << ", hottest file " << hottest->fileNumber
+                << " (" << hottest->wastedProbes.load() << "/" << seek_budget(*hottest) << ")";
+        }
+        os << std::endl;
+    }
+    if(seekPending){
+        os << "Pending candidate: level " << seekLevel << ", file " << seekFile << std::endl;
+    }
+}
@@ -1,19 +1,118 @@
 #pragma once
 
-#include "bloomfilter.h"
+#include "filter.h"
+#include "rangefilter.h"
+#include "learnedindex.h"
+#include "eytzinger.h"
+#include "packedarray.h"
+#include "blockcache.h"
+#include "compressor.h"
+#include "mappedfile.h"
+#include "manifest.h"
+#include "threadpool.h"
+#include "ratelimiter.h"
+#include <shared_mutex>
+#include <set>
 #include "global.h"
 #include "vlog.h"
 
+// 缓存的SSTable在内存中查找键的方式
+enum IndexType{
+    INDEX_BINARY, // 在有序键数组上二分查找
+    INDEX_LEARNED, // 分段线性的学习索引预测位置后局部查找
+    INDEX_EYTZINGER // 按Eytzinger布局另存一份键，缓存友好的二分查找
+};
+
+// 合并策略，实现见CompactionPicker
+enum CompactionStyle{
+    COMPACTION_LEVELED, // 分层合并，每层只有一个有序段
+    COMPACTION_TIERED, // 分级合并，整层归并为下一层的一个新段
+    COMPACTION_LAZY_LEVELING, // 除最深层外分级，最深层分层
+    COMPACTION_GUARDED // 每层按守卫键分区，区间内的片段只追加不重写
+};
+
+// 分层合并从一层中选出部分文件时的优先顺序
+enum CompactionPriority{
+    COMPACTION_PRI_OLDEST, // 时间戳最小者优先
+    COMPACTION_PRI_MIN_OVERLAP, // 与下一层重叠的字节数相对自身字节数最小的一段连续文件优先，相同时按游标轮转
+    COMPACTION_PRI_ROUND_ROBIN // 从游标开始按键的顺序轮转
+};
+
+struct CacheTable;
+class CompactionPicker;
+
+// 打开时尚未加载的SSTable，由工作线程或第一次访问它的读操作加载，只加载一次
+struct PendingTable{
+    std::once_flag once;
+    CacheTable *target = nullptr; // cacheMap中的占位项，加载完成前只有MANIFEST中的元信息
+    std::string path;
+    uint32_t level = 0;
+    bool missing = false; // 文件不存在或为空，打开结束时从版本中删除
+};
+
 // 缓存的单个SSTable
 struct CacheTable{
     uint64_t timeStamp; // 时间戳
     uint64_t KVNumber; // 键值对数目
     uint64_t minKey; // 键最小值
     uint64_t maxKey; // 键最大值
-    BloomFilter bloomFilter; // 布隆过滤器
-    std::vector<uint64_t> keyList; // 存放元组的键
-    std::vector<uint64_t> offsetList; // 存放元组的偏移量
-    std::vector<uint32_t> vlenList; // 存放元组的值长度
+    std::shared_ptr<Filter> filter; // 过滤器，构建后只读，可在副本间共享
+    std::shared_ptr<RangeFilter> rangeFilter; // 范围过滤器，未启用时为空
+    std::vector<uint64_t> keyList; // 存放元组的键，使用学习索引或启用压缩时为空
+    std::vector<uint64_t> offsetList; // 存放元组的偏移量，启用压缩时为空
+    std::vector<uint32_t> vlenList; // 存放元组的值长度，启用压缩时为空
+    std::shared_ptr<PackedArray> packedKeys; // 压缩后的键、偏移量与值长度，未启用压缩时为空
+    std::shared_ptr<PackedArray> packedOffsets;
+    std::shared_ptr<PackedArray> packedVlens;
+    uint32_t format = TABLE_FORMAT_V1; // 文件格式
+    uint64_t fileNumber = 0; // MANIFEST中的文件编号
+    uint64_t fileSize = 0; // 文件的字节数
+    std::string path; // 按需加载时所在的文件
+    uint64_t tableId = 0; // 按需加载时在块缓存中的编号
+    bool lazyLoaded = false; // 元组不在内存中，需要按块读取
+    std::vector<uint64_t> fenceKeys; // 每块的首键，只在按需加载时保留
+    std::vector<uint64_t> blockOffsets; // 每块在文件中的起始位置，末尾多一项为最后一块的结束位置
+    std::shared_ptr<MappedFile> mapping; // v4格式的文件映射，以下三个数组直接指向其中
+    const uint64_t *mappedKeys = nullptr;
+    const uint64_t *mappedOffsets = nullptr;
+    const uint32_t *mappedVlens = nullptr;
+    std::shared_ptr<PendingTable> pending; // 打开时在后台加载，加载前只能访问时间戳、键的最值与文件编号
+    mutable std::atomic<uint64_t> wastedProbes{0}; // 点查询检查了该文件却没有从它得到结果的次数，读操作在共享锁下并发累加
+
+    bool lazy() const { return lazyLoaded; }
+    std::shared_ptr<LearnedIndex> learnedIndex; // 学习索引，未启用时为空
+    std::shared_ptr<EytzingerIndex> eytzingerIndex; // Eytzinger布局的索引，未启用时为空
+
+    // 第i个元组的键
+    uint64_t key(uint64_t i) const {
+        if(!keyList.empty()) return keyList[i];
+        if(mappedKeys) return mappedKeys[i];
+        return packedKeys ? packedKeys->get(i) : learnedIndex->key(i);
+    }
+
+    // 第i个元组的偏移量
+    uint64_t offset(uint64_t i) const {
+        if(mappedOffsets) return mappedOffsets[i];
+        return packedOffsets ? packedOffsets->get(i) : offsetList[i];
+    }
+
+    // 第i个元组的值长度
+    uint32_t vlen(uint64_t i) const {
+        if(mappedVlens) return mappedVlens[i];
+        return packedVlens ? (uint32_t)packedVlens->get(i) : vlenList[i];
+    }
+
+    // 键、偏移量、值长度与内存索引占用的字节数，不含过滤器与映射
+    uint64_t metadataBytes() const;
+
+    // 第一个不小于key的元组的位置，不存在时为KVNumber
+    uint64_t lower_bound(uint64_t key) const;
+
+    // 移入other读出的内容，时间戳、键的最值、文件编号与pending保持不变，加载期间读操作可以同时访问它们
+    void move_body(CacheTable &other);
+
+    CacheTable() = default;
+    CacheTable(const CacheTable &other) { *this = other; }
 
     // 自定义赋值运算符重载函数
     CacheTable& operator=(const CacheTable& other) {
@@ -22,14 +121,120 @@ struct CacheTable{
             KVNumber = other.KVNumber;
             minKey = other.minKey;
             maxKey = other.maxKey;
-            bloomFilter = other.bloomFilter;
+            filter = other.filter;
+            rangeFilter = other.rangeFilter;
             keyList = other.keyList;
             offsetList = other.offsetList;
             vlenList = other.vlenList;
+            packedKeys = other.packedKeys;
+            packedOffsets = other.packedOffsets;
+            packedVlens = other.packedVlens;
+            format = other.format;
+            fileNumber = other.fileNumber;
+            fileSize = other.fileSize;
+            path = other.path;
+            tableId = other.tableId;
+            lazyLoaded = other.lazyLoaded;
+            fenceKeys = other.fenceKeys;
+            blockOffsets = other.blockOffsets;
+            mapping = other.mapping;
+            mappedKeys = other.mappedKeys;
+            mappedOffsets = other.mappedOffsets;
+            mappedVlens = other.mappedVlens;
+            learnedIndex = other.learnedIndex;
+            eytzingerIndex = other.eytzingerIndex;
+            pending = other.pending;
+            wastedProbes = other.wastedProbes.load(std::memory_order_relaxed);
         return *this;
     }
 };
 
+// 每一层过滤器的查询统计
+struct FilterStats{
+    std::atomic<uint64_t> queries{0}; // 通过键范围检查、查询过滤器的次数
+    std::atomic<uint64_t> hits{0}; // 键确实存在于SSTable中的次数
+    std::atomic<uint64_t> falsePositives{0}; // 过滤器判断可能存在但实际不存在的次数
+};
+
+// 扫描的统计，用于观察范围过滤器跳过的文件数
+struct ScanStats{
+    uint64_t scans = 0; // 扫描次数
+    uint64_t overlapped = 0; // 键范围与扫描区间重叠的文件数
+    uint64_t skipped = 0; // 其中被范围过滤器跳过的文件数
+    uint64_t lastOverlapped = 0; // 最近一次扫描的对应值
+    uint64_t lastSkipped = 0;
+};
+
+// 一层中查找触发合并的统计，由seekMutex保护
+struct SeekStats{
+    uint64_t wastedProbes = 0; // 本层文件的无效探查次数
+    uint64_t triggers = 0; // 文件的无效探查达到预算、成为候选的次数
+    uint64_t compactions = 0; // 因此执行的合并次数
+};
+
+// 待执行的合并任务，score为该层文件数与容量之比，大于1时溢出；查找触发的合并为0，排在溢出的层之后
+struct CompactionJob{
+    double score;
+    uint32_t level;
+
+    bool operator<(const CompactionJob &other) const { return score < other.score; }
+};
+
+// 写入硬盘的字节数，用于计算写放大
+struct WriteAmpStats{
+    std::atomic<uint64_t> flushBytes{0}; // Memtable写入level-0的字节数
+    std::atomic<uint64_t> compactionBytes{0}; // 合并重写的字节数
+    std::atomic<uint64_t> movedFiles{0}; // 直接移到下一层、没有重写的文件数
+    std::atomic<uint64_t> movedBytes{0};
+
+    void clear() { flushBytes = compactionBytes = movedFiles = movedBytes = 0; }
+};
+
+// 合并丢弃的元组与由此不再被引用的vLog字节
+struct GarbageStats{
+    std::atomic<uint64_t> droppedVersions{0}; // 被更新的版本覆盖的旧版本
+    std::atomic<uint64_t> droppedTombstones{0}; // 最深层中不再需要的删除标记
+    std::atomic<uint64_t> garbageBytes{0}; // 估计的可回收字节数，合并发现时增加，GC回收时减少
+
+    void clear() { droppedVersions = droppedTombstones = garbageBytes = 0; }
+};
+
+// 一层被选出的合并输入，overlapBytes / inputBytes即每下移一个字节需要重写的下一层字节数
+struct PickStats{
+    uint64_t picks = 0; // 合并次数
+    uint64_t inputBytes = 0; // 来自本层的字节数
+    uint64_t overlapBytes = 0; // 一起重写的下一层的字节数
+    uint64_t fallbacks = 0; // 没有可选的候选、退回按时间戳选择的次数
+};
+
+/*
+ * 分段布局中一层的读索引，文件按最小键排序，并记录最大键的前缀最大值
+ * 片段都在守卫处切分，点查询从最小键不超过键的最后一个文件向前，前缀最大值小于键时停止，只访问键所在守卫区间的片段
+ */
+struct GuardIndex{
+    std::vector<uint64_t> minKeys;
+    std::vector<uint64_t> maxPrefix;
+    std::vector<const CacheTable *> tables;
+};
+
+// 写入因level-0文件过多而受到的限制
+struct WriteStallStats{
+    uint64_t slowdowns = 0; // 暂停的次数
+    uint64_t stops = 0; // 等待合并的次数
+    uint64_t stallMicros = 0; // 两者合计的微秒数
+    uint64_t flushWaits = 0; // 分区写满时等待该分区上一次刷写的次数
+    uint64_t flushWaitMicros = 0;
+    uint64_t droppedWrites = 0; // 刷写持续失败、写入被放弃的次数
+};
+
+// 打开数据目录的选项
+struct OpenOptions{
+    uint32_t threads = std::thread::hardware_concurrency(); // 读取文件、解码过滤器与构建索引的工作线程数，为0时在调用线程中逐个打开
+    uint32_t asyncLevels = OPEN_ASYNC_LEVELS; // 最深的若干层在后台加载，打开时不等待；level-0总是等待
+    bool lazyLoading = false; // 打开时即按需加载，只读取每个文件的元信息、过滤器与块索引
+    uint64_t blockCacheBytes = BLOCK_CACHE_BYTES;
+};
+
 // 有关SSTable的相关处理，为了提高速度，提供缓存
 class SSTable{
 public:
@@ -46,36 +251,391 @@ public:
     // 表示各个level的文件数的map
     std::map<uint32_t, uint64_t> levelFileNum;
 
+    // 新生成的SSTable中过滤器每个键分配的位数
+    uint32_t bitsPerKey = BLOOM_BITS_PER_KEY;
+
+    // 各层新生成的SSTable使用的过滤器策略，未设置的层使用defaultFilterPolicy
+    std::map<uint32_t, FilterPolicy> filterPolicy;
+    FilterPolicy defaultFilterPolicy = FILTER_POLICY_BLOOM;
+
+    /*
+     * 按层分配过滤器内存（Monkey）
+     * 在总内存预算下最小化不存在的键的期望I/O，浅层的每键位数多，最深层少，甚至不分配
+     * filterMemoryBudget为总字节数，为0时取bitsPerKey乘以各层容量，即与均匀分配内存相同
+     * 默认各层均匀使用bitsPerKey，由setFilterBudget开启
+     */
+    bool monkeyAllocation = false;
+    uint64_t filterMemoryBudget = 0;
+    std::map<uint32_t, double> levelBitsPerKey; // 各层每键位数
+    std::map<uint32_t, double> levelProjectedRate; // 各层按分配结果估计的误报率
+    std::map<uint32_t, FilterStats> filterStats; // 各层实际的查询统计，由rebalance_filters在独占锁下为每层创建
+
+    // 是否为新生成的SSTable构建范围过滤器，以及前缀的粒度
+    bool rangeFilterEnabled = false;
+    uint32_t rangeFilterBits = RANGE_FILTER_PREFIX_BITS;
+    ScanStats scanStats;
+
+    // 新生成或读入的SSTable使用的内存索引
+    IndexType indexType = INDEX_BINARY;
+
+    // 是否以帧参考位压缩的形式缓存键、偏移量与值长度，启用时不再构建其他内存索引
+    bool packedMetadata = false;
+
+    /*
+     * 按需加载
+     * 启用时每个SSTable只常驻头部、过滤器与每块的首键，元组按块从硬盘读入块缓存
+     * level-0的块以高优先级缓存，过滤器始终常驻，内存上限由块缓存的容量决定，与数据量无关
+     */
+    bool lazyLoading = false;
+    BlockCache blockCache;
+    std::atomic<uint64_t> nextTableId{1}; // 打开时由多个线程分配
+
+    /*
+     * SSTable集合的版本日志，文件名为level-N/<文件编号>.sst
+     * syncWrites为真时新文件、vLog与日志记录都在落盘后才使用，合并的输入文件在记录落盘后才删除
+     */
+    Manifest manifest;
+    bool syncWrites = true;
+
+    // 刷写、合并与GC写入SSTable与vLog时共用的限速器，刷写优先；在线程池之前声明，析构时合并已经结束
+    RateLimiter rateLimiter;
+
+    /*
+     * 新生成的SSTable的格式，以及v2及以后的格式下合并生成的文件的键数
+     * v4格式的文件通过mmap打开，键、偏移量、值长度与过滤器都直接在映射上使用，不构建内存索引，也不经过块缓存
+     */
+    uint32_t tableFormat = TABLE_FORMAT_V2;
+    uint64_t tableKeyNumber = MAX_KEY_NUMBER * TABLE_KEY_FACTOR;
+
+    // 各层新生成的SSTable的数据块压缩选项，未设置的层不压缩；只对v2格式有效，压缩后的文件为v3格式
+    std::map<uint32_t, CompressionOptions> blockCompression;
+
+    /*
+     * 后台合并
+     * 写入level-0后只把溢出的层交给线程池，按溢出程度从高到低执行，涉及的两层互不重叠的任务可以同时进行
+     * 合并期间读操作看到合并前的版本；新文件落盘并记入MANIFEST后，才在独占锁下一次性替换输入文件
+     * level-0的文件数达到l0SlowdownFiles时每次写入level-0后暂停，达到l0StopFiles时等待合并，写入不再等待整个级联合并
+     * compactionThreads为0时在写入时同步合并
+     */
+    uint32_t compactionThreads = COMPACTION_THREADS;
+    uint64_t l0SlowdownFiles = L0_SLOWDOWN_FILES;
+    uint64_t l0StopFiles = L0_STOP_FILES;
+    WriteStallStats stallStats;
+
+    /*
+     * 子合并
+     * 输入较多时按输入文件的键区间把一次合并切分为互不相交的若干段，各段并行归并并写入各自的文件，最后作为一条版本变更提交
+     * 第一段在合并线程中执行，其余各段交给subcompactionPool；各合并共用这maxSubcompactions - 1个线程，线程总数有界
+     */
+    uint32_t maxSubcompactions = MAX_SUBCOMPACTIONS;
+    std::atomic<uint64_t> subcompactions{0}; // 累计执行的子合并数，多个合并线程同时累加
+    WriteAmpStats writeAmpStats;
+
+    /*
+     * 合并时跳过被覆盖的旧版本；输出层以下没有文件覆盖某个键时，该键的删除标记也不再写出
+     * 更深的层只会从更浅的层得到文件，而合并涉及的两层在合并期间不会有其他合并，选择输入时记下的更深层键区间始终有效
+     * 丢弃的旧版本在vLog中的字节计入garbageStats，vlogTail之前的字节已被GC回收，不再计入
+     */
+    GarbageStats garbageStats;
+    std::atomic<uint64_t> vlogTail{0};
+
+    // GC回收了bytes字节的无效值，从估计的可回收字节数中扣除
+    void release_garbage(uint64_t bytes);
+
+    /*
+     * 合并策略
+     * picker决定各层何时溢出、选出多少个文件以及是否重写下一层重叠的文件，其余步骤各策略共用
+     * compactionFanout为相邻两层文件数容量之比；dynamicLevelBytes只对分层合并有效，按最深层的实际字节数确定各层目标
+     */
+    CompactionStyle compactionStyle = COMPACTION_LEVELED;
+    uint32_t compactionFanout = COMPACTION_FANOUT;
+    bool dynamicLevelBytes = false;
+    std::unique_ptr<CompactionPicker> picker;
+
+    /*
+     * 分层合并只取一层中的部分文件时，compactionPriority决定取哪些，默认按时间戳取最旧的文件
+     * 另外两种按键的顺序取连续的若干个文件，使输入的键区间紧凑；游标记录每层上一次合并到的位置，使整个键空间被轮流合并
+     * 文件只有一个时间戳，读操作依赖每层的文件都不比下一层旧；选中的文件比本层剩下的新时，输出的时间戳压低到剩下的文件中最小者，
+     * 此时不能原样移动文件，照常重写；没有与本层其余文件都不重叠的候选时退回按时间戳选择
+     */
+    CompactionPriority compactionPriority = COMPACTION_PRI_OLDEST;
+    std::map<uint32_t, uint64_t> compactCursor; // 各层下一次合并开始的键
+    std::map<uint32_t, PickStats> pickStats;
+
+    /*
+     * 查找触发的合并（参照LevelDB的allowed_seeks）
+     * 点查询检查了键区间覆盖它的文件、却没有从该文件得到结果时，记为该文件的一次无效探查：过滤器的否定与误报、
+     * 找到的版本又被更新的文件覆盖，都白白花费了过滤器查询或二分查找
+     * 无效探查达到预算max(seekMinProbes, 文件字节数 / seekBytesPerProbe)的文件成为候选，即使各层都未溢出，
+     * 也与本层和它重叠的文件一起合并到下一层；不论合并策略都重写下一层中重叠的文件，使反复被读到的重叠区间合并为更少的文件
+     * 同一时刻最多一个候选；最深层的文件下面没有可合并的层，不作为候选；文件移动后计数从0开始
+     * 默认关闭，由setSeekCompaction开启
+     */
+    bool seekCompaction = false;
+    uint64_t seekMinProbes = SEEK_COMPACTION_MIN_PROBES;
+    uint64_t seekBytesPerProbe = SEEK_COMPACTION_BYTES_PER_PROBE;
+    std::map<uint32_t, SeekStats> seekStats;
+    std::mutex seekMutex; // 保护候选与seekStats，在versionMutex之后获取
+    std::atomic<bool> seekPending{false}; // 存在候选，读操作不加锁检查
+    std::atomic<bool> seekTriggered{false}; // 产生了新的候选，尚未提交合并
+    uint32_t seekLevel = 0; // 候选所在的层与文件编号
+    uint64_t seekFile = 0;
+
+    // cacheTable允许的无效探查次数
+    uint64_t seek_budget(const CacheTable &cacheTable) const;
+
+    // 第level层以下是否还有文件，调用者持有锁
+    bool has_deeper_files(uint32_t level) const;
+
+    // 按本次点查询检查过的文件累加无效探查，answer为得到结果的文件，没有时为空；调用者持有共享锁
+    void charge_probes(const std::vector<std::pair<uint32_t, const CacheTable *>> &probed, const CacheTable *answer);
+
+    // 取出第level层的候选与本层和它重叠的文件，时间戳相同时编号大的在前；候选已不在本层时丢弃它，调用者持有独占锁
+    bool select_seek_file(uint32_t level, std::vector<std::pair<std::string, CacheTable>> &selected);
+
+    // 读操作产生了新的候选时调用：同步合并，或交给后台线程；调用者不持有锁
+    void schedule_seek_compaction();
+
+    // 输出各层的无效探查、候选与查找触发的合并次数，以及探查最多的文件
+    void seek_report(std::ostream &os);
+
+    /*
+     * level-0的键区间分区
+     * 每个分区有自己的Memtable，写满后交给后台刷写，各分区的刷写可以同时进行；level-0溢出时只合并文件最多的分区及与之重叠的文件
+     * l0Bounds为第二个及以后各分区的起始键，按第一次写满的Memtable与已有文件的键确定；l0Partitions为1时不分区，l0Bounds为空
+     * 时间戳在Memtable写满时分配，各分区的刷写不一定按时间戳的顺序完成；flushingStamps记录尚未放入level-0的时间戳，
+     * level-0合并的输出不超过其中最小者，刷写完成后level-0的文件仍不比下一层旧
+     */
+    uint32_t l0Partitions = L0_PARTITIONS;
+    std::vector<uint64_t> l0Bounds; // 在独占锁下修改，前台不加锁读取
+    std::multiset<uint64_t> flushingStamps; // 在独占锁下修改
+
+    // key所在的分区
+    uint32_t partition_of(uint64_t key) const;
+
+    // 按keys的分位数确定各分区的起始键，keys之外还计入已有文件的最小键与最大键
+    void set_partition_bounds(std::vector<uint64_t> keys);
+
+    // 取出level-0中文件最多的分区的文件及与之重叠的文件，时间戳相同时编号大的在前；不分区时返回false，调用者持有独占锁
+    bool select_partition(uint32_t level, std::vector<std::pair<std::string, CacheTable>> &selected);
+
+    // 把已写入vLog的Memtable写入level-0并在MANIFEST中记录，timeStamp为写满时分配的时间戳；写入或记录失败时删除文件并返回false
+    bool flush_table(const std::string &path, CacheTable &cacheTable, uint64_t timeStamp, const std::string &vlogPath, IOPriority priority);
+
+    // 把flush_table交给刷写线程，完成后调用done并检查合并；quiesce与wait_compactions也等待刷写结束
+    // 连续失败FLUSH_MAX_RETRIES次后放弃，以false调用done，时间戳保留在flushingStamps中，由调用者同步重试
+    void flush_async(std::shared_ptr<CacheTable> cacheTable, uint64_t timeStamp, const std::string &vlogPath, IOPriority priority, std::function<void(bool)> done);
+
+    // 等待后台任务结束后修改刷写线程数，为0时由调用者同步刷写
+    void set_flush_threads(uint32_t threads);
+
+    bool background_flush() const { return flushPool != nullptr; }
+
+    // 等待后台任务结束后修改分区数，清除分界，level-0的容量为每个分区两个文件，其余各层按扇出推算
+    void set_l0_partitions(uint32_t partitions);
+
+    /*
+     * 分段布局（COMPACTION_GUARDED）的守卫键
+     * 键的哈希值末尾有b个0时，它是守卫位数不超过b的各层的守卫；level-1需要GUARD_TOP_BITS位，每深一层少log2(扇出)位，不少于GUARD_MIN_BITS
+     * 因此较深的层守卫更密，且每层的守卫也是所有更深层的守卫；守卫从写入level-0的键中采样，按位数分别保存
+     * 守卫不写入MANIFEST，切换到该策略时从已有的文件中重新采样，只影响片段的切分位置，不影响读到的版本
+     */
+    std::map<uint32_t, std::set<uint64_t>> guards; // <位数，守卫键>
+    std::map<uint32_t, GuardIndex> guardIndex; // level-1及以下各层的读索引，只在分段布局下存在
+
+    // 按cacheMap重建第level层的读索引，调用者持有独占锁
+    void build_guard_index(uint32_t level);
+
+    // 第level层的守卫位数
+    uint32_t guard_bits(uint32_t level) const;
+
+    // 第level层的守卫键，调用者持有锁
+    const std::set<uint64_t> &level_guards(uint32_t level) const;
+
+    // 从cacheTable的键中采样守卫，按需加载的文件只采样各块的首键；调用者持有独占锁
+    void sample_guards(const CacheTable &cacheTable);
+
+    // 等待后台任务结束后更换策略，并按新的扇出重新计算各层容量
+    void set_compaction_style(CompactionStyle style, uint32_t fanout, bool dynamic);
+
+    // 保护cacheMap与levelFileNum，读操作持共享锁，合并只在选择输入与替换文件时持独占锁
+    std::shared_mutex versionMutex;
+
     SSTable();
 
+    ~SSTable();
+
     bool get(uint64_t key, std::string &value, vLog &vlog, uint64_t &offset);
 
-    bool getByOne(CacheTable cacheTable, uint64_t key, std::string &value, vLog &vlog, uint64_t &offset);
+    bool getByOne(const CacheTable &cacheTable, uint32_t level, uint64_t key, std::string &value, vLog &vlog, uint64_t &offset);
 
-    void scan(uint64_t k1,uint64_t k2, 
-        std::map<uint64_t, std::string> &map, std::map<uint64_t, uint64_t> &timeStamp, vLog &vlog);
+    // 在单个SSTable中查找键对应的偏移量与值长度，不检查过滤器
+    bool find_cell(const CacheTable &cacheTable, uint32_t level, uint64_t key, uint64_t &offset, uint32_t &vlen);
 
-    void scanByOne(CacheTable cacheTable, uint64_t k1, uint64_t k2, 
-        std::map<uint64_t, std::string> &map, std::map<uint64_t, uint64_t> &timeStamp, vLog &vlog);
+    // 扫描[k1, k2]时要访问的文件：键区间与之重叠、且未被范围过滤器否定，记入scanStats
+    // 按同一个键的版本的优先级排列，即时间戳从新到旧、层从浅到深、同一层编号从大到小，与get一致；调用者持有共享锁
+    // 扫描由Iterator以堆归并这些文件与Memtable完成
+    void scan_tables(uint64_t k1, uint64_t k2, std::vector<std::pair<uint32_t, const CacheTable *>> &tables);
 
-    // TODO:使用优先级队列进行扫描操作
-    // std::map<uint64_t, std::string> scanWithHeap(uint64_t k1,uint64_t k2, vLog &vlog){ };
+    // cacheMap中有文件被删除时加一，迭代器持有的文件指针随之失效，需要重建；在独占锁下修改
+    std::atomic<uint64_t> tableVersion{0};
 
+    // 写入level-0后调用：同步合并，或把溢出的层交给后台线程
     void compaction();
 
-    void select_overflow(std::map<std::string, CacheTable> cacheList, std::vector<std::pair<std::string, CacheTable>> &selected, uint32_t level,
+    // 将第level层溢出的文件与下一层有交集的文件合并到下一层，未溢出时直接返回
+    void compact_level(uint32_t level);
+
+    // 写入level-0后按level-0的文件数暂停或等待合并
+    void throttle_writes();
+
+    // 等待所有后台合并结束，包括由它们触发的后续合并
+    void wait_compactions();
+
+    // 修改后台合并的线程数，为0时改为同步合并
+    void set_compaction_threads(uint32_t threads);
+
+    // 等待后台任务结束后修改一次合并最多切分成的子合并数limit，并相应重建子合并线程
+    void set_subcompactions(uint32_t limit);
+
+    // 等待后台的加载与合并都结束，修改选项前调用
+    void quiesce();
+
+    // 第level层的文件数
+    uint64_t level_files(uint32_t level);
+
+    void select_overflow(const std::map<std::string, CacheTable> &cacheList, std::vector<std::pair<std::string, CacheTable>> &selected, uint64_t selectedNum,
         uint64_t &minKey, uint64_t &maxKey, uint64_t &timeStamp);
 
-    void select_next_level(std::map<std::string, CacheTable> cacheList, std::vector<std::pair<std::string, CacheTable>> &selected, uint32_t level,
+    // 按compactionPriority从第level层选出selectedNum个连续的文件，没有可选的候选时返回false；调用者持有独占锁
+    bool select_window(uint32_t level, uint64_t selectedNum, std::vector<std::pair<std::string, CacheTable>> &selected,
+        uint64_t &minKey, uint64_t &maxKey, uint64_t &timeStamp);
+
+    void select_next_level(const std::map<std::string, CacheTable> &cacheList, std::vector<std::pair<std::string, CacheTable>> &selected, uint32_t level,
         uint64_t minKey, uint64_t maxKey, uint64_t &timeStamp);
 
-    void merge(std::vector<uint64_t> &keyList, std::vector<uint64_t> &offsetList, std::vector<uint32_t> &vlenList,
-    std::vector<CacheTable> &selected);
+    /*
+     * 下一层没有与输入重叠的文件、且输入之间互不重叠时，把输入文件原样移到下一层，不重写
+     * 先在下一层建立硬链接，记录落盘后再删除原文件，任何时刻崩溃都能按MANIFEST找到文件
+     * 建立链接失败时返回false，由调用者照常合并；记录写入失败时删除链接、版本不变，返回true跳过本次合并
+     */
+    bool move_tables(uint32_t level, const std::vector<std::pair<std::string, CacheTable>> &selected);
 
-    void set_sstable(uint64_t timeStamp, std::vector<uint64_t> keyList, std::vector<uint64_t> offsetList, std::vector<uint32_t> vlenList,
-    uint32_t level);
+    // 删除各层目录中不在当前版本里的文件，即崩溃时尚未提交或尚未删除的文件
+    void remove_obsolete_files();
 
+    // 子合并的分界键，各段[boundaries[i - 1], boundaries[i])的键数大致相等；不切分时为空
+    std::vector<uint64_t> subcompaction_boundaries(const std::vector<CacheTable> &selected);
+
+    // 分配新的文件编号，返回level-0中对应的路径
     std::string putNewFile();
 
-    void diskToCache();
+    // 第level层编号为number的文件的路径
+    std::string table_path(uint32_t level, uint64_t number);
+
+    // 落盘并构建内存索引，在edit中记录新增的文件，不放入缓存
+    void prepare_table(uint32_t level, const std::string &path, CacheTable &cacheTable, VersionEdit &edit);
+
+    // 分配文件编号与提交版本变更，前台写入与后台合并共用MANIFEST
+    uint64_t new_file_number();
+
+    // 写入失败时版本不变，调用者删除新生成的文件并保留输入
+    bool log_edit(VersionEdit &edit);
+
+    // 合并生成的每个文件的键数
+    uint64_t table_keys() const;
+
+    /*
+     * 存在MANIFEST时先按其中的元信息为每个文件放入占位项，再由线程池并行读取文件、解码过滤器并构建索引
+     * 只等待较浅的层加载完成，最深的层在后台继续加载；读操作访问尚未加载的文件时直接在调用线程中加载
+     */
+    void diskToCache(const OpenOptions &options = OpenOptions());
+
+    // 读入pending对应的文件，只执行一次
+    void open_pending(PendingTable &pending);
+
+    // 等待cacheTable加载完成，尚未开始时在调用线程中加载
+    void wait_loaded(const CacheTable &cacheTable);
+
+    // 等待所有文件加载完成并回收线程池，删除不存在的文件；合并、重置与修改加载选项前调用
+    void finish_open();
+
+    // 根据已填好键、偏移量与值长度的缓存，按所在层的策略生成过滤器
+    void build_filter(CacheTable &cacheTable, uint32_t level);
+
+    FilterPolicy policy_of(uint32_t level);
+
+    CompressionOptions compression_of(uint32_t level);
+
+    // 按indexType为缓存构建内存索引，使用学习索引时释放键数组；按需加载时只保留每块的首键；v4格式改为映射文件
+    void build_index(CacheTable &cacheTable, const std::string &path, uint32_t level);
+
+    // 通过块缓存取得按需加载的SSTable的第blockIndex块
+    std::shared_ptr<const CellBlock> load_block(const CacheTable &cacheTable, uint64_t blockIndex, uint32_t level);
+
+    // 将按需加载的SSTable的元组全部读回内存，合并前调用
+    void materialize(CacheTable &cacheTable);
+
+    // 层数或容量变化后重新计算各层的每键位数
+    void rebalance_filters();
+
+    // 输出各层的分配结果、估计与实际的误报率
+    void filter_report(std::ostream &os);
+
+    // 输出扫描时范围过滤器跳过的文件数
+    void scan_report(std::ostream &os);
+
+    // 输出缓存的元数据与过滤器占用的内存
+    void memory_report(std::ostream &os);
+
+    // 输出各层的文件数与有序段数、读写与空间放大，以及写入受到的限制
+    void compaction_report(std::ostream &os);
+
+    // 将缓存的SSTable按指定格式序列化并写入硬盘，同时记录各块的首键与位置；给出limiter时按priority申请令牌；写入失败时返回false
+    static bool write_table(const std::string &path, CacheTable &cacheTable, uint32_t format,
+        const CompressionOptions &compression = CompressionOptions(), RateLimiter *limiter = nullptr, IOPriority priority = IO_PRIORITY_LOW);
+
+    // 从硬盘读取SSTable到缓存，根据文件末尾的魔数区分格式，兼容旧格式；文件不存在或为空时返回false
+    // cells为false时只读取元信息、过滤器与块索引，不解码元组，按需加载时只接触文件中的这几段
+    static bool read_table(const std::string &path, CacheTable &cacheTable, bool cells = true);
+
+    static bool write_table_v2(const std::string &path, CacheTable &cacheTable, const CompressionOptions &compression,
+        RateLimiter *limiter, IOPriority priority);
+
+    static void read_table_v2(char *init, uint64_t fileSize, CacheTable &cacheTable, bool cells);
+
+    static bool write_table_v4(const std::string &path, CacheTable &cacheTable, RateLimiter *limiter, IOPriority priority);
+
+    // 只读取尾部并设置指向映射的指针，与键数无关，不复制任何数组
+    static void map_table_v4(std::shared_ptr<MappedFile> file, CacheTable &cacheTable);
+
+    // v1格式每LAZY_BLOCK_CELLS个元组划为一块，块的首键从init中cellStart起的元组读出
+    static void v1_block_index(CacheTable &cacheTable, const char *init, uint64_t cellStart);
+
+    // 从硬盘读取按需加载的SSTable的第blockIndex块
+    static std::shared_ptr<const CellBlock> read_block(const CacheTable &cacheTable, uint64_t blockIndex);
+
+private:
+    void load_pending(PendingTable &pending);
+
+    // 调用者持有compactionMutex
+    void schedule_compactions();
+
+    void run_compaction(uint32_t level);
+
+    std::mutex manifestMutex;
+    std::mutex openMutex;
+    std::mutex compactionMutex; // 保护以下合并状态
+    std::condition_variable compactionDone;
+    std::set<uint32_t> busyLevels; // 正在合并的层
+    uint32_t runningJobs = 0;
+    bool compactionStopping = false;
+    std::unique_ptr<ThreadPool> subcompactionPool; // 子合并只由合并任务提交，在compactionPool之前声明，晚于它回收
+    std::unique_ptr<ThreadPool> compactionPool;
+    uint32_t runningFlushes = 0; // 在compactionMutex下修改
+    std::unique_ptr<ThreadPool> flushPool; // 刷写完成后会提交合并，在compactionPool之后声明，先于它回收
+
+    // 打开时的工作线程，最后声明，析构时最先回收，后台任务结束前缓存仍然有效
+    std::unique_ptr<ThreadPool> openPool;
+    bool opening = false; // 仍有文件可能未加载
 };
\ No newline at end of file
@@ -0,0 +1,59 @@
+#include "tablebuilder.h"
+
+TableBuilder::TableBuilder(SSTable &sstable, uint32_t level, uint64_t timeStamp, VersionEdit &edit,
+    std::vector<std::pair<std::string, CacheTable>> &outputs, const std::vector<uint64_t> *cuts)
+    : sstable(sstable), level(level), timeStamp(timeStamp), tableKeys(sstable.table_keys()), edit(edit), outputs(outputs), cuts(cuts)
+{
+}
+
+void TableBuilder::add(uint64_t key, uint64_t offset, uint32_t vlen)
+{
+    if(cuts && nextCut < cuts->size() && key >= (*cuts)[nextCut]){
+        if(!current.keyList.empty()){
+            flush();
+        }
+        nextCut = std::upper_bound(cuts->begin(), cuts->end(), key) - cuts->begin();
+    }
+    if(current.keyList.empty()){
+        current.keyList.reserve(tableKeys);
+        current.offsetList.reserve(tableKeys);
+        current.vlenList.reserve(tableKeys);
+    }
+    current.keyList.push_back(key);
+    current.offsetList.push_back(offset);
+    current.vlenList.push_back(vlen);
+    if(current.keyList.size() >= tableKeys){
+        flush();
+    }
+}
+
+bool TableBuilder::finish()
+{
+    if(!current.keyList.empty()){
+        flush();
+    }
+    return !failed;
+}
+
+void TableBuilder::flush()
+{
+    CacheTable cacheTable;
+    cacheTable.timeStamp = timeStamp;
+    cacheTable.KVNumber = current.keyList.size();
+    cacheTable.minKey = current.keyList.front();
+    cacheTable.maxKey = current.keyList.back();
+    cacheTable.keyList.swap(current.keyList);
+    cacheTable.offsetList.swap(current.offsetList);
+    cacheTable.vlenList.swap(current.vlenList);
+    // 计算过滤器
+    sstable.build_filter(cacheTable, level);
+    std::string path = sstable.table_path(level, sstable.new_file_number());
+
+    // 写入硬盘
+    if(SSTable::write_table(path, cacheTable, sstable.tableFormat, sstable.compression_of(level), &sstable.rateLimiter, IO_PRIORITY_LOW)){
+        sstable.prepare_table(level, path, cacheTable, edit);
+    } else {
+        failed = true;
+    }
+    outputs.emplace_back(path, std::move(cacheTable));
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "sstable.h"
+
+/*
+ * 流式生成合并的输出文件
+ * 按键的顺序逐个加入元组，每满一个文件的键数就构建过滤器、写入硬盘并开始下一个文件
+ * 内存中只保留正在生成的一个文件的元组，与合并的总键数无关
+ * 生成的文件记入edit并放入outputs，由调用者提交后放入缓存
+ * 给出切分点时，键越过下一个切分点就提前写出当前文件，使每个文件都不跨过切分点
+ */
+class TableBuilder{
+private:
+    SSTable &sstable;
+    uint32_t level;
+    uint64_t timeStamp;
+    uint64_t tableKeys; // 每个文件的键数
+    VersionEdit &edit;
+    std::vector<std::pair<std::string, CacheTable>> &outputs;
+    CacheTable current; // 正在生成的文件
+    const std::vector<uint64_t> *cuts; // 升序的切分点，可以为空指针
+    uint64_t nextCut = 0; // cuts中第一个大于已加入的键的位置
+    bool failed = false; // 有文件写入失败，仍放入outputs，由调用者删除
+
+    // 写出当前文件
+    void flush();
+
+public:
+    TableBuilder(SSTable &sstable, uint32_t level, uint64_t timeStamp, VersionEdit &edit,
+        std::vector<std::pair<std::string, CacheTable>> &outputs, const std::vector<uint64_t> *cuts = nullptr);
+
+    // 键必须严格递增
+    void add(uint64_t key, uint64_t offset, uint32_t vlen);
+
+    // 写出最后一个不满的文件，有文件写入失败时返回false
+    bool finish();
+};
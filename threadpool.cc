@@ -0,0 +1,47 @@
+#include "threadpool.h"
+
+ThreadPool::ThreadPool(uint32_t threads)
+{
+    for(uint32_t i = 0; i < threads; i++){
+        workers.emplace_back(&ThreadPool::work, this);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for(auto &worker : workers){
+        worker.join();
+    }
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push(std::move(task));
+    }
+    wake.notify_one();
+}
+
+// 队列为空且已停止时退出
+void ThreadPool::work()
+{
+    while(true){
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this]{ return stopping || !tasks.empty(); });
+            if(tasks.empty()){
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop();
+        }
+        task();
+    }
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "global.h"
+
+/*
+ * 固定数目的工作线程与先进先出的任务队列
+ * 任务按提交顺序开始执行；析构时先执行完队列中剩余的任务，再回收线程
+ */
+class ThreadPool{
+private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    void work();
+
+public:
+    explicit ThreadPool(uint32_t threads);
+
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    void submit(std::function<void()> task);
+
+    uint32_t size() const { return workers.size(); }
+};
@@ -1,16 +1,12 @@
 #include "vlog.h"
 #include <iostream>
 
-// 实现memtable将数据写入vLog，并返回偏移量数组
-std::vector<uint64_t> vLog::addNewEntrys(std::vector<Entry> entries, uint64_t length)
+// 实现memtable将数据写入vLog，并得到偏移量数组
+bool vLog::addNewEntrys(const std::vector<Entry> &entries, uint64_t length, std::vector<uint64_t> &offset, RateLimiter *limiter, IOPriority priority)
 {
-    std::fstream file;
-    file.open(path, std::fstream::out | std::fstream::binary | std::fstream::app);
-    file.seekp(0, std::ios::end); // head指针在文件结尾
-    head = file.tellp(); // 获取head指针
     char* bytes = new char[length * 4];
     char* init = bytes;
-    std::vector<uint64_t> offset; // 偏移量
+    offset.clear(); // 偏移量
     // 遍历entries，将他们加入到bytes这一个缓存的char数组
     for(auto &it : entries){
         // 注意提供的entries是包含了删除项的(防止offset不对齐)
@@ -19,31 +15,125 @@ std::vector<uint64_t> vLog::addNewEntrys(std::vector<Entry> entries, uint64_t le
             offset.push_back(0);
             continue;
         }
-        offset.push_back(head + (bytes - init)); // 计算偏移量
+        offset.push_back(bytes - init); // 计算相对于写入位置的偏移量
         char_to_byte(it.magic, &bytes);
         uint16_to_byte(it.checkNum, &bytes);
         uint64_to_byte(it.key, &bytes);
         uint32_to_byte(it.vlen, &bytes);
         string_to_byte(it.value, &bytes);
     }
-    file.write(init, length);
-    file.close();
+    // 追加到文件结尾，head指针为写入的位置；失败时偏移量没有意义
+    bool written = append_file(path, init, length, head, limiter, priority);
     delete [] init;
-    return offset;
+    if(!written){
+        return false;
+    }
+    for(uint64_t i = 0; i < entries.size(); i++){
+        if(entries[i].vlen != 0){
+            offset[i] += head;
+        }
+    }
+    return true;
 }
 
 // 根据偏移量和值长度找到相应的值
-std::string vLog::get(uint64_t offset, uint32_t vlen)
+bool vLog::get(uint64_t offset, uint32_t vlen, std::string &value)
 {
     std::fstream file;
     file.open(path, std::fstream::in | std::fstream::binary);
     file.seekg(offset + VLOG_ENTRY_HEAD, std::ios::beg); // 根据偏移量定位到对应的entry
-    char *val = new char[vlen];
-    file.read(val,vlen); // 根据值长度读取
+    if(vlen & VLOG_COMPRESSED_FLAG){
+        // 读入与解压都使用复用的缓冲区
+        thread_local std::string stored;
+        stored.resize(stored_length(vlen));
+        bool complete = (bool)file.read(&stored[0], stored.size());
+        file.close();
+        return complete && decode_value(stored, vlen, value);
+    }
+    value.resize(vlen);
+    bool complete = (bool)file.read(&value[0], vlen); // 根据值长度读取
+    file.close();
+    return complete;
+}
+
+uint32_t vLog::encode_value(const std::string &value, std::string &stored)
+{
+    auto it = valueCompression.upper_bound(value.length());
+    if(it == valueCompression.begin() || std::prev(it)->second.type == COMPRESSION_NONE){
+        stored = value;
+        return value.length();
+    }
+    uint32_t sizeClass = std::prev(it)->first;
+    const CompressionOptions &options = std::prev(it)->second;
+
+    // 使用字典的类先收集样本，样本足够后训练字典并持久化
+    uint32_t dictId = 0;
+    if(options.dictionary){
+        if(classDictionary.find(sizeClass) != classDictionary.end()){
+            dictId = classDictionary[sizeClass];
+        } else {
+            dictSamples[sizeClass].push_back(value);
+            dictSampleBytes[sizeClass] += value.length();
+            if(dictSampleBytes[sizeClass] >= VLOG_DICT_SAMPLE_BYTES){
+                std::string dict = Compressor::train_dictionary(dictSamples[sizeClass], VLOG_DICT_BYTES);
+                dictSamples.erase(sizeClass);
+                dictSampleBytes.erase(sizeClass);
+                dictId = dictionaries.size();
+                dictionaries.push_back(dict);
+                classDictionary[sizeClass] = dictId;
+                std::fstream file;
+                file.open(path + ".dict", std::fstream::out | std::fstream::binary | std::fstream::app);
+                uint32_t length = dict.length();
+                file.write(reinterpret_cast<char *>(&length), sizeof(uint32_t));
+                file.write(dict.data(), length);
+                file.close();
+            }
+        }
+    }
+
+    stored.clear();
+    Compressor::encode(options, value.data(), value.length(), stored, dictId, dictId ? &dictionaries[dictId] : nullptr);
+    if(stored.length() >= value.length()){
+        stored = value;
+        return value.length();
+    }
+    return stored.length() | VLOG_COMPRESSED_FLAG;
+}
+
+bool vLog::decode_value(const std::string &stored, uint32_t vlen, std::string &value)
+{
+    if(!(vlen & VLOG_COMPRESSED_FLAG)){
+        value = stored;
+        return true;
+    }
+    return Compressor::decode(stored.data(), stored.length(), value, &dictionaries);
+}
+
+// 读入已持久化的字典，新训练的字典编号接在其后
+void vLog::load_dictionaries()
+{
+    dictionaries.assign(1, "");
+    std::fstream file;
+    file.open(path + ".dict", std::fstream::in | std::fstream::binary);
+    if(!file.is_open()){
+        return;
+    }
+    uint32_t length;
+    while(file.read(reinterpret_cast<char *>(&length), sizeof(uint32_t))){
+        std::string dict(length, 0);
+        if(!file.read(&dict[0], length)) break;
+        dictionaries.push_back(dict);
+    }
     file.close();
-    std::string result = std::string(val,vlen);
-    delete [] val;
-    return result;
+}
+
+void vLog::clear_dictionaries()
+{
+    utils::rmfile(path + ".dict");
+    dictionaries.assign(1, "");
+    classDictionary.clear();
+    dictSamples.clear();
+    dictSampleBytes.clear();
 }
 
 /*
@@ -65,6 +155,7 @@ void vLog::garbageCollection(uint64_t chunk_size, Skiplist &memtable)
 // 用于初始化
 void vLog::setHeadAndTail()
 {
+    load_dictionaries();
     // 根据文件大小设置head
     std::fstream file;
     file.open(path, std::fstream::in | std::fstream::binary);
@@ -93,9 +184,9 @@ void vLog::setHeadAndTail()
 
 		    file.read(reinterpret_cast<char*>(&entry.key),sizeof(uint64_t));
 		    file.read(reinterpret_cast<char*>(&entry.vlen), sizeof(uint32_t));
-		    char* buffer = new char[entry.vlen];
-		    file.read(buffer, entry.vlen);
-		    entry.value = std::string(buffer, entry.vlen);
+		    char* buffer = new char[stored_length(entry.vlen)];
+		    file.read(buffer, stored_length(entry.vlen));
+		    entry.value = std::string(buffer, stored_length(entry.vlen));
 		    delete [] buffer;
 
             std::vector<unsigned char> data;
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "global.h"
+#include "compressor.h"
 
 // 展示单个vLog entry
 struct Entry{
@@ -20,9 +21,37 @@ public:
 
     std::string path; // vLog文件的路径
 
-    std::vector<uint64_t> addNewEntrys(std::vector<Entry> entries, uint64_t length); // 实现memtable将数据写入vLog，返回偏移量
+    // 实现memtable将数据写入vLog，偏移量写入offset；给出limiter时按priority申请令牌；写入失败时返回false
+    bool addNewEntrys(const std::vector<Entry> &entries, uint64_t length, std::vector<uint64_t> &offset, RateLimiter *limiter = nullptr, IOPriority priority = IO_PRIORITY_HIGH);
     
-    std::string get(uint64_t offset, uint32_t vlen);
+    // 读出偏移量处的值，读取不完整或解码失败时返回false
+    bool get(uint64_t offset, uint32_t vlen, std::string &value);
 
     void setHeadAndTail();
+
+    /*
+     * 按值长度分类压缩
+     * 键为该类值长度的下限，值长度不小于某个键时使用其中最大键的选项
+     * 压缩后的值在vlen的最高位置1，vLog中存放的是压缩层的编码结果
+     */
+    std::map<uint32_t, CompressionOptions> valueCompression;
+
+    // 训练出的字典，编号0表示不使用字典；字典追加写入path + ".dict"，重启后据此解码
+    std::vector<std::string> dictionaries{""};
+    std::map<uint32_t, uint32_t> classDictionary; // 每类值使用的字典编号
+    std::map<uint32_t, std::vector<std::string>> dictSamples; // 尚未训练字典的类收集的样本
+    std::map<uint32_t, uint64_t> dictSampleBytes;
+
+    // 按值长度所属的类编码值，返回写入SSTable的vlen
+    uint32_t encode_value(const std::string &value, std::string &stored);
+
+    // 还原vLog中存放的值，数据损坏时返回false
+    bool decode_value(const std::string &stored, uint32_t vlen, std::string &value);
+
+    // vLog中实际存放的字节数
+    static uint32_t stored_length(uint32_t vlen) { return vlen & ~(uint32_t)VLOG_COMPRESSED_FLAG; }
+
+    void load_dictionaries();
+
+    void clear_dictionaries();
 };
\ No newline at end of file
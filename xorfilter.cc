@@ -0,0 +1,144 @@
+#include "xorfilter.h"
+
+#define XOR_MAX_ATTEMPTS 64 // 构建失败时换种子重试的最大次数
+
+template <typename FingerPrint>
+uint64_t XorFilter<FingerPrint>::hash(uint64_t key) const
+{
+    return fmix64(key + seed);
+}
+
+// 将哈希旋转后的低32位映射到段内，第index段的起点为index * blockLength
+template <typename FingerPrint>
+uint32_t XorFilter<FingerPrint>::slot(uint64_t hash, int index) const
+{
+    uint32_t part = (uint32_t)(index == 0 ? hash : rotl64(hash, 21 * index));
+    return (uint32_t)(((uint64_t)part * blockLength) >> 32) + index * blockLength;
+}
+
+template <typename FingerPrint>
+FingerPrint XorFilter<FingerPrint>::fingerprint(uint64_t hash) const
+{
+    return (FingerPrint)(hash ^ (hash >> 32));
+}
+
+// 构建过滤器
+template <typename FingerPrint>
+bool XorFilter<FingerPrint>::build(const std::vector<uint64_t> &keyList)
+{
+    uint64_t size = keyList.size();
+    uint64_t capacity = 32 + (uint64_t)(XOR_SIZE_FACTOR * size);
+    blockLength = capacity / 3;
+    capacity = 3 * (uint64_t)blockLength;
+
+    std::vector<uint64_t> xorMask(capacity); // 每个槽上所有键哈希的异或
+    std::vector<uint32_t> count(capacity); // 每个槽上的键数
+    std::vector<uint32_t> queue; // 只有一个键的槽
+    std::vector<std::pair<uint64_t, uint32_t>> stack; // 剥离顺序，<哈希，槽>
+    queue.reserve(capacity);
+    stack.reserve(size);
+
+    uint64_t nextSeed = 0x9e3779b97f4a7c15ULL;
+    for(int attempt = 0; attempt < XOR_MAX_ATTEMPTS; attempt++){
+        seed = fmix64(nextSeed);
+        nextSeed += 0x9e3779b97f4a7c15ULL;
+        std::fill(xorMask.begin(), xorMask.end(), 0);
+        std::fill(count.begin(), count.end(), 0);
+        queue.clear();
+        stack.clear();
+
+        for(auto key : keyList){
+            uint64_t h = hash(key);
+            for(int i = 0; i < 3; i++){
+                uint32_t s = slot(h, i);
+                xorMask[s] ^= h;
+                count[s]++;
+            }
+        }
+        for(uint32_t s = 0; s < capacity; s++){
+            if(count[s] == 1) queue.push_back(s);
+        }
+        // 不断取出只有一个键的槽，将该键从另外两个槽中移除
+        while(!queue.empty()){
+            uint32_t s = queue.back();
+            queue.pop_back();
+            if(count[s] == 0) continue;
+            uint64_t h = xorMask[s];
+            stack.emplace_back(h, s);
+            for(int i = 0; i < 3; i++){
+                uint32_t t = slot(h, i);
+                xorMask[t] ^= h;
+                count[t]--;
+                if(count[t] == 1) queue.push_back(t);
+            }
+        }
+        if(stack.size() == size) break;
+    }
+    if(stack.size() != size){
+        return false;
+    }
+
+    // 按剥离的逆序填入指纹，保证每个键三个槽的异或恰为其指纹
+    fingerprints.assign(capacity, 0);
+    for(auto it = stack.rbegin(); it != stack.rend(); it++){
+        uint64_t h = it->first;
+        fingerprints[it->second] = fingerprint(h)
+            ^ fingerprints[slot(h, 0)] ^ fingerprints[slot(h, 1)] ^ fingerprints[slot(h, 2)];
+    }
+    return true;
+}
+
+// 查询只需访问三个槽
+template <typename FingerPrint>
+bool XorFilter<FingerPrint>::search(uint64_t key) const
+{
+    uint64_t h = hash(key);
+    FingerPrint f = fingerprint(h);
+    const FingerPrint *table = slots();
+    return f == (FingerPrint)(table[slot(h, 0)] ^ table[slot(h, 1)] ^ table[slot(h, 2)]);
+}
+
+// 类型标记、种子、段长与所有指纹
+template <typename FingerPrint>
+uint64_t XorFilter<FingerPrint>::byteSize() const
+{
+    return sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint32_t) + 3 * (uint64_t)blockLength * sizeof(FingerPrint);
+}
+
+template <typename FingerPrint>
+void XorFilter<FingerPrint>::filter_to_byte(char **dst)
+{
+    uint32_to_byte(FILTER_MAGIC | (sizeof(FingerPrint) == 1 ? FILTER_TYPE_XOR8 : FILTER_TYPE_XOR16), dst);
+    uint64_to_byte(seed, dst);
+    uint32_to_byte(blockLength, dst);
+    std::memcpy(*dst, slots(), 3 * (uint64_t)blockLength * sizeof(FingerPrint));
+    (*dst) += 3 * (uint64_t)blockLength * sizeof(FingerPrint);
+}
+
+template <typename FingerPrint>
+void XorFilter<FingerPrint>::byte_to_filter(char **src)
+{
+    seed = byte_to_uint64(src);
+    blockLength = byte_to_uint32(src);
+    fingerprints.resize(3 * (uint64_t)blockLength);
+    std::memcpy(fingerprints.data(), *src, fingerprints.size() * sizeof(FingerPrint));
+    (*src) += fingerprints.size() * sizeof(FingerPrint);
+}
+
+template <typename FingerPrint>
+bool XorFilter<FingerPrint>::map_filter(const char *src, std::shared_ptr<MappedFile> mappedFile)
+{
+    const char *table = src + sizeof(uint64_t) + sizeof(uint32_t);
+    if((uintptr_t)table % alignof(FingerPrint) != 0){
+        return false;
+    }
+    std::memcpy(&seed, src, sizeof(uint64_t));
+    std::memcpy(&blockLength, src + sizeof(uint64_t), sizeof(uint32_t));
+    std::vector<FingerPrint>().swap(fingerprints);
+    mapped = (const FingerPrint *)table;
+    file = mappedFile;
+    return true;
+}
+
+template class XorFilter<uint8_t>;
+template class XorFilter<uint16_t>;
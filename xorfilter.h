@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include "MurmurHash3.h"
+#include "global.h"
+#include "filter.h"
+
+/*
+ * 异或过滤器
+ * 槽数组分为三段，每个键在三段中各对应一个槽，三个槽的指纹异或后等于键的指纹
+ * 构建时通过剥离（peeling）求解，失败则换种子重试；查询只需访问三个槽
+ * 相同误报率下比布隆过滤器节省约30%的空间
+ * FingerPrint为uint8_t时误报率约为1/256，为uint16_t时约为1/65536
+ */
+template <typename FingerPrint>
+class XorFilter : public Filter{
+private:
+    uint64_t seed; // 哈希种子
+    uint32_t blockLength; // 每段的槽数
+    std::vector<FingerPrint> fingerprints; // 共3 * blockLength个槽
+    const FingerPrint *mapped = nullptr; // 映射在文件中的槽，为空时使用fingerprints
+    std::shared_ptr<MappedFile> file; // 保证映射在过滤器存活期间有效
+
+    const FingerPrint *slots() const { return mapped ? mapped : fingerprints.data(); }
+
+    uint64_t hash(uint64_t key) const;
+
+    // 计算键在第index段的槽位置
+    uint32_t slot(uint64_t hash, int index) const;
+
+    FingerPrint fingerprint(uint64_t hash) const;
+
+public:
+    XorFilter() : seed(0), blockLength(0) {}
+
+    // 为一组互不相同的键构建过滤器，键有重复时无法求解，返回false
+    bool build(const std::vector<uint64_t> &keyList);
+
+    bool search(uint64_t key) const override;
+
+    uint64_t byteSize() const override;
+
+    void filter_to_byte(char **dst) override;
+
+    // 调用前类型标记应已被读出
+    void byte_to_filter(char **src);
+
+    // 原地使用映射中的槽，槽未按指纹大小对齐时返回false
+    bool map_filter(const char *src, std::shared_ptr<MappedFile> mappedFile);
+};
+
+typedef XorFilter<uint8_t> XorFilter8;
+typedef XorFilter<uint16_t> XorFilter16;